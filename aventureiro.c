@@ -1,159 +1,530 @@
+#define _POSIX_C_SOURCE 199309L // clock_gettime também com -std=c11
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define GRAU_BTREE 8                        // grau mínimo da árvore de pistas
+#define MAX_CHAVES_BTREE (2 * GRAU_BTREE - 1)
+#define SEM_SALA -1                         // índice de caminho inexistente
+#define TAMANHO_SAIDA (64 * 1024)           // buffer da saída do jogo
 
 // ------------------------------------------------------------
-// Estrutura para representar cada sala da mansão
-// (nó da árvore binária do mapa)
+// Mansão compacta usada durante a exploração (árvore binária)
+// As salas ficam em arrays contíguos em ordem de largura (BFS):
+// os índices dos caminhos (quentes) separados dos textos (frios).
 // ------------------------------------------------------------
-typedef struct Sala {
+typedef struct SalaQuente {
+    int esq;   // índice da sala à esquerda ou SEM_SALA
+    int dir;
+} SalaQuente;
+
+typedef struct SalaFria {
     char nome[50];
-    char pista[100];   // pista opcional
-    struct Sala *esq;
-    struct Sala *dir;
-} Sala;
+    char pista[100];
+} SalaFria;
+
+typedef struct Mansao {
+    int numSalas;
+    const SalaQuente *quentes;
+    const SalaFria *frias;
+} Mansao;
+
+// ------------------------------------------------------------
+// Mapa fixo da mansão, já na forma compacta
+//
+//   Hall de Entrada -> Sala de Estar (e), Cozinha (d)
+//   Sala de Estar   -> Biblioteca (e), Jardim (d)
+//   Cozinha         -> Despensa (e), Sala Secreta (d)
+//
+// As tabelas são constantes e sem ponteiros: ficam na seção
+// somente leitura do executável, sem nenhuma alocação ou cópia
+// ao iniciar, e as páginas são compartilhadas entre processos.
+// ------------------------------------------------------------
+static const SalaQuente quentesPadrao[] = {
+    { 1, 2 },                 // Hall de Entrada
+    { 3, 4 },                 // Sala de Estar
+    { 5, 6 },                 // Cozinha
+    { SEM_SALA, SEM_SALA },   // Biblioteca
+    { SEM_SALA, SEM_SALA },   // Jardim
+    { SEM_SALA, SEM_SALA },   // Despensa
+    { SEM_SALA, SEM_SALA },   // Sala Secreta
+};
+
+static const SalaFria friasPadrao[] = {
+    { "Hall de Entrada", "Pegada de lama" },
+    { "Sala de Estar",   "Copo quebrado" },
+    { "Cozinha",         "Faca fora do lugar" },
+    { "Biblioteca",      "Livro arrancado" },
+    { "Jardim",          "" },
+    { "Despensa",        "Lata caída" },
+    { "Sala Secreta",    "Documento misterioso" },
+};
 
 // ------------------------------------------------------------
-// Estrutura da árvore BST para armazenar pistas coletadas
+// Estrutura da árvore de pistas coletadas (B-tree)
+// Cada nó guarda várias pistas em ordem; os 8 primeiros bytes
+// de cada uma ficam inline para comparar sem seguir ponteiros.
 // ------------------------------------------------------------
 typedef struct PistaNode {
-    char pista[100];
-    struct PistaNode *esq;
-    struct PistaNode *dir;
+    int numChaves;
+    int folha;
+    uint64_t prefixos[MAX_CHAVES_BTREE];
+    char pistas[MAX_CHAVES_BTREE][100];
+    struct PistaNode *filhos[MAX_CHAVES_BTREE + 1];
 } PistaNode;
 
 // ------------------------------------------------------------
-// Função criarSala()
-// Cria dinamicamente uma sala com nome e pista opcional.
+// Saída do jogo: texto para o jogador, nada (--quieto e modo em
+// lote) ou uma linha JSON por evento (--ndjson). Tudo passa por
+// um buffer grande, entregue de uma vez quando enche, antes de
+// ler o teclado e no fim, em vez de um printf por linha.
+// ------------------------------------------------------------
+enum { SAIDA_TEXTO, SAIDA_SILENCIOSA, SAIDA_NDJSON };
+int modoSaida = SAIDA_TEXTO;
+char bufferSaida[TAMANHO_SAIDA];
+size_t usadoSaida = 0;
+long partidaAtual = 0;        // número da partida nos eventos
+
+// ------------------------------------------------------------
+// Modo em lote: os movimentos vêm de um roteiro em memória
+// (ver executarLote()).
+// ------------------------------------------------------------
+const char *roteiro = NULL;   // NULL = movimentos lidos do teclado
+
+// ------------------------------------------------------------
+// Função descarregarSaida()
+// Entrega ao stdout tudo o que está no buffer.
+// ------------------------------------------------------------
+void descarregarSaida(void) {
+    if (usadoSaida == 0) return;
+    fwrite(bufferSaida, 1, usadoSaida, stdout);
+    fflush(stdout);
+    usadoSaida = 0;
+}
+
+// ------------------------------------------------------------
+// Função mostrar()
+// printf do jogo: escreve no buffer, e só no modo texto.
+// ------------------------------------------------------------
+void mostrar(const char *formato, ...) {
+    if (modoSaida != SAIDA_TEXTO) return;
+    va_list args;
+    for (int tentativa = 0; tentativa < 2; tentativa++) {
+        va_start(args, formato);
+        int n = vsnprintf(bufferSaida + usadoSaida, TAMANHO_SAIDA - usadoSaida, formato, args);
+        va_end(args);
+        if (n < 0) return;
+        if ((size_t) n < TAMANHO_SAIDA - usadoSaida) {
+            usadoSaida += (size_t) n;
+            return;
+        }
+        descarregarSaida();   // não coube: esvazia e tenta de novo
+    }
+    va_start(args, formato);  // maior que o buffer inteiro
+    vprintf(formato, args);
+    va_end(args);
+}
+
+// ------------------------------------------------------------
+// Função evento()
+// No modo NDJSON, escreve {"partida":N,"evento":"tipo",...} com
+// os pares campo/valor seguintes (textos, terminados por NULL).
+// ------------------------------------------------------------
+void evento(const char *tipo, ...) {
+    if (modoSaida != SAIDA_NDJSON) return;
+    char linha[1024];
+    size_t n = (size_t) snprintf(linha, sizeof(linha), "{\"partida\":%ld,\"evento\":\"%s\"", partidaAtual, tipo);
+    va_list args;
+    va_start(args, tipo);
+    const char *campo;
+    while ((campo = va_arg(args, const char*)) != NULL) {
+        const unsigned char *valor = va_arg(args, const unsigned char*);
+        int k = snprintf(linha + n, sizeof(linha) - n, ",\"%s\":\"", campo);
+        if (k < 0 || n + (size_t) k + 8 >= sizeof(linha)) break; // Sem espaço: os campos restantes ficam de fora
+        n += (size_t) k;
+        for (; *valor != '\0' && n + 8 < sizeof(linha); valor++) {
+            if (*valor == '"' || *valor == '\\') {
+                linha[n++] = '\\';
+                linha[n++] = (char) *valor;
+            } else if (*valor < 0x20) {
+                n += (size_t) sprintf(linha + n, "\\u%04x", *valor);
+            } else {
+                linha[n++] = (char) *valor;
+            }
+        }
+        linha[n++] = '"';
+    }
+    va_end(args);
+    linha[n++] = '}';
+    linha[n++] = '\n';
+    if (usadoSaida + n > TAMANHO_SAIDA) descarregarSaida();
+    memcpy(bufferSaida + usadoSaida, linha, n);
+    usadoSaida += n;
+}
+
+// ------------------------------------------------------------
+// Função lerOpcao()
+// Lê o próximo caractere que não seja espaço, do roteiro ou do
+// teclado. Retorna 0 quando a entrada acaba.
+// ------------------------------------------------------------
+int lerOpcao(char *opcao) {
+    if (roteiro != NULL) {
+        while (*roteiro != '\0' && isspace((unsigned char) *roteiro)) roteiro++;
+        if (*roteiro == '\0') return 0;
+        *opcao = *roteiro++;
+        return 1;
+    }
+    descarregarSaida();   // o jogador precisa ver a pergunta
+    return scanf(" %c", opcao) == 1;
+}
+
+// ------------------------------------------------------------
+// Funções de navegação na mansão compacta
+// ------------------------------------------------------------
+int mansaoFilho(const Mansao *m, int sala, char direcao) {
+    if (direcao == 'e') return m->quentes[sala].esq;
+    if (direcao == 'd') return m->quentes[sala].dir;
+    return SEM_SALA;
+}
+
+const char* mansaoNome(const Mansao *m, int sala) {
+    return m->frias[sala].nome;
+}
+
+const char* mansaoPista(const Mansao *m, int sala) {
+    return m->frias[sala].pista;
+}
+
+// ------------------------------------------------------------
+// Função prefixoPista()
+// Primeiros 8 bytes da pista como inteiro big-endian: a ordem
+// numérica dos prefixos é a mesma ordem de strcmp.
+// ------------------------------------------------------------
+uint64_t prefixoPista(const char *pista) {
+    uint64_t prefixo = 0;
+    int i = 0;
+    for (; i < 8 && pista[i] != '\0'; i++) {
+        prefixo = (prefixo << 8) | (unsigned char) pista[i];
+    }
+    return i == 0 ? 0 : prefixo << (8 * (8 - i));
+}
+
+// ------------------------------------------------------------
+// Função compararChave()
+// Compara a pista com a chave i do nó (prefixo primeiro).
+// ------------------------------------------------------------
+int compararChave(const PistaNode *no, int i, uint64_t prefixo, const char *pista) {
+    if (prefixo != no->prefixos[i]) {
+        return prefixo < no->prefixos[i] ? -1 : 1;
+    }
+    if ((prefixo & 0xFF) == 0) return 0;   // ambas terminam no prefixo
+    return strcmp(pista + 8, no->pistas[i] + 8);
+}
+
+// ------------------------------------------------------------
+// Função criarNoPistas()
+// Aloca um nó vazio da árvore de pistas.
 // ------------------------------------------------------------
-Sala* criarSala(const char *nome, const char *pista) {
-    Sala *nova = (Sala*) malloc(sizeof(Sala));
-    if (!nova) {
-        printf("Erro de memória ao criar sala.\n");
+PistaNode* criarNoPistas(int folha) {
+    PistaNode *no = (PistaNode*) malloc(sizeof(PistaNode));
+    if (!no) {
+        printf("Erro de memória ao criar nó de pistas.\n");
         exit(1);
     }
-    strcpy(nova->nome, nome);
-    strcpy(nova->pista, pista);
-    nova->esq = NULL;
-    nova->dir = NULL;
-    return nova;
+    no->numChaves = 0;
+    no->folha = folha;
+    return no;
+}
+
+// ------------------------------------------------------------
+// Função dividirFilho()
+// Divide o filho cheio i do pai, promovendo a chave do meio.
+// ------------------------------------------------------------
+void dividirFilho(PistaNode *pai, int i) {
+    PistaNode *cheio = pai->filhos[i];
+    PistaNode *novo = criarNoPistas(cheio->folha);
+
+    novo->numChaves = GRAU_BTREE - 1;
+    memcpy(novo->prefixos, cheio->prefixos + GRAU_BTREE, (GRAU_BTREE - 1) * sizeof(uint64_t));
+    memcpy(novo->pistas, cheio->pistas + GRAU_BTREE, (GRAU_BTREE - 1) * sizeof(novo->pistas[0]));
+    if (!cheio->folha) {
+        memcpy(novo->filhos, cheio->filhos + GRAU_BTREE, GRAU_BTREE * sizeof(PistaNode*));
+    }
+    cheio->numChaves = GRAU_BTREE - 1;
+
+    memmove(pai->filhos + i + 2, pai->filhos + i + 1, (pai->numChaves - i) * sizeof(PistaNode*));
+    memmove(pai->prefixos + i + 1, pai->prefixos + i, (pai->numChaves - i) * sizeof(uint64_t));
+    memmove(pai->pistas + i + 1, pai->pistas + i, (pai->numChaves - i) * sizeof(pai->pistas[0]));
+    pai->filhos[i + 1] = novo;
+    pai->prefixos[i] = cheio->prefixos[GRAU_BTREE - 1];
+    strcpy(pai->pistas[i], cheio->pistas[GRAU_BTREE - 1]);
+    pai->numChaves++;
 }
 
 // ------------------------------------------------------------
 // Função inserirPista()
-// Insere uma pista na BST em ordem alfabética.
+// Insere uma pista na árvore em ordem alfabética. A árvore se
+// mantém balanceada (altura O(log n)) e a descida é iterativa.
+// Uma pista que já está na árvore não é inserida de novo.
 // ------------------------------------------------------------
 PistaNode* inserirPista(PistaNode *raiz, const char *pista) {
+    uint64_t prefixo = prefixoPista(pista);
+
     if (raiz == NULL) {
-        PistaNode *nova = (PistaNode*) malloc(sizeof(PistaNode));
-        strcpy(nova->pista, pista);
-        nova->esq = nova->dir = NULL;
-        return nova;
+        raiz = criarNoPistas(1);
+    } else if (raiz->numChaves == MAX_CHAVES_BTREE) {
+        PistaNode *novaRaiz = criarNoPistas(0);
+        novaRaiz->filhos[0] = raiz;
+        dividirFilho(novaRaiz, 0);
+        raiz = novaRaiz;
     }
-    if (strcmp(pista, raiz->pista) < 0) {
-        raiz->esq = inserirPista(raiz->esq, pista);
-    } else {
-        raiz->dir = inserirPista(raiz->dir, pista);
+
+    PistaNode *no = raiz;
+    while (1) {
+        int i = 0;
+        int cmp = 1;
+        while (i < no->numChaves && (cmp = compararChave(no, i, prefixo, pista)) > 0) {
+            i++;
+        }
+        if (i < no->numChaves && cmp == 0) return raiz;   // pista repetida
+
+        if (no->folha) {
+            memmove(no->prefixos + i + 1, no->prefixos + i, (no->numChaves - i) * sizeof(uint64_t));
+            memmove(no->pistas + i + 1, no->pistas + i, (no->numChaves - i) * sizeof(no->pistas[0]));
+            no->prefixos[i] = prefixo;
+            strncpy(no->pistas[i], pista, 99);
+            no->pistas[i][99] = '\0';
+            no->numChaves++;
+            return raiz;
+        }
+
+        if (no->filhos[i]->numChaves == MAX_CHAVES_BTREE) {
+            dividirFilho(no, i);
+            cmp = compararChave(no, i, prefixo, pista);
+            if (cmp == 0) return raiz;
+            if (cmp > 0) i++;
+        }
+        no = no->filhos[i];
+    }
+}
+
+// ------------------------------------------------------------
+// Função buscarPista()
+// Retorna 1 se a pista já estiver na árvore.
+// ------------------------------------------------------------
+int buscarPista(const PistaNode *raiz, const char *pista) {
+    uint64_t prefixo = prefixoPista(pista);
+    while (raiz != NULL) {
+        int i = 0;
+        int cmp = 1;
+        while (i < raiz->numChaves && (cmp = compararChave(raiz, i, prefixo, pista)) > 0) {
+            i++;
+        }
+        if (i < raiz->numChaves && cmp == 0) return 1;
+        raiz = raiz->folha ? NULL : raiz->filhos[i];
     }
-    return raiz;
+    return 0;
 }
 
 // ------------------------------------------------------------
 // Função exibirPistas()
-// Percorre a BST em ordem e exibe todas as pistas coletadas.
+// Percorre a árvore em ordem e exibe todas as pistas coletadas.
 // ------------------------------------------------------------
 void exibirPistas(PistaNode *raiz) {
     if (raiz == NULL) return;
 
-    exibirPistas(raiz->esq);
-    printf("- %s\n", raiz->pista);
-    exibirPistas(raiz->dir);
+    for (int i = 0; i < raiz->numChaves; i++) {
+        if (!raiz->folha) exibirPistas(raiz->filhos[i]);
+        mostrar("- %s\n", raiz->pistas[i]);
+    }
+    if (!raiz->folha) exibirPistas(raiz->filhos[raiz->numChaves]);
+}
+
+// ------------------------------------------------------------
+// Função liberarPistas()
+// Libera todos os nós da árvore de pistas.
+// ------------------------------------------------------------
+void liberarPistas(PistaNode *raiz) {
+    if (raiz == NULL) return;
+    if (!raiz->folha) {
+        for (int i = 0; i <= raiz->numChaves; i++) liberarPistas(raiz->filhos[i]);
+    }
+    free(raiz);
 }
 
 // ------------------------------------------------------------
 // Função explorarSalasComPistas()
 // Controla a exploração, coleta pistas automaticamente,
-// e insere na BST.
+// e insere na árvore de pistas. Um bit por sala marca as já
+// visitadas, então voltar a um cômodo não mexe na árvore.
 // ------------------------------------------------------------
-void explorarSalasComPistas(Sala *atual, PistaNode **pistas) {
+void explorarSalasComPistas(const Mansao *m, PistaNode **pistas) {
     char opcao;
+    int atual = 0;   // entrada da mansão
+    unsigned char *visitadas = (unsigned char*) calloc((m->numSalas + 7) / 8, 1);
+    if (!visitadas) {
+        printf("Erro de memória ao marcar salas visitadas.\n");
+        exit(1);
+    }
 
     while (1) {
-        printf("\nVocê está em: **%s**\n", atual->nome);
+        mostrar("\nVocê está em: **%s**\n", mansaoNome(m, atual));
+        evento("sala", "sala", mansaoNome(m, atual), NULL);
 
-        // Se a sala tiver uma pista, coleta automaticamente
-        if (strlen(atual->pista) > 0) {
-            printf(">> Você encontrou uma pista: \"%s\"\n", atual->pista);
-            *pistas = inserirPista(*pistas, atual->pista);
+        // Se a sala tiver uma pista, coleta automaticamente (só na primeira visita)
+        const char *pista = mansaoPista(m, atual);
+        int jaVisitada = (visitadas[atual >> 3] >> (atual & 7)) & 1;
+        visitadas[atual >> 3] |= (unsigned char) (1u << (atual & 7));
+        if (pista[0] != '\0' && jaVisitada) {
+            mostrar(">> A pista deste cômodo já foi coletada.\n");
+        } else if (pista[0] != '\0') {
+            mostrar(">> Você encontrou uma pista: \"%s\"\n", pista);
+            evento("pista", "sala", mansaoNome(m, atual), "pista", pista, NULL);
+            *pistas = inserirPista(*pistas, pista);
         } else {
-            printf(">> Nenhuma pista neste cômodo.\n");
+            mostrar(">> Nenhuma pista neste cômodo.\n");
         }
 
         // Opções de navegação
-        printf("\nAções disponíveis:\n");
-        if (atual->esq != NULL) 
-            printf("  (e) Ir para %s\n", atual->esq->nome);
-        if (atual->dir != NULL) 
-            printf("  (d) Ir para %s\n", atual->dir->nome);
-
-        printf("  (s) Sair da mansão\n");
-        printf("Escolha: ");
-        scanf(" %c", &opcao);
-
-        if (opcao == 'e' && atual->esq != NULL) {
-            atual = atual->esq;
-        } 
-        else if (opcao == 'd' && atual->dir != NULL) {
-            atual = atual->dir;
+        int esq = mansaoFilho(m, atual, 'e');
+        int dir = mansaoFilho(m, atual, 'd');
+        mostrar("\nAções disponíveis:\n");
+        if (esq != SEM_SALA) 
+            mostrar("  (e) Ir para %s\n", mansaoNome(m, esq));
+        if (dir != SEM_SALA) 
+            mostrar("  (d) Ir para %s\n", mansaoNome(m, dir));
+
+        mostrar("  (s) Sair da mansão\n");
+        mostrar("Escolha: ");
+        if (!lerOpcao(&opcao)) {
+            opcao = 's';   // fim da entrada
+        }
+
+        if ((opcao == 'e' || opcao == 'd') && mansaoFilho(m, atual, opcao) != SEM_SALA) {
+            atual = mansaoFilho(m, atual, opcao);
         } 
         else if (opcao == 's') {
-            printf("\nExploração encerrada.\n");
+            mostrar("\nExploração encerrada.\n");
+            free(visitadas);
             return;
         } 
         else {
-            printf("Opção inválida. Tente novamente.\n");
+            mostrar("Opção inválida. Tente novamente.\n");
         }
     }
 }
 
 // ------------------------------------------------------------
-// Função main()
-// Monta o mapa fixo da mansão, inicia exploração e mostra pistas.
+// Função executarLote()
+// Cada linha do arquivo é uma partida (ex.: "eds"). O arquivo
+// inteiro é lido uma vez e repetido 'repeticoes' vezes, sem
+// saída; no fim mostra quantas partidas por segundo rodaram.
 // ------------------------------------------------------------
-int main() {
-    // ----------------- Criação da Mansão (Árvore Binária) -----------------
+int executarLote(const char *caminho, long repeticoes, const Mansao *mansao) {
+    FILE *arquivo = strcmp(caminho, "-") == 0 ? stdin : fopen(caminho, "rb");
+    if (arquivo == NULL) {
+        printf("Erro ao abrir roteiro %s.\n", caminho);
+        return 1;
+    }
+    size_t capacidade = 4096, tamanho = 0;
+    char *texto = (char*) malloc(capacidade);
+    while (texto != NULL) {
+        tamanho += fread(texto + tamanho, 1, capacidade - tamanho - 1, arquivo);
+        if (tamanho < capacidade - 1) break;
+        capacidade *= 2;
+        texto = (char*) realloc(texto, capacidade);
+    }
+    if (arquivo != stdin) fclose(arquivo);
+    if (texto == NULL) {
+        printf("Erro ao alocar memória.\n");
+        exit(1);
+    }
+    texto[tamanho] = '\0';
 
-    Sala *hall        = criarSala("Hall de Entrada", "Pegada de lama");
-    Sala *estar       = criarSala("Sala de Estar", "Copo quebrado");
-    Sala *cozinha     = criarSala("Cozinha", "Faca fora do lugar");
-    Sala *biblioteca  = criarSala("Biblioteca", "Livro arrancado");
-    Sala *jardim      = criarSala("Jardim", "");
-    Sala *despensa    = criarSala("Despensa", "Lata caída");
-    Sala *secreta     = criarSala("Sala Secreta", "Documento misterioso");
+    // Uma string por linha (troca os '\n' por '\0')
+    for (size_t i = 0; i < tamanho; i++) {
+        if (texto[i] == '\n') texto[i] = '\0';
+    }
 
-    // Ligações da árvore da mansão
-    hall->esq = estar;
-    hall->dir = cozinha;
+    long partidas = 0;
+    struct timespec inicio, fim;
+    int modoAnterior = modoSaida;
+    if (modoSaida != SAIDA_NDJSON) modoSaida = SAIDA_SILENCIOSA;
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+    for (long r = 0; r < repeticoes; r++) {
+        for (size_t i = 0; i < tamanho; i += strlen(texto + i) + 1) {
+            const char *linha = texto + i;
+            while (isspace((unsigned char) *linha)) linha++;
+            if (*linha == '\0' || *linha == '#') continue;
+            PistaNode *pistas = NULL;
+            roteiro = linha;
+            partidaAtual = partidas;
+            explorarSalasComPistas(mansao, &pistas);
+            liberarPistas(pistas);
+            partidas++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &fim);
+    descarregarSaida();
+    modoSaida = modoAnterior;
+    roteiro = NULL;
+    free(texto);
 
-    estar->esq = biblioteca;
-    estar->dir = jardim;
+    // Com --ndjson o stdout é só de eventos: a vazão vai para o stderr
+    double segundos = (fim.tv_sec - inicio.tv_sec) + (fim.tv_nsec - inicio.tv_nsec) / 1e9;
+    fprintf(modoSaida == SAIDA_NDJSON ? stderr : stdout, "Lote: %ld partidas em %.3f s = %.0f partidas/s\n",
+            partidas, segundos, segundos > 0 ? partidas / segundos : 0.0);
+    return 0;
+}
 
-    cozinha->esq = despensa;
-    cozinha->dir = secreta;
+// ------------------------------------------------------------
+// Função main()
+// Usa o mapa fixo da mansão, inicia exploração e mostra pistas.
+// ------------------------------------------------------------
+int main(int argc, char *argv[]) {
+    const char *arquivoLote = NULL;
+    long repeticoes = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--lote") == 0 && i + 1 < argc) {
+            arquivoLote = argv[++i];
+        } else if (strcmp(argv[i], "--repeticoes") == 0 && i + 1 < argc) {
+            repeticoes = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--quieto") == 0) {
+            modoSaida = SAIDA_SILENCIOSA;
+        } else if (strcmp(argv[i], "--ndjson") == 0) {
+            modoSaida = SAIDA_NDJSON;
+        } else {
+            printf("Uso: %s [--quieto | --ndjson] [--lote roteiros.txt|- [--repeticoes N]]\n", argv[0]);
+            return 1;
+        }
+    }
+    // ----------------- Mansão (Árvore Binária) -----------------
+    Mansao mansao = { (int) (sizeof(quentesPadrao) / sizeof(quentesPadrao[0])), quentesPadrao, friasPadrao };
 
     // ----------------- Exploração -----------------
     PistaNode *pistas = NULL;
 
-    printf("===== Detective Quest: Coleta de Pistas =====\n");
-    explorarSalasComPistas(hall, &pistas);
+    if (arquivoLote != NULL) {
+        return executarLote(arquivoLote, repeticoes, &mansao);
+    }
+
+    mostrar("===== Detective Quest: Coleta de Pistas =====\n");
+    explorarSalasComPistas(&mansao, &pistas);
 
     // ----------------- Exibição das Pistas Coletadas -----------------
-    printf("\n===== Pistas coletadas (ordem alfabética) =====\n");
+    mostrar("\n===== Pistas coletadas (ordem alfabética) =====\n");
     if (pistas == NULL) {
-        printf("Nenhuma pista foi coletada.\n");
+        mostrar("Nenhuma pista foi coletada.\n");
     } else {
         exibirPistas(pistas);
     }
+    descarregarSaida();
 
     return 0;
 }
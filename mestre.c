@@ -1,400 +1,6940 @@
+// Compilar com: gcc -O2 -pthread mestre.c -o mestre
+// Com métricas:  gcc -O2 -pthread -DDQ_METRICAS mestre.c -o mestre
+
+#define _XOPEN_SOURCE 700 // pread, fdatasync, mmap e clock_gettime também com -std=c11
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#ifdef DQ_METRICAS
+#include <signal.h>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-// Definição do tamanho da Tabela Hash
-#define TAMANHO_HASH 10
-#define MAX_PISTAS 100 // Tamanho máximo para strings de pistas
+// Parâmetros da Tabela Hash (endereçamento aberto com bytes de controle)
+#define HASH_CAPACIDADE_INICIAL 32 // Sempre potência de 2 e múltiplo do grupo
+#define HASH_CARGA_NUM 7           // Fator de carga máximo: 7/8
+#define HASH_CARGA_DEN 8
+#if defined(__AVX2__)
+#define HASH_LARGURA_GRUPO 32      // Bytes de controle comparados por instrução
+#else
+#define HASH_LARGURA_GRUPO 16
+#endif
+#define CTRL_VAZIO ((int8_t)-128)  // Byte de controle de um slot livre
 #define MAX_SUSPEITO 50 // Tamanho máximo para strings de suspeitos
+#define ARENA_TAMANHO_BLOCO (64 * 1024) // Bytes pedidos ao malloc por bloco da arena
+#define ARENA_ALINHAMENTO 16
+#define TEXTOS_CAPACIDADE_INICIAL 64 // Slots iniciais do índice de textos internados
+#define TEXTO_VAZIO 0                // Id reservado para a string vazia ("sem pista")
+#define TEXTO_INEXISTENTE UINT32_MAX // Retorno de procurarTexto quando não há o texto
+#define MAPA_MAGICA "DQM1"          // Assinatura do arquivo binário de mansão
+#define MAPA_VERSAO 3
+#define SESSAO_MAGICA "DQS1"
+#define SESSAO_VERSAO 5
+#define DIARIO_MAGICA "DQJ1"         // Assinatura do diário de eventos
+#define DIARIO_VERSAO 1
+#define DIARIO_MAX_CARGA 1024        // Maior carga de um registro do diário
+#define DIARIO_LIMITE_PENDENTE (8 * 1024 * 1024) // Bytes à espera do gravador antes de frear o jogo
+#define DIARIO_PARTIDAS_LISTADAS 10  // Partidas detalhadas por --reproduzir
+#define SEM_SALA UINT32_MAX          // Índice de filho ausente na mansão compacta
+#define SALA_ENTRADA 0               // A entrada é sempre a primeira sala do layout plano
+#define MAX_ATALHOS_SAIDA 9          // Saídas escolhidas por número (1-9) no menu
+#define SALAS_EM_CACHE 64            // Salas decodificadas guardadas pela mansão sob demanda
+#define MAX_LINHA_MAPA 1024          // Linha mais longa aceita na descrição em texto
+#define SEM_ESTADO UINT32_MAX        // Fim da cadeia de saídas do autômato de regras
+#define SEM_SUSPEITO UINT32_MAX      // Pista que não casou com nenhuma regra
+#define MAX_CAMPOS_LINHA 16         // Campos separados por '|' nos arquivos de texto (nome, pista e até 14 saídas)
+#define MAX_RANKING 8              // Maior k aceito por rankingTopo()
+#define TRECHO_MAX 3               // Maior n-grama indexado nas pistas
+#define TRECHOS_CAPACIDADE_INICIAL 256
+#define BENCH_MAX_CHAVES 10000000  // Maior tamanho aceito por --tamanho
+#define GERADOR_MAX_SALAS (1u << 30) // Maior --gerar (as saídas, 2 por sala, cabem em 32 bits)
+#define BENCH_MIN_PASSOS 100000    // Passos mínimos medidos na exploração
+#define METRICAS_FAIXAS_LATENCIA 32 // Histograma de latência por potência de 2 (ns)
+
+// Instrumentação opcional: com -DDQ_METRICAS o código dentro de METRICA(...)
+// é compilado; sem a flag, a macro some e o custo é zero.
+#ifdef DQ_METRICAS
+#define METRICA(...) __VA_ARGS__
+#else
+#define METRICA(...)
+#endif
+#define SAIDA_LIMITE (64 * 1024)     // Bytes acumulados antes de entregar a saída
+#define LOTE_PARTIDAS_POR_TAREFA 64  // Partidas que um trabalhador reserva de cada vez
+#define MAX_TRABALHADORES 256
+#define GRAU_BTREE 8 // Grau mínimo da B-tree de pistas
+#define MAX_CHAVES_BTREE (2 * GRAU_BTREE - 1)
+#define BITS_RAMO 4               // log2 dos filhos por nó do conjunto persistente de salas
+#define RAMOS_BITS (1 << BITS_RAMO)
+#define BITS_FOLHA (6 + BITS_RAMO) // log2 das salas por folha (RAMOS_BITS palavras de 64 bits)
+#define MAX_DESFAZER 1024         // Movimentos que 'u' desfaz (os mais antigos são esquecidos)
+#define MAX_MARCAS 64             // Pontos marcados com 'm' por partida
+
+// Identificador compacto de uma string internada (ver TabelaTextos)
+typedef uint32_t IdTexto;
 
-// --- 1. ESTRUTURAS DE DADOS DA MANSÃO (Árvore Binária) ---
+// Índice de uma sala na mansão compacta
+typedef uint32_t IdSala;
 
+// --- 1. ESTRUTURAS DE DADOS DA MANSÃO (Grafo de cômodos) ---
+
+// Sala usada na montagem do mapa. As saídas são portas: compilarMansao as
+// torna de mão dupla, então ciclos são permitidos e sempre há caminho de volta.
 typedef struct Sala {
-    char nome[MAX_SUSPEITO];
-    char pista[MAX_PISTAS]; // Pista estática associada à sala
-    struct Sala *esquerda;
-    struct Sala *direita;
+    IdTexto nome;
+    IdTexto pista; // Pista estática associada à sala (TEXTO_VAZIO se não houver)
+    IdSala indice; // Posição na mansão compacta (SEM_SALA até compilarMansao)
+    uint32_t numSaidas;
+    uint32_t capacidadeSaidas;
+    struct Sala **saidas;  // Na arena da mansão; a primeira é 'e', a segunda 'd'
 } Sala;
 
-// --- 2. ESTRUTURAS DE DADOS DAS PISTAS COLETADAS (BST) ---
+// Mansão compacta: salas em um array contíguo em ordem de largura (BFS), com
+// os campos de navegação (quentes) separados dos textos (frios). As saídas de
+// todas as salas ficam em um único array (CSR), na faixa de cada sala.
+typedef struct SalaQuente {
+    uint32_t primeiraSaida;  // Posição da primeira saída em Mansao.saidas
+    uint32_t numSaidas;
+} SalaQuente;
+
+typedef struct SalaFria {
+    IdTexto nome;
+    IdTexto pista;
+} SalaFria;
+
+// Roteamento por intervalos sobre a árvore de largura a partir da entrada.
+// Cada sala sabe o intervalo de pré-ordem da sua subárvore: o próximo passo
+// até um destino fora dele é o pai; dentro dele, o filho cujo intervalo o
+// contém (busca binária). São 20 bytes por sala, em vez de uma tabela n x n.
+typedef struct RotaSala {
+    IdSala pai;              // SEM_SALA na entrada
+    uint32_t ordem;          // Posição da sala na pré-ordem da árvore
+    uint32_t fim;            // ordem + tamanho da subárvore
+    uint32_t primeiroFilho;  // Faixa dos filhos em Mansao.filhosRota
+    uint32_t numFilhos;
+} RotaSala;
 
+// Mansão sob demanda: em vez de mapear o .dqm inteiro, cada sala é lida do
+// arquivo (pread) na primeira vez que o jogo precisa dela e fica em um cache
+// das SALAS_EM_CACHE usadas mais recentemente, já com nome e pista internados.
+// O custo de abrir e a memória residente acompanham as salas visitadas, não
+// o tamanho da mansão. O cache não tem trava: uma sessão por vez.
+typedef struct SalaCarregada {
+    IdTexto nome;
+    IdTexto pista;
+    RotaSala rota;
+    uint32_t numSaidas;
+    uint32_t capacidadeSaidas;
+    IdSala *saidas;
+} SalaCarregada;
+
+typedef struct SalasSobDemanda {
+    int fd;
+    const char *caminho;         // Para as mensagens de erro
+    uint32_t numSalas;
+    uint32_t numSaidas;
+    uint32_t numTextos;
+    uint64_t tamanhoBlob;
+    uint64_t posQuentes;         // Início de cada seção no arquivo
+    uint64_t posFrias;
+    uint64_t posRotas;
+    uint64_t posSaidas;
+    uint64_t posFilhosRota;
+    uint64_t posSalasPorNome;
+    uint64_t posDeslocamentos;
+    uint64_t posBlob;
+    IdSala salaDoSlot[SALAS_EM_CACHE];  // SEM_SALA em slot livre; procurado em sequência
+    uint64_t usoDoSlot[SALAS_EM_CACHE]; // Relógio do último acesso (0 = livre)
+    uint64_t relogio;
+    SalaCarregada slots[SALAS_EM_CACHE];
+} SalasSobDemanda;
+
+typedef struct Mansao {
+    uint32_t numSalas;
+    uint32_t numSaidas;
+    const SalaQuente *quentes;  // Na arena da mansão ou direto do arquivo mapeado
+    const IdSala *saidas;
+    const SalaFria *frias;
+    const RotaSala *rotas;
+    const IdSala *filhosRota;   // numSalas - 1 salas, agrupadas por pai, em pré-ordem
+    const IdSala *salasPorNome; // Salas em ordem alfabética do nome (sem diferenciar maiúsculas)
+    SalasSobDemanda *sobDemanda; // Só no modo sob demanda (aí os arrays acima ficam NULL)
+} Mansao;
+
+// --- 2. ESTRUTURAS DE DADOS DAS PISTAS COLETADAS (B-tree persistente) ---
+
+// Nó largo da árvore de busca balanceada, que guarda também o suspeito de
+// cada pista (é o mapa pista -> suspeito da partida). Os 8 primeiros bytes de
+// cada pista ficam inline como inteiro big-endian, então a maioria das
+// comparações dentro do nó não precisa buscar o texto completo na tabela de
+// textos. A árvore é persistente: um nó que outra versão também alcança
+// nunca muda, e a inserção copia só esses nós do caminho da raiz até a folha
+// (no máximo O(log n) nós novos). Os que só a versão atual alcança são
+// alterados no lugar, e os que nenhuma versão alcança mais voltam à lista
+// livre da arena: cada nó conta as referências (de versões e de nós pais).
 typedef struct PistaColetada {
-    char pista[MAX_PISTAS];
-    struct PistaColetada *esq;
-    struct PistaColetada *dir;
+    uint32_t referencias;
+    int numChaves;
+    int folha;
+    uint64_t prefixos[MAX_CHAVES_BTREE];
+    IdTexto pistas[MAX_CHAVES_BTREE];
+    IdTexto suspeitos[MAX_CHAVES_BTREE];
+    struct PistaColetada *filhos[MAX_CHAVES_BTREE + 1];
 } PistaColetada;
 
+// Conjunto persistente de salas (visitadas ou com a pista coletada): trie de
+// base RAMOS_BITS sobre o índice da sala, com 2^BITS_FOLHA salas por folha.
+// Ligar um bit copia só os nós compartilhados do caminho até a folha, com a
+// mesma contagem de referências da B-tree. NULL é o conjunto vazio (e uma
+// subárvore sem nenhuma sala).
+typedef struct NoBits {
+    uint32_t referencias;
+    union {
+        struct NoBits *filhos[RAMOS_BITS];
+        uint64_t palavras[RAMOS_BITS];
+    };
+} NoBits;
+
 // --- 3. ESTRUTURAS DE DADOS DA ASSOCIAÇÃO PISTA-SUSPEITO (Tabela Hash) ---
 
-// Estrutura para os itens da lista encadeada (encadeamento para colisões)
+// Item armazenado diretamente no array de slots (sem nós encadeados).
+// Chave e valor são ids internados: a igualdade é uma comparação de inteiros
+// e o hash completo de 64 bits vem pré-calculado da tabela de textos.
 typedef struct ItemHash {
-    char pista[MAX_PISTAS];
-    char suspeito[MAX_SUSPEITO];
-    struct ItemHash *proximo;
+    IdTexto pista;
+    IdTexto suspeito;
 } ItemHash;
 
-// Tabela Hash é um array de ponteiros para ItemHash
-ItemHash *tabelaHash[TAMANHO_HASH];
+// Tabela Hash com endereçamento aberto: cada slot tem um byte de controle
+// (CTRL_VAZIO ou os 7 bits baixos do hash), varridos em grupos via SIMD.
+// Na sessão, registra as pistas já postas nos índices de trechos e de
+// evidências, em qualquer linha da investigação (ver Momento).
+typedef struct TabelaHash {
+    int8_t *controle;     // 'capacidade' bytes de controle
+    ItemHash *itens;      // 'capacidade' slots
+    size_t capacidade;    // Potência de 2, múltiplo de HASH_LARGURA_GRUPO
+    size_t ocupados;
+} TabelaHash;
+
+// Índice reverso da tabela hash: para cada suspeito (índices do motor de
+// regras, com o "Desconhecido" no fim), as pistas associadas a ele em um
+// array contíguo que só cresce, na ordem em que as associações foram feitas.
+typedef struct ListaEvidencias {
+    IdTexto *pistas;
+    uint32_t tamanho;
+    uint32_t capacidade;
+} ListaEvidencias;
+
+typedef struct IndiceEvidencias {
+    ListaEvidencias *listas;
+    uint32_t numSuspeitos;
+} IndiceEvidencias;
+
+
+// --- 4. ALOCADOR POR ARENA ---
+
+// Bloco de memória contíguo do qual os nós são recortados sequencialmente.
+typedef struct BlocoArena {
+    struct BlocoArena *proximo;
+    size_t tamanho;
+    size_t usado;
+    _Alignas(ARENA_ALINHAMENTO) unsigned char dados[];
+} BlocoArena;
+
+// Tipos de nó com lista de reaproveitamento própria
+typedef enum {
+    NO_SALA,
+    NO_PISTAS,
+    NO_BITS,
+    NUM_TIPOS_NO
+} TipoNo;
+
+// Arena: alocação por incremento de ponteiro, listas livres por tipo de nó e
+// descarte de todo o conteúdo de uma vez. Os blocos são mantidos após o
+// reinício e reaproveitados pela próxima partida.
+typedef struct Arena {
+    BlocoArena *primeiro;
+    BlocoArena *atual;
+    void *livres[NUM_TIPOS_NO];
+} Arena;
+
+// A mansão vive durante todo o programa (as pistas coletadas ficam na arena de cada Sessao).
+Arena arenaMansao;
+
+// --- 5. TABELA DE TEXTOS INTERNADOS ---
+
+// Cada string distinta (nome de cômodo, pista, suspeito) é guardada uma única
+// vez e recebe um id sequencial de 32 bits com o hash já calculado. O índice
+// texto -> id usa o mesmo esquema de bytes de controle da tabela hash.
+typedef struct TabelaTextos {
+    Arena memoria;           // Onde os caracteres são guardados (endereços estáveis)
+    const char **textos;     // id -> string
+    uint64_t *hashes;        // id -> funcaoHash(string)
+    uint32_t numTextos;
+    uint32_t capacidadeTextos;
+    int8_t *controle;        // Índice de endereçamento aberto
+    IdTexto *ids;
+    size_t capacidadeIndice;
+} TabelaTextos;
+
+TabelaTextos tabelaTextos;
+
+// --- 6. ARQUIVO BINÁRIO DE MANSÃO (.dqm) ---
+
+// Layout (inteiros na ordem de bytes da máquina que gerou o arquivo):
+//   CabecalhoMapa | uint64_t hashes[numTextos] | SalaQuente[numSalas]
+//   | SalaFria[numSalas] | RotaSala[numSalas] | IdSala saidas[numSaidas]
+//   | IdSala filhosRota[numSalas - 1] | IdSala salasPorNome[numSalas]
+//   | uint32_t deslocamentos[numTextos] | blob de strings terminadas em '\0'
+// As salas estão em ordem de largura, com a entrada na posição SALA_ENTRADA,
+// e o texto 0 é sempre "" (sem pista). Os arrays (inclusive as rotas, já
+// calculadas) são usados direto do mmap; os de 8 bytes vêm antes dos de 4.
+typedef struct CabecalhoMapa {
+    char magica[4];
+    uint32_t versao;
+    uint32_t numSalas;
+    uint32_t numTextos;
+    uint32_t numSaidas;
+    uint32_t reservado;
+    uint64_t tamanhoBlob;
+} CabecalhoMapa;
+
+// Arquivo de mapa mapeado em memória (as strings são usadas direto dele)
+typedef struct MapaArquivo {
+    void *base;
+    size_t tamanho;
+} MapaArquivo;
+
+// --- 7. MOTOR DE REGRAS DE ATRIBUIÇÃO (Aho-Corasick) ---
+
+// Regra "se a pista contém 'palavra', aponta para 'suspeito'". Entre as
+// regras que casam, vence o suspeito com a maior prioridade; empates são
+// decididos pela soma dos pesos de cada ocorrência e, por fim, pela ordem
+// de cadastro do suspeito.
+typedef struct Regra {
+    IdTexto palavra;
+    uint32_t suspeito;   // Índice em MotorRegras.suspeitos
+    int prioridade;
+    int peso;
+    int32_t proxima;     // Outra regra com a mesma palavra-chave (-1 se não houver)
+} Regra;
+
+// Autômato de Aho-Corasick já determinizado: uma linha de transições por
+// estado, com o alfabeto comprimido às classes de bytes que aparecem nas
+// palavras-chave. Cada pista é varrida uma única vez, byte a byte.
+typedef struct MotorRegras {
+    Regra *regras;
+    uint32_t numRegras;
+    uint32_t capacidadeRegras;
+    IdTexto *suspeitos;           // Suspeitos distintos, na ordem de cadastro
+    uint32_t numSuspeitos;
+    uint32_t capacidadeSuspeitos;
+    uint8_t classeDoByte[256];    // 0 = byte que não aparece em nenhuma palavra
+    uint32_t numClasses;
+    uint32_t *transicoes;         // numEstados * numClasses
+    int32_t *regraDoEstado;       // Primeira regra que termina no estado (-1 se nenhuma)
+    uint32_t *saidaSufixo;        // Próximo estado com regra na cadeia de falhas
+    uint32_t numEstados;
+    IdTexto desconhecido;         // Suspeito das pistas que não casam com nenhuma regra
+} MotorRegras;
+
+// Acumuladores por suspeito usados durante a atribuição de uma pista
+typedef struct PlacarSuspeitos {
+    int *prioridade;
+    int *peso;
+    uint32_t *tocados;
+    uint32_t numTocados;
+} PlacarSuspeitos;
+
+MotorRegras motorRegras;
+
+// --- 8. ENTRADA DO JOGADOR ---
+
+// De onde vêm os comandos: o teclado (arquivo != NULL) ou um roteiro em
+// memória, usado pelo modo em lote para repetir partidas sem interação.
+typedef struct FonteEntrada {
+    FILE *arquivo;
+    const char *texto;
+    size_t posicao;
+    size_t tamanho;
+} FonteEntrada;
+
+// --- 9. RANKING DE SUSPEITOS (Heap indexado) ---
+
+// Quantas pistas apontam para cada suspeito, atualizado a cada pista
+// coletada. Os índices são os do motor de regras; o índice numSuspeitos é
+// o "Desconhecido". O heap máximo (com a posição de cada suspeito nele)
+// deixa o mais provável sempre na raiz.
+typedef struct RankingSuspeitos {
+    uint32_t *contagem;  // Pistas por suspeito
+    uint32_t *heap;      // Índices de suspeitos em ordem de heap
+    uint32_t *posicao;   // Posição de cada suspeito em heap[]
+    uint32_t tamanho;
+} RankingSuspeitos;
+
+// --- 10. ÍNDICE DE TRECHOS DAS PISTAS (n-gramas) ---
+
+// Cada pista coletada é indexada por todos os seus trechos de 1, 2 e 3 bytes
+// (sem diferenciar maiúsculas). Um termo de até 3 bytes é respondido direto
+// pela lista do seu trecho; um termo maior usa a menor lista entre os seus
+// trigramas e só confere essas candidatas. A chave empacota os bytes e o
+// comprimento, então nunca é 0 (slot livre).
+typedef struct ListaTrecho {
+    uint32_t chave;
+    uint32_t tamanho;
+    uint32_t capacidade;
+    IdTexto *pistas;   // Em ordem de coleta, sem repetição
+} ListaTrecho;
+
+typedef struct IndiceTrechos {
+    ListaTrecho *slots;  // Endereçamento aberto com sondagem linear
+    size_t capacidade;   // Potência de 2 (0 antes da primeira pista)
+    size_t ocupados;
+} IndiceTrechos;
+
+// --- 11. SESSÃO DE JOGO ---
+
+// Fases de uma partida, avançadas uma entrada por vez por passo()
+typedef enum {
+    JOGO_EXPLORANDO,  // Espera 'e', 'd' ou 's'
+    JOGO_ACUSACAO,    // Espera o nome do acusado
+    JOGO_FIM
+} EstadoJogo;
+
+// Como a sessão mostra o jogo: texto para o jogador, nada, ou uma linha JSON
+// por evento (NDJSON) para análise posterior
+typedef enum {
+    SAIDA_TEXTO,
+    SAIDA_SILENCIOSA,
+    SAIDA_NDJSON
+} ModoSaida;
+
+// Escritor com buffer próprio de cada sessão: a saída é acumulada e entregue
+// ao destino em blocos de SAIDA_LIMITE, sempre em linhas inteiras no modo
+// NDJSON, para as threads do modo em lote dividirem o stdout sem misturar
+// eventos.
+typedef struct Renderizador {
+    ModoSaida modo;
+    FILE *destino;
+    char *buffer;
+    size_t usado;
+    size_t capacidade;
+    uint64_t partida;            // Número da partida nos eventos
+} Renderizador;
+
+// Um ponto da investigação, para desfazer movimentos e voltar a marcas.
+// Pistas e salas são raízes de estruturas persistentes (o momento segura uma
+// referência a cada uma), então guardar um momento custa O(suspeitos) (a
+// cópia do ranking), não O(pistas) nem O(salas).
+typedef struct Momento {
+    PistaColetada *pistas;
+    NoBits *visitadas;
+    NoBits *coletadas;
+    uint32_t *ranking;            // Contagem, heap e posições (3 * numRanking)
+    IdSala salaAtual;
+    int totalPistasColetadas;
+    struct Momento *proximoLivre; // Na lista de momentos livres da sessão
+} Momento;
+
+// Todo o estado de uma investigação. A mansão, as regras e a tabela de
+// textos são compartilhadas entre sessões e só são lidas durante o jogo,
+// então várias sessões podem rodar ao mesmo tempo em threads diferentes.
+typedef struct Sessao {
+    const Mansao *mansao;
+    const MotorRegras *motor;
+    Arena memoria;                // Nós das estruturas persistentes e momentos desta partida
+    PistaColetada *raizPistas;    // Pista -> suspeito, em ordem alfabética
+    TabelaHash indexadas;         // Pistas já indexadas em 'trechos' e 'evidencias'
+    IndiceEvidencias evidencias;  // Suspeito -> pistas (conferido em raizPistas ao consultar)
+    PlacarSuspeitos placar;       // Rascunho do motor de regras
+    RankingSuspeitos ranking;     // Pistas por suspeito, mantidas ao coletar
+    IndiceTrechos trechos;        // Busca por trecho no texto das pistas (idem)
+    NoBits *visitadas;            // Salas em que o jogador já entrou
+    NoBits *coletadas;            // Salas cuja pista já foi coletada
+    uint32_t alturaBits;          // Níveis internos das tries de salas
+    int totalPistasColetadas;
+    Momento **desfazer;           // Pilha de desfazer circular (MAX_DESFAZER posições)
+    uint32_t inicioDesfazer;      // Posição do momento mais antigo
+    uint32_t numDesfazer;
+    Momento *momentosLivres;      // Esquecidos, reaproveitados com o ranking já alocado
+    Momento **marcas;             // Pontos marcados com 'm', voltados com 'r'
+    uint32_t numMarcas;
+    uint32_t capacidadeMarcas;
+    struct Diario *diario;        // Diário de eventos compartilhado, ou NULL
+    uint8_t *registros;           // Registros do passo atual, entregues juntos ao diário
+    size_t usadoRegistros;
+    size_t capacidadeRegistros;
+    uint32_t numRegistros;
+    Renderizador saida;           // Texto, nada (modo em lote) ou eventos NDJSON
+    EstadoJogo estado;
+    IdSala salaAtual;
+    int vitoria;                  // Resultado, válido quando estado == JOGO_FIM
+} Sessao;
+
+// --- 12. MÉTRICAS (só com -DDQ_METRICAS) ---
+
+#ifdef DQ_METRICAS
+// Contadores globais do processo, atualizados com atômicos relaxados
+// para valerem também no modo em lote com várias threads.
+typedef struct Metricas {
+    uint64_t hashSondagens;          // Buscas de slot na tabela pista -> suspeito
+    uint64_t hashGrupos;             // Grupos visitados (comprimento da sondagem)
+    uint64_t hashMaxGrupos;
+    uint64_t hashComparacoes;        // Candidatos com o mesmo tag comparados
+    uint64_t hashRedimensionamentos;
+    uint64_t btreeInsercoes;
+    uint64_t btreeComparacoes;
+    uint64_t btreeNiveis;            // Soma da profundidade de cada inserção
+    uint64_t btreeMaxProfundidade;
+    uint64_t btreeDivisoes;
+    uint64_t nos[NUM_TIPOS_NO];      // Nós entregues por arenaAlocarNo, por tipo
+    uint64_t nosReaproveitados[NUM_TIPOS_NO];
+    uint64_t blocosArena;            // mallocs feitos pelas arenas
+    uint64_t bytesArena;
+    uint64_t tabelasHash;            // mallocs de tabelas hash
+    uint64_t bytesHash;
+    uint64_t salasCarregadas;        // Salas lidas do arquivo no modo sob demanda
+    uint64_t salasEmCache;           // Acessos resolvidos pelo cache de salas
+    uint64_t passos;                 // Chamadas de passo()
+    uint64_t nsPassos;
+    uint64_t maxNsPasso;
+    uint64_t latenciaPassos[METRICAS_FAIXAS_LATENCIA]; // Faixa i: [2^i, 2^(i+1)) ns
+} Metricas;
+
+Metricas metricas;
+
+// Ligado pelo tratador de SIGUSR1; o despejo acontece fora do tratador
+volatile sig_atomic_t pedidoMetricas = 0;
+#endif
+
+// --- 13. INSTANTÂNEO DE SESSÃO (.dqs) ---
+
+// Layout: cabeçalho, pares pista -> suspeito em ordem (ItemHash[numPistas])
+// e os bitsets de salas visitadas e coletadas (teto(numSalas / 64) palavras
+// cada; as tries persistentes vão achatadas). O ranking não vai no arquivo:
+// é refeito a partir dos pares. Desfazer e marcas não são salvos. Os textos
+// são ids da tabela de textos, então o instantâneo só vale para a mesma
+// mansão e as mesmas regras (conferido por numTextos e assinaturaTextos).
+typedef struct CabecalhoSessao {
+    char magica[4];
+    uint32_t versao;
+    uint64_t assinaturaTextos;   // Hash do último texto internado
+    uint64_t partida;            // Número da partida no diário (0: fora de um diário)
+    uint32_t numTextos;
+    uint32_t numSalas;
+    uint32_t numRanking;         // Suspeitos das regras, mais o "Desconhecido"
+    uint32_t estado;
+    uint32_t salaAtual;
+    uint32_t totalPistasColetadas;
+    uint32_t numPistas;
+} CabecalhoSessao;
+
+// --- 14. MANSÃO EMBUTIDA ---
+
+// Mapa usado sem --mapa nem --gerar, já compilado: as mesmas seções do .dqm
+// como tabelas constantes e sem ponteiros, que ficam na seção somente leitura
+// do executável e são compartilhadas entre os processos. Abrir a mansão não
+// aloca nem copia nenhuma sala (ver abrirMansaoEmbutida). As tabelas abaixo
+// são as de mansao.txt, geradas com ./mestre --converter mansao.txt mansao.h;
+// outra descrição entra no lugar com -DDQ_MANSAO_EMBUTIDA='"mansao.h"'.
+#ifdef DQ_MANSAO_EMBUTIDA
+#include DQ_MANSAO_EMBUTIDA
+#else
+static const uint64_t hashesEmbutidos[] = {
+    0xd725c98e9509182eull, 0xe9f7a5a333cf4f21ull, 0x0e1ddf215b28a585ull, 0x5d8c377706f2311full,
+    0x4364398d55d509fcull, 0x4b6248c25c1c5679ull, 0x89cfa8009c8892d2ull, 0xa2752304de9de132ull,
+    0xcaf4d0c3caa2c9caull, 0x83d95b284383b8d4ull, 0x6d597edc27790df5ull, 0xdb1f72c39e975bf3ull,
+    0xf5529d947c260b3full, 0xb4c4d2de54644e4cull, 0xea9dfd254bd73b41ull,
+};
+
+static const char blobEmbutido[] =
+    "\0"
+    "Saguão Principal\0"
+    "Um casaco de inverno molhado no chão.\0"
+    "Biblioteca Antiga\0"
+    "Cozinha Industrial\0"
+    "Restos de charuto de alta qualidade (aponta para Alfredo).\0"
+    "Quarto Principal\0"
+    "Jardim de Inverno\0"
+    "Uma faca de cozinha usada e jogada na pia (aponta para Carlos).\0"
+    "Despensa de Vinhos\0"
+    "Escritório Secreto\0"
+    "Um frasco de perfume caro e vazio.\0"
+    "Um par de sapatos enlameados na entrada (aponta para Carlos).\0"
+    "Uma garrafa de vinho tinto de safra rara, quase vazia (aponta para Alfredo).\0"
+    "Um fio de cabelo loiro em cima da mesa (aponta para Berta).";
+
+static const uint32_t deslocamentosEmbutidos[] = {
+    0, 1, 19, 58, 76, 95, 154, 171, 189, 253, 272, 292,
+    327, 389, 466,
+};
+
+static const SalaQuente quentesEmbutidos[] = {
+    {0, 2},
+    {2, 3},
+    {5, 3},
+    {8, 1},
+    {9, 1},
+    {10, 1},
+    {11, 1},
+};
+
+static const SalaFria friasEmbutidas[] = {
+    {1, 2}, // Saguão Principal
+    {3, 5}, // Biblioteca Antiga
+    {4, 8}, // Cozinha Industrial
+    {6, 11}, // Quarto Principal
+    {7, 12}, // Jardim de Inverno
+    {9, 13}, // Despensa de Vinhos
+    {10, 14}, // Escritório Secreto
+};
+
+static const RotaSala rotasEmbutidas[] = {
+    {SEM_SALA, 0, 7, 0, 2},
+    {0, 1, 4, 2, 2},
+    {0, 4, 7, 4, 2},
+    {1, 2, 3, 6, 0},
+    {1, 3, 4, 6, 0},
+    {2, 5, 6, 6, 0},
+    {2, 6, 7, 6, 0},
+};
+
+static const IdSala saidasEmbutidas[] = {
+    1, 2, 3, 4, 0, 5, 6, 0, 1, 1, 2, 2,
+};
+
+static const IdSala filhosRotaEmbutidos[] = {
+    1, 2, 3, 4, 5, 6,
+};
+
+static const IdSala salasPorNomeEmbutidas[] = {
+    1, 2, 5, 6, 4, 3, 0,
+};
+#endif
+
+// --- 15. DIÁRIO DE EVENTOS (.dqj) ---
+
+// Layout: CabecalhoDiario e depois só acréscimos, cada um um RegistroDiario
+// seguido de 'tamanho' bytes de carga. A verificação cobre o resto do
+// registro e a carga: um registro cortado por uma queda é detectado e
+// descartado (ao reabrir para acrescentar, ele é truncado). Como no .dqs,
+// os ids de salas e textos só valem para a mesma mansão e as mesmas regras.
+// Cargas: COMANDO (o texto digitado), SALA (IdSala), PISTA (IdSala, pista,
+// suspeito), MOMENTO (AcaoMomento, IdSala), VEREDITO (pistas, vitória e o
+// nome do acusado); INICIO, RETOMADA e FIM_DA_ENTRADA não têm carga.
+typedef struct CabecalhoDiario {
+    char magica[4];
+    uint32_t versao;
+    uint64_t assinaturaTextos;
+    uint32_t numTextos;
+    uint32_t numSalas;
+} CabecalhoDiario;
+
+typedef enum {
+    REGISTRO_INICIO,          // Partida começou na entrada
+    REGISTRO_RETOMADA,        // Partida continuou a partir de um .dqs
+    REGISTRO_COMANDO,         // Entrada do jogador entregue a passo()
+    REGISTRO_FIM_DA_ENTRADA,  // passo(NULL)
+    REGISTRO_SALA,
+    REGISTRO_PISTA,
+    REGISTRO_MOMENTO,
+    REGISTRO_VEREDITO,
+    NUM_TIPOS_REGISTRO
+} TipoRegistro;
 
-// Ponteiro para a raiz da BST de pistas coletadas
-PistaColetada *raizPistas = NULL;
+typedef enum {
+    MOMENTO_DESFAZER,
+    MOMENTO_MARCAR,
+    MOMENTO_VOLTAR
+} AcaoMomento;
+
+typedef struct RegistroDiario {
+    uint64_t verificacao;     // Hash dos campos abaixo e da carga
+    uint64_t partida;
+    uint32_t tipo;
+    uint32_t tamanho;         // Bytes de carga
+} RegistroDiario;
+
+// Quando um registro conta como gravado
+typedef enum {
+    DURABILIDADE_NENHUMA,     // Entregue ao sistema (write), sem fdatasync
+    DURABILIDADE_LOTE,        // Sincronizado em grupo, sem o jogo esperar
+    DURABILIDADE_SEMPRE       // O passo só termina depois do fdatasync que o cobre
+} NivelDurabilidade;
+
+// Gravação em grupo: as sessões acrescentam os registros de cada passo ao
+// buffer sob a trava e seguem; uma thread gravadora troca o buffer por um
+// vazio e grava tudo o que se acumulou com um write e um fdatasync. Enquanto
+// ela sincroniza, os próximos registros (de qualquer sessão) formam o lote
+// seguinte, então o número de fdatasync acompanha o disco, não os eventos.
+typedef struct Diario {
+    int fd;                       // -1: só em memória (usado por --reproduzir)
+    NivelDurabilidade nivel;
+    pthread_mutex_t trava;
+    pthread_cond_t pendente;      // Há registros para o gravador (ou é hora de encerrar)
+    pthread_cond_t gravado;       // Um lote terminou de ser gravado
+    uint8_t *buffer;              // Registros aceitos e ainda não entregues ao gravador
+    size_t usado;
+    size_t capacidade;
+    uint64_t aceitos;             // Passos (lotes de registros) aceitos até agora
+    uint64_t gravados;            // Dos aceitos, quantos já foram gravados
+    uint64_t registros;           // Total de registros, para o resumo
+    uint64_t gravacoes;           // Lotes gravados pelo gravador
+    uint64_t proximaPartida;      // Próximo número livre (começa em 1; 0 é "fora do diário")
+    int encerrar;
+    int falhou;                   // Erro de escrita: nada mais é aceito
+    int temGravador;
+    pthread_t gravador;
+} Diario;
 
 // -------------------------------------------------------------------
-// -------------------- FUNÇÕES DE MANSÃO (Árvore Binária) --------------------
+// -------------------- FUNÇÕES DE ENTRADA E SAÍDA --------------------
 // -------------------------------------------------------------------
 
 /**
- * @brief Cria dinamicamente um novo cômodo (nó da Árvore Binária).
- * @param nome O nome exclusivo do cômodo.
- * @param pista A pista estática associada a este cômodo.
- * @return Um ponteiro para a nova Sala criada.
+ * @brief Entrega ao destino tudo o que está no buffer da saída.
  */
-Sala* criarSala(const char *nome, const char *pista) {
-    Sala *novaSala = (Sala*)malloc(sizeof(Sala));
-    if (novaSala == NULL) {
-        perror("Erro ao alocar memoria para Sala");
-        exit(EXIT_FAILURE);
+void descarregarSaida(Renderizador *saida) {
+    if (saida->usado > 0) {
+        fwrite(saida->buffer, 1, saida->usado, saida->destino);
+        fflush(saida->destino);
+        saida->usado = 0;
     }
-    strncpy(novaSala->nome, nome, MAX_SUSPEITO - 1);
-    novaSala->nome[MAX_SUSPEITO - 1] = '\0';
-    strncpy(novaSala->pista, pista, MAX_PISTAS - 1);
-    novaSala->pista[MAX_PISTAS - 1] = '\0';
-    novaSala->esquerda = NULL;
-    novaSala->direita = NULL;
-    return novaSala;
 }
 
-// -------------------------------------------------------------------
-// -------------------- FUNÇÕES DE PISTAS (BST) --------------------
-// -------------------------------------------------------------------
-
 /**
- * @brief Insere uma pista coletada na Árvore de Busca Binária (BST).
- * Garante a ordenação alfabética das pistas.
- * @param raiz O ponteiro para a raiz da BST atual.
- * @param pista A string da pista a ser inserida.
- * @return O ponteiro para a nova raiz (após a inserção).
+ * @brief Garante espaço para mais 'bytes' no buffer (que só cresce).
  */
-PistaColetada* inserirPista(PistaColetada *raiz, const char *pista) {
-    if (raiz == NULL) {
-        PistaColetada *novaPista = (PistaColetada*)malloc(sizeof(PistaColetada));
-        if (novaPista == NULL) {
-            perror("Erro ao alocar memoria para PistaColetada");
-            return NULL;
-        }
-        strncpy(novaPista->pista, pista, MAX_PISTAS - 1);
-        novaPista->pista[MAX_PISTAS - 1] = '\0';
-        novaPista->esq = NULL;
-        novaPista->dir = NULL;
-        return novaPista;
+static void reservarSaida(Renderizador *saida, size_t bytes) {
+    if (saida->usado + bytes <= saida->capacidade) {
+        return;
     }
+    size_t capacidade = saida->capacidade ? saida->capacidade : SAIDA_LIMITE;
+    while (capacidade < saida->usado + bytes) {
+        capacidade *= 2;
+    }
+    saida->buffer = (char*)realloc(saida->buffer, capacidade);
+    if (saida->buffer == NULL) {
+        perror("Erro ao alocar memoria para a saida");
+        exit(EXIT_FAILURE);
+    }
+    saida->capacidade = capacidade;
+}
 
-    // Compara as strings para determinar se vai para a esquerda ou direita
-    int comparacao = strcmp(pista, raiz->pista);
-
-    if (comparacao < 0) {
-        raiz->esq = inserirPista(raiz->esq, pista);
-    } else if (comparacao > 0) {
-        raiz->dir = inserirPista(raiz->dir, pista);
+/**
+ * @brief Fecha uma unidade de saída (uma chamada de exibir ou um evento):
+ * só aqui o buffer é entregue, então nunca sai uma linha pela metade.
+ */
+static void concluirSaida(Renderizador *saida) {
+    if (saida->usado >= SAIDA_LIMITE) {
+        descarregarSaida(saida);
     }
-    // Se comparacao == 0, a pista já existe, não faz nada.
+}
+
+static void escreverSaida(Renderizador *saida, const char *dados, size_t tamanho) {
+    reservarSaida(saida, tamanho);
+    memcpy(saida->buffer + saida->usado, dados, tamanho);
+    saida->usado += tamanho;
+}
 
-    return raiz;
+/**
+ * @brief Escolhe como a sessão mostra o jogo e para onde vai a saída.
+ * @param sessao A sessão (o que estiver no buffer é entregue antes).
+ * @param modo Texto, silencioso ou NDJSON.
+ * @param destino O arquivo de saída (normalmente stdout).
+ */
+void configurarSaida(Sessao *sessao, ModoSaida modo, FILE *destino) {
+    descarregarSaida(&sessao->saida);
+    sessao->saida.modo = modo;
+    sessao->saida.destino = destino;
 }
 
 /**
- * @brief Exibe todas as pistas coletadas em ordem (BST percorrida "Em Ordem").
- * @param raiz O ponteiro para a raiz da BST de pistas.
+ * @brief printf do jogo: só no modo texto, e para o buffer da sessão (não
+ * formata nada nos outros modos).
  */
-void listarPistasColetadas(PistaColetada *raiz) {
-    if (raiz != NULL) {
-        listarPistasColetadas(raiz->esq);
-        printf(" -> %s\n", raiz->pista);
-        listarPistasColetadas(raiz->dir);
+static void exibir(Sessao *sessao, const char *formato, ...) {
+    Renderizador *saida = &sessao->saida;
+    if (saida->modo != SAIDA_TEXTO) {
+        return;
     }
+    reservarSaida(saida, 1);
+    va_list argumentos;
+    va_start(argumentos, formato);
+    va_list copia;
+    va_copy(copia, argumentos);
+    int tamanho = vsnprintf(saida->buffer + saida->usado, saida->capacidade - saida->usado, formato, argumentos);
+    if (tamanho >= 0 && saida->usado + (size_t)tamanho + 1 > saida->capacidade) {
+        reservarSaida(saida, (size_t)tamanho + 1);
+        vsnprintf(saida->buffer + saida->usado, saida->capacidade - saida->usado, formato, copia);
+    }
+    va_end(copia);
+    va_end(argumentos);
+    if (tamanho > 0) {
+        saida->usado += (size_t)tamanho;
+    }
+    concluirSaida(saida);
 }
 
-// -------------------------------------------------------------------
-// -------------------- FUNÇÕES DE ASSOCIAÇÃO (Tabela Hash) --------------------
-// -------------------------------------------------------------------
+/**
+ * @brief Começa a linha de um evento NDJSON: {"partida":N,"evento":"tipo".
+ * @return 1 se a sessão emite eventos (os campos e fecharEvento só devem ser
+ * chamados nesse caso), 0 caso contrário.
+ */
+static int abrirEvento(Sessao *sessao, const char *tipo) {
+    Renderizador *saida = &sessao->saida;
+    if (saida->modo != SAIDA_NDJSON) {
+        return 0;
+    }
+    char inicio[64];
+    int tamanho = snprintf(inicio, sizeof(inicio), "{\"partida\":%llu,\"evento\":\"%s\"",
+                           (unsigned long long)saida->partida, tipo);
+    escreverSaida(saida, inicio, (size_t)tamanho);
+    return 1;
+}
 
 /**
- * @brief Função de hash simples para strings.
- * Converte a pista em um índice numérico.
- * @param chave A string da pista.
- * @return O índice do bucket na tabela hash.
+ * @brief Acrescenta ,"nome":"valor" ao evento, escapando o valor para JSON.
  */
-int funcaoHash(const char *chave) {
-    int valor = 0;
-    for (int i = 0; chave[i] != '\0'; i++) {
-        valor = (valor * 31 + chave[i]) % TAMANHO_HASH;
+static void campoTexto(Sessao *sessao, const char *nome, const char *valor) {
+    Renderizador *saida = &sessao->saida;
+    size_t tamanhoNome = strlen(nome);
+    reservarSaida(saida, tamanhoNome + 6 * strlen(valor) + 6);
+    char *p = saida->buffer + saida->usado;
+    *p++ = ',';
+    *p++ = '"';
+    memcpy(p, nome, tamanhoNome);
+    p += tamanhoNome;
+    *p++ = '"';
+    *p++ = ':';
+    *p++ = '"';
+    for (const unsigned char *c = (const unsigned char*)valor; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            *p++ = '\\';
+            *p++ = (char)*c;
+        } else if (*c < 0x20) {
+            p += sprintf(p, "\\u%04x", *c);
+        } else {
+            *p++ = (char)*c; // UTF-8 passa como está
+        }
     }
-    return valor;
+    *p++ = '"';
+    saida->usado = (size_t)(p - saida->buffer);
 }
 
 /**
- * @brief Insere a associação pista/suspeito na tabela hash.
- * @param pista A string da pista (chave).
- * @param suspeito A string do suspeito (valor).
+ * @brief Acrescenta ,"nome":valor ao evento.
  */
-void inserirNaHash(const char *pista, const char *suspeito) {
-    int indice = funcaoHash(pista);
+static void campoNumero(Sessao *sessao, const char *nome, uint64_t valor) {
+    char campo[96];
+    int tamanho = snprintf(campo, sizeof(campo), ",\"%s\":%llu", nome, (unsigned long long)valor);
+    escreverSaida(&sessao->saida, campo, (size_t)tamanho);
+}
 
-    // Cria um novo item
-    ItemHash *novoItem = (ItemHash*)malloc(sizeof(ItemHash));
-    if (novoItem == NULL) {
-        perror("Erro ao alocar memoria para ItemHash");
-        return;
-    }
-    strncpy(novoItem->pista, pista, MAX_PISTAS - 1);
-    novoItem->pista[MAX_PISTAS - 1] = '\0';
-    strncpy(novoItem->suspeito, suspeito, MAX_SUSPEITO - 1);
-    novoItem->suspeito[MAX_SUSPEITO - 1] = '\0';
+/**
+ * @brief Acrescenta ,"nome":true|false ao evento.
+ */
+static void campoLogico(Sessao *sessao, const char *nome, int valor) {
+    char campo[96];
+    int tamanho = snprintf(campo, sizeof(campo), ",\"%s\":%s", nome, valor ? "true" : "false");
+    escreverSaida(&sessao->saida, campo, (size_t)tamanho);
+}
 
-    // Insere no início da lista encadeada (tratamento de colisão)
-    novoItem->proximo = tabelaHash[indice];
-    tabelaHash[indice] = novoItem;
+static void fecharEvento(Sessao *sessao) {
+    escreverSaida(&sessao->saida, "}\n", 2);
+    concluirSaida(&sessao->saida);
 }
 
 /**
- * @brief Consulta o suspeito correspondente a uma pista.
- * @param pista A string da pista (chave).
- * @return A string do suspeito ou NULL se não for encontrada.
+ * @brief Lê o próximo caractere da fonte (EOF no fim do roteiro ou do arquivo).
+ */
+static int lerCaractere(FonteEntrada *fonte) {
+    if (fonte->arquivo != NULL) {
+        return getc(fonte->arquivo);
+    }
+    return fonte->posicao < fonte->tamanho ? (unsigned char)fonte->texto[fonte->posicao++] : EOF;
+}
+
+/**
+ * @brief Lê o próximo caractere que não seja espaço (equivale a scanf(" %c")).
+ * @return 1 se leu, 0 no fim da entrada.
  */
-const char* encontrarSuspeito(const char *pista) {
-    int indice = funcaoHash(pista);
-    ItemHash *atual = tabelaHash[indice];
+int lerEscolha(FonteEntrada *fonte, char *escolha) {
+    int c;
+    do {
+        c = lerCaractere(fonte);
+    } while (c != EOF && isspace(c));
+    if (c == EOF) {
+        return 0;
+    }
+    *escolha = (char)c;
+    return 1;
+}
 
-    while (atual != NULL) {
-        if (strcmp(atual->pista, pista) == 0) {
-            return atual->suspeito; // Suspeito encontrado
+/**
+ * @brief Lê a próxima palavra (equivale a scanf(" %Ns")), truncando em 'tamanho' - 1.
+ * @return 1 se leu, 0 no fim da entrada.
+ */
+int lerPalavra(FonteEntrada *fonte, char *palavra, size_t tamanho) {
+    int c;
+    do {
+        c = lerCaractere(fonte);
+    } while (c != EOF && isspace(c));
+    if (c == EOF) {
+        return 0;
+    }
+    size_t n = 0;
+    while (c != EOF && !isspace(c)) {
+        if (n + 1 < tamanho) {
+            palavra[n++] = (char)c;
         }
-        atual = atual->proximo;
+        c = lerCaractere(fonte);
     }
+    palavra[n] = '\0';
+    return 1;
+}
 
-    return NULL; // Pista não encontrada na hash
+/**
+ * @brief Lê o termo de um comando: o resto da linha, até um ';' (que separa o
+ * termo dos comandos seguintes num roteiro de uma linha só). O que passa de
+ * 'tamanho' - 1 é descartado, sem virar comando.
+ */
+void lerTermo(FonteEntrada *fonte, char *termo, size_t tamanho) {
+    size_t n = 0;
+    int c = lerCaractere(fonte);
+    while (c != EOF && c != '\n' && c != ';') {
+        if (n + 1 < tamanho) {
+            termo[n++] = (char)c;
+        }
+        c = lerCaractere(fonte);
+    }
+    termo[n] = '\0';
 }
 
 // -------------------------------------------------------------------
-// -------------------- FUNÇÕES DE LÓGICA DE JOGO --------------------
+// -------------------- FUNÇÕES DE MÉTRICAS --------------------
 // -------------------------------------------------------------------
 
-// Variável global para armazenar o número total de pistas coletadas
-int totalPistasColetadas = 0;
+#ifdef DQ_METRICAS
+static void metricaSomar(uint64_t *contador, uint64_t valor) {
+    __atomic_fetch_add(contador, valor, __ATOMIC_RELAXED);
+}
+
+static void metricaMaximo(uint64_t *contador, uint64_t valor) {
+    uint64_t atual = __atomic_load_n(contador, __ATOMIC_RELAXED);
+    while (valor > atual && !__atomic_compare_exchange_n(contador, &atual, valor, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static uint64_t metricaAgoraNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
 
 /**
- * @brief Função recursiva para navegar pela árvore e coletar pistas.
- * @param salaAtual O ponteiro para a Sala atual que o jogador está explorando.
+ * @brief Registra a latência de um passo no total, no máximo e no histograma.
  */
-void explorarSalas(Sala *salaAtual) {
-    if (salaAtual == NULL) {
-        return;
+static void metricaPasso(uint64_t ns) {
+    int faixa = ns > 0 ? 63 - __builtin_clzll(ns) : 0;
+    if (faixa >= METRICAS_FAIXAS_LATENCIA) {
+        faixa = METRICAS_FAIXAS_LATENCIA - 1;
     }
+    metricaSomar(&metricas.passos, 1);
+    metricaSomar(&metricas.nsPassos, ns);
+    metricaMaximo(&metricas.maxNsPasso, ns);
+    metricaSomar(&metricas.latenciaPassos[faixa], 1);
+}
+
+/**
+ * @brief Escreve todas as métricas como um objeto JSON em uma linha.
+ */
+void despejarMetricas(FILE *saida) {
+    Metricas m;
+    // Cópia campo a campo com leituras atômicas (pode haver threads rodando)
+    for (size_t i = 0; i < sizeof(m) / sizeof(uint64_t); i++) {
+        ((uint64_t*)&m)[i] = __atomic_load_n(&((uint64_t*)&metricas)[i], __ATOMIC_RELAXED);
+    }
+    double media = m.hashSondagens ? (double)m.hashGrupos / (double)m.hashSondagens : 0.0;
+    fprintf(saida, "{\"hash\":{\"sondagens\":%llu,\"grupos\":%llu,\"media_grupos\":%.3f,\"max_grupos\":%llu,"
+            "\"comparacoes\":%llu,\"redimensionamentos\":%llu},",
+            (unsigned long long)m.hashSondagens, (unsigned long long)m.hashGrupos, media,
+            (unsigned long long)m.hashMaxGrupos, (unsigned long long)m.hashComparacoes,
+            (unsigned long long)m.hashRedimensionamentos);
+    media = m.btreeInsercoes ? (double)m.btreeNiveis / (double)m.btreeInsercoes : 0.0;
+    fprintf(saida, "\"btree\":{\"insercoes\":%llu,\"comparacoes\":%llu,\"profundidade_media\":%.3f,"
+            "\"profundidade_max\":%llu,\"divisoes\":%llu},",
+            (unsigned long long)m.btreeInsercoes, (unsigned long long)m.btreeComparacoes, media,
+            (unsigned long long)m.btreeMaxProfundidade, (unsigned long long)m.btreeDivisoes);
+    fprintf(saida, "\"memoria\":{\"nos_sala\":%llu,\"nos_pistas\":%llu,\"nos_bits\":%llu,\"nos_reaproveitados\":%llu,"
+            "\"blocos_arena\":%llu,\"bytes_arena\":%llu,\"tabelas_hash\":%llu,\"bytes_hash\":%llu,\"textos\":%u},",
+            (unsigned long long)m.nos[NO_SALA], (unsigned long long)m.nos[NO_PISTAS], (unsigned long long)m.nos[NO_BITS],
+            (unsigned long long)(m.nosReaproveitados[NO_SALA] + m.nosReaproveitados[NO_PISTAS]
+                                 + m.nosReaproveitados[NO_BITS]),
+            (unsigned long long)m.blocosArena, (unsigned long long)m.bytesArena,
+            (unsigned long long)m.tabelasHash, (unsigned long long)m.bytesHash, tabelaTextos.numTextos);
+    fprintf(saida, "\"sob_demanda\":{\"carregadas\":%llu,\"em_cache\":%llu},",
+            (unsigned long long)m.salasCarregadas, (unsigned long long)m.salasEmCache);
+    media = m.passos ? (double)m.nsPassos / (double)m.passos : 0.0;
+    fprintf(saida, "\"passos\":{\"total\":%llu,\"ns_medio\":%.1f,\"ns_max\":%llu,\"histograma_ns_log2\":[",
+            (unsigned long long)m.passos, media, (unsigned long long)m.maxNsPasso);
+    for (int i = 0; i < METRICAS_FAIXAS_LATENCIA; i++) {
+        fprintf(saida, "%s%llu", i > 0 ? "," : "", (unsigned long long)m.latenciaPassos[i]);
+    }
+    fprintf(saida, "]}}\n");
+    fflush(saida);
+}
 
-    printf("\n--- Você está no cômodo: **%s** ---\n", salaAtual->nome);
+/**
+ * @brief Junta às métricas deste processo as de outro (uma rodada do
+ * benchmark, feita num processo filho): contadores somam, máximos ficam
+ * com o maior.
+ */
+static void juntarMetricas(const Metricas *parcial) {
+    const uint64_t *origem = (const uint64_t*)parcial;
+    uint64_t *destino = (uint64_t*)&metricas;
+    for (size_t i = 0; i < sizeof(Metricas) / sizeof(uint64_t); i++) {
+        size_t campo = i * sizeof(uint64_t);
+        if (campo == offsetof(Metricas, hashMaxGrupos) || campo == offsetof(Metricas, btreeMaxProfundidade)
+            || campo == offsetof(Metricas, maxNsPasso)) {
+            metricaMaximo(&destino[i], origem[i]);
+        } else {
+            metricaSomar(&destino[i], origem[i]);
+        }
+    }
+}
 
-    if (salaAtual->pista[0] != '\0') {
-        printf("🔍 Você encontrou uma **Pista**!\n");
-        printf("   Pista: \"%s\"\n", salaAtual->pista);
+/**
+ * @brief Tratador de SIGUSR1: só marca o pedido (fprintf não é seguro aqui).
+ */
+static void tratarSinalMetricas(int sinal) {
+    (void)sinal;
+    pedidoMetricas = 1;
+}
 
-        // Define a associação Suspeito/Pista dinamicamente baseada na pista
-        const char *suspeito = "Desconhecido"; // Default
+/**
+ * @brief Despeja as métricas se um SIGUSR1 chegou (só uma thread atende cada pedido).
+ */
+static void atenderPedidoMetricas() {
+    if (pedidoMetricas && __atomic_exchange_n(&pedidoMetricas, 0, __ATOMIC_RELAXED)) {
+        despejarMetricas(stderr);
+    }
+}
+#endif
 
-        // Lógica Simplificada: Associa Pistas a Suspeitos (Requisito: regras codificadas)
-        if (strstr(salaAtual->pista, "cigarro") || strstr(salaAtual->pista, "vinho")) {
-            suspeito = "Alfredo";
-        } else if (strstr(salaAtual->pista, "cabelo loiro") || strstr(salaAtual->pista, "carta")) {
-            suspeito = "Berta";
-        } else if (strstr(salaAtual->pista, "faca") || strstr(salaAtual->pista, "sapato sujo")) {
-            suspeito = "Carlos";
-        }
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE MEMÓRIA (Arena) --------------------
+// -------------------------------------------------------------------
 
-        // Armazena a pista na BST (ordenada)
-        raizPistas = inserirPista(raizPistas, salaAtual->pista);
+static const size_t tamanhoTipoNo[NUM_TIPOS_NO] = {
+    [NO_SALA] = sizeof(Sala),
+    [NO_PISTAS] = sizeof(PistaColetada),
+    [NO_BITS] = sizeof(NoBits),
+};
 
-        // Armazena a associação Pista-Suspeito na Tabela Hash
-        inserirNaHash(salaAtual->pista, suspeito);
-        
-        totalPistasColetadas++;
-        printf("   **Pista Coletada e Associada a: %s**\n", suspeito);
-    } else {
-        printf("   Este cômodo não tem pistas a serem coletadas.\n");
+/**
+ * @brief Aloca 'tamanho' bytes da arena, alinhados a ARENA_ALINHAMENTO.
+ * Só chama malloc quando o bloco atual (e os seguintes, já reservados) se esgotam.
+ * @param arena A arena de origem.
+ * @param tamanho Quantidade de bytes.
+ * @return Ponteiro para a memória (nunca NULL; aborta se faltar memória).
+ */
+void* arenaAlocar(Arena *arena, size_t tamanho) {
+    tamanho = (tamanho + ARENA_ALINHAMENTO - 1) & ~(size_t)(ARENA_ALINHAMENTO - 1);
+
+    BlocoArena *bloco = arena->atual;
+    if (bloco != NULL && bloco->usado + tamanho <= bloco->tamanho) {
+        void *ptr = bloco->dados + bloco->usado;
+        bloco->usado += tamanho;
+        return ptr;
     }
 
-    char escolha;
-    while (1) {
-        printf("\nOnde deseja ir? [**e**] Esquerda, [**d**] Direita, ou [**s**] Sair da mansão: ");
-        if (scanf(" %c", &escolha) != 1) {
-            // Limpa o buffer se for uma entrada inválida
-            while(getchar() != '\n');
-            continue;
+    // Reaproveita o próximo bloco da cadeia (sobra de uma partida anterior)
+    if (bloco != NULL && bloco->proximo != NULL && bloco->proximo->tamanho >= tamanho) {
+        bloco = bloco->proximo;
+        bloco->usado = 0;
+    } else {
+        size_t capacidade = tamanho > ARENA_TAMANHO_BLOCO ? tamanho : ARENA_TAMANHO_BLOCO;
+        BlocoArena *novo = (BlocoArena*)malloc(sizeof(BlocoArena) + capacidade);
+        if (novo == NULL) {
+            perror("Erro ao alocar memoria para Arena");
+            exit(EXIT_FAILURE);
         }
-        escolha = tolower(escolha);
-        if (escolha == 'e' || escolha == 'd' || escolha == 's') {
-            break;
+        METRICA(metricaSomar(&metricas.blocosArena, 1);
+                metricaSomar(&metricas.bytesArena, sizeof(BlocoArena) + capacidade);)
+        novo->tamanho = capacidade;
+        novo->usado = 0;
+        if (bloco == NULL) {
+            novo->proximo = arena->primeiro;
+            arena->primeiro = novo;
+        } else {
+            novo->proximo = bloco->proximo;
+            bloco->proximo = novo;
         }
-        printf("Escolha inválida. Use 'e', 'd', ou 's'.\n");
+        bloco = novo;
     }
 
-    if (escolha == 's') {
-        printf("\n✅ **Saindo da Mansão...** Iniciando a fase de Acusação!\n");
-        return; // Sai da recursão e retorna ao main
-    } else if (escolha == 'e' && salaAtual->esquerda != NULL) {
-        explorarSalas(salaAtual->esquerda);
-    } else if (escolha == 'd' && salaAtual->direita != NULL) {
-        explorarSalas(salaAtual->direita);
-    } else {
-        printf("❌ Não há cômodo nesta direção. Permanece em **%s**.\n", salaAtual->nome);
-        // Permite ao jogador tentar novamente na mesma sala
-        explorarSalas(salaAtual); 
+    arena->atual = bloco;
+    bloco->usado = tamanho;
+    return bloco->dados;
+}
+
+/**
+ * @brief Aloca um nó do tipo informado, reaproveitando a lista livre do tipo se houver.
+ * @param arena A arena de origem.
+ * @param tipo O tipo do nó.
+ * @return Ponteiro para o nó (conteúdo não inicializado).
+ */
+void* arenaAlocarNo(Arena *arena, TipoNo tipo) {
+    METRICA(metricaSomar(&metricas.nos[tipo], 1);)
+    void *no = arena->livres[tipo];
+    if (no != NULL) {
+        METRICA(metricaSomar(&metricas.nosReaproveitados[tipo], 1);)
+        arena->livres[tipo] = *(void**)no;
+        return no;
     }
+    return arenaAlocar(arena, tamanhoTipoNo[tipo]);
 }
 
 /**
- * @brief Conduz à fase de julgamento final: lista pistas, solicita acusação e verifica evidências.
+ * @brief Devolve um nó à lista livre do seu tipo, para a próxima arenaAlocarNo.
+ * @param arena A arena de onde o nó veio.
+ * @param tipo O tipo do nó.
+ * @param no O nó que não será mais usado.
  */
-void verificarSuspeitoFinal() {
-    char acusacao[MAX_SUSPEITO];
-    int pistasContraSuspeito = 0;
+void arenaDevolverNo(Arena *arena, TipoNo tipo, void *no) {
+    *(void**)no = arena->livres[tipo];
+    arena->livres[tipo] = no;
+}
 
-    printf("\n============================================\n");
-    printf("        🚨 FASE DE ACUSAÇÃO 🚨\n");
-    printf("============================================\n");
+/**
+ * @brief Copia uma string para dentro da arena.
+ * @return A cópia terminada em '\0'.
+ */
+char* arenaCopiarTexto(Arena *arena, const char *texto) {
+    size_t tamanho = strlen(texto) + 1;
+    char *copia = (char*)arenaAlocar(arena, tamanho);
+    memcpy(copia, texto, tamanho);
+    return copia;
+}
 
-    if (totalPistasColetadas == 0) {
-        printf("⚠️ Você não coletou nenhuma pista. Acusação impossível.\n");
-        printf("FIM DE JOGO: O culpado escapou por falta de provas.\n");
-        return;
+/**
+ * @brief Descarta tudo o que foi alocado na arena em O(1), mantendo os blocos para reuso.
+ * @param arena A arena a ser reiniciada.
+ */
+void arenaReiniciar(Arena *arena) {
+    arena->atual = arena->primeiro;
+    if (arena->primeiro != NULL) {
+        arena->primeiro->usado = 0;
     }
+    memset(arena->livres, 0, sizeof(arena->livres));
+}
 
-    printf("Pistas Coletadas (em ordem alfabética):\n");
-    listarPistasColetadas(raizPistas);
-
-    printf("\nCom base nas evidências, quem você acusa? (Alfredo, Berta, Carlos): ");
-    if (scanf(" %49s", acusacao) != 1) {
-        printf("Entrada inválida. FIM DE JOGO.\n");
-        return;
+/**
+ * @brief Devolve todos os blocos da arena ao sistema.
+ * @param arena A arena a ser destruída.
+ */
+void arenaDestruir(Arena *arena) {
+    BlocoArena *bloco = arena->primeiro;
+    while (bloco != NULL) {
+        BlocoArena *proximo = bloco->proximo;
+        free(bloco);
+        bloco = proximo;
     }
-    
-    // Força a primeira letra para maiúscula para padronização na verificação
-    acusacao[0] = toupper(acusacao[0]);
+    memset(arena, 0, sizeof(*arena));
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE TEXTOS (Internação) --------------------
+// -------------------------------------------------------------------
 
-    // Verificação de Pistas: Percorre todas as pistas coletadas na BST e consulta a Hash
-    PistaColetada *pilha[MAX_PISTAS]; // Usando um array como pilha para simular a travessia in-order não recursiva
-    int topo = -1;
-    PistaColetada *atual = raizPistas;
+/**
+ * @brief Função de hash para strings (FNV-1a de 64 bits com mistura final).
+ * Os 7 bits baixos viram a "tag" do byte de controle e o restante escolhe o grupo.
+ * @param chave A string da pista.
+ * @return O hash completo de 64 bits.
+ */
+uint64_t funcaoHash(const char *chave) {
+    uint64_t valor = 1469598103934665603ULL;
+    for (int i = 0; chave[i] != '\0'; i++) {
+        valor ^= (unsigned char)chave[i];
+        valor *= 1099511628211ULL;
+    }
+    // Mistura final (fmix64) para espalhar bem também os bits baixos
+    valor ^= valor >> 33;
+    valor *= 0xff51afd7ed558ccdULL;
+    valor ^= valor >> 33;
+    valor *= 0xc4ceb9fe1a85ec53ULL;
+    valor ^= valor >> 33;
+    return valor;
+}
 
-    // Travessia In-Order não recursiva para iterar sobre todas as pistas
-    while (atual != NULL || topo != -1) {
-        while (atual != NULL) {
-            pilha[++topo] = atual;
-            atual = atual->esq;
+/**
+ * @brief Compara um grupo de bytes de controle com um valor.
+ * @param grupo Início do grupo (HASH_LARGURA_GRUPO bytes).
+ * @param valor O byte procurado (tag ou CTRL_VAZIO).
+ * @return Máscara com o bit i ligado se grupo[i] == valor.
+ */
+static uint32_t grupoCorresponder(const int8_t *grupo, int8_t valor) {
+#if defined(__AVX2__)
+    __m256i bytes = _mm256_loadu_si256((const __m256i*)grupo);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(valor)));
+#elif defined(__SSE2__)
+    __m128i bytes = _mm_loadu_si128((const __m128i*)grupo);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(valor)));
+#else
+    uint32_t mascara = 0;
+    for (int i = 0; i < HASH_LARGURA_GRUPO; i++) {
+        if (grupo[i] == valor) {
+            mascara |= 1u << i;
         }
-        atual = pilha[topo--];
+    }
+    return mascara;
+#endif
+}
 
-        // Consulta a Tabela Hash para cada pista
-        const char *suspeitoDaPista = encontrarSuspeito(atual->pista);
+/**
+ * @brief Procura um texto no índice ou o slot livre onde ele deve entrar.
+ * @param encontrado Recebe 1 se o texto já estiver internado.
+ * @return O índice do slot no índice de textos.
+ */
+static size_t sondarTextos(const TabelaTextos *tabela, const char *texto, uint64_t hash, int *encontrado) {
+    size_t mascaraGrupos = tabela->capacidadeIndice / HASH_LARGURA_GRUPO - 1;
+    size_t grupo = (size_t)(hash >> 7) & mascaraGrupos;
+    int8_t tag = (int8_t)(hash & 0x7F);
 
-        if (suspeitoDaPista != NULL && strcmp(suspeitoDaPista, acusacao) == 0) {
-            pistasContraSuspeito++;
+    for (size_t passo = 1; ; passo++) {
+        size_t base = grupo * HASH_LARGURA_GRUPO;
+        uint32_t candidatos = grupoCorresponder(tabela->controle + base, tag);
+        while (candidatos != 0) {
+            size_t slot = base + (size_t)__builtin_ctz(candidatos);
+            IdTexto id = tabela->ids[slot];
+            if (tabela->hashes[id] == hash && strcmp(tabela->textos[id], texto) == 0) {
+                *encontrado = 1;
+                return slot;
+            }
+            candidatos &= candidatos - 1;
         }
-
-        atual = atual->dir;
+        uint32_t vazios = grupoCorresponder(tabela->controle + base, CTRL_VAZIO);
+        if (vazios != 0) {
+            *encontrado = 0;
+            return base + (size_t)__builtin_ctz(vazios);
+        }
+        grupo = (grupo + passo) & mascaraGrupos;
     }
+}
 
-    printf("\n--- RESULTADO DO JULGAMENTO ---\n");
-    printf("Suspeito Acusado: **%s**\n", acusacao);
-    printf("Pistas que apontam para %s: **%d**\n", acusacao, pistasContraSuspeito);
+/**
+ * @brief (Re)constrói o índice de textos com a capacidade informada.
+ */
+static void reconstruirIndiceTextos(TabelaTextos *tabela, size_t capacidade) {
+    free(tabela->controle);
+    free(tabela->ids);
+    tabela->controle = (int8_t*)malloc(capacidade);
+    tabela->ids = (IdTexto*)malloc(capacidade * sizeof(IdTexto));
+    if (tabela->controle == NULL || tabela->ids == NULL) {
+        perror("Erro ao alocar memoria para TabelaTextos");
+        exit(EXIT_FAILURE);
+    }
+    memset(tabela->controle, CTRL_VAZIO, capacidade);
+    tabela->capacidadeIndice = capacidade;
 
-    if (pistasContraSuspeito >= 2) {
-        printf("\n🎉 **VITÓRIA!** A acusação contra %s é sustentada por %d pistas.\n", acusacao, pistasContraSuspeito);
-        printf("O caso está resolvido. O culpado foi levado à justiça!\n");
-    } else {
-        printf("\n😢 **FRACASSO.** Você precisa de pelo menos 2 pistas, mas só encontrou %d.\n", pistasContraSuspeito);
-        printf("O caso foi arquivado por falta de provas suficientes. O culpado escapou.\n");
+    for (IdTexto id = 0; id < tabela->numTextos; id++) {
+        int encontrado;
+        size_t slot = sondarTextos(tabela, tabela->textos[id], tabela->hashes[id], &encontrado);
+        tabela->controle[slot] = (int8_t)(tabela->hashes[id] & 0x7F);
+        tabela->ids[slot] = id;
     }
 }
 
 /**
- * @brief Libera a memória alocada para a BST de Pistas (recursivo).
- * @param raiz A raiz da BST.
+ * @brief Devolve o id de um texto, internando-o se ainda não existir.
+ * @param texto A string a internar.
+ * @return O id do texto (TEXTO_VAZIO para "").
  */
-void liberarPistas(PistaColetada *raiz) {
-    if (raiz != NULL) {
-        liberarPistas(raiz->esq);
-        liberarPistas(raiz->dir);
-        free(raiz);
+IdTexto internarTexto(const char *texto) {
+    TabelaTextos *tabela = &tabelaTextos;
+    if (tabela->capacidadeIndice == 0) {
+        reconstruirIndiceTextos(tabela, TEXTOS_CAPACIDADE_INICIAL);
+    }
+
+    uint64_t hash = funcaoHash(texto);
+    if (tabela->numTextos > 0) {
+        int encontrado;
+        size_t slot = sondarTextos(tabela, texto, hash, &encontrado);
+        if (encontrado) {
+            return tabela->ids[slot];
+        }
+    }
+
+    if (tabela->numTextos == tabela->capacidadeTextos) {
+        uint32_t capacidade = tabela->capacidadeTextos ? tabela->capacidadeTextos * 2 : TEXTOS_CAPACIDADE_INICIAL;
+        const char **textos = (const char**)realloc(tabela->textos, capacidade * sizeof(char*));
+        uint64_t *hashes = (uint64_t*)realloc(tabela->hashes, capacidade * sizeof(uint64_t));
+        if (textos == NULL || hashes == NULL) {
+            perror("Erro ao alocar memoria para TabelaTextos");
+            exit(EXIT_FAILURE);
+        }
+        tabela->textos = textos;
+        tabela->hashes = hashes;
+        tabela->capacidadeTextos = capacidade;
     }
+    if ((tabela->numTextos + 1) * HASH_CARGA_DEN > tabela->capacidadeIndice * HASH_CARGA_NUM) {
+        reconstruirIndiceTextos(tabela, tabela->capacidadeIndice * 2);
+    }
+
+    IdTexto id = tabela->numTextos++;
+    tabela->textos[id] = arenaCopiarTexto(&tabela->memoria, texto);
+    tabela->hashes[id] = hash;
+
+    int encontrado;
+    size_t slot = sondarTextos(tabela, texto, hash, &encontrado);
+    tabela->controle[slot] = (int8_t)(hash & 0x7F);
+    tabela->ids[slot] = id;
+    return id;
 }
 
 /**
- * @brief Libera a memória alocada para a Tabela Hash.
+ * @brief Procura o id de um texto sem interná-lo.
+ * @param texto A string procurada.
+ * @return O id, ou TEXTO_INEXISTENTE se o texto nunca foi internado.
  */
-void liberarHash() {
-    for (int i = 0; i < TAMANHO_HASH; i++) {
-        ItemHash *atual = tabelaHash[i];
-        ItemHash *temp;
-        while (atual != NULL) {
-            temp = atual;
-            atual = atual->proximo;
-            free(temp);
-        }
-        tabelaHash[i] = NULL;
+IdTexto procurarTexto(const char *texto) {
+    if (tabelaTextos.numTextos == 0) {
+        return TEXTO_INEXISTENTE;
     }
+    int encontrado;
+    size_t slot = sondarTextos(&tabelaTextos, texto, funcaoHash(texto), &encontrado);
+    return encontrado ? tabelaTextos.ids[slot] : TEXTO_INEXISTENTE;
 }
 
-// -------------------------------------------------------------------
-// -------------------- FUNÇÃO PRINCIPAL (MAIN) --------------------
-// -------------------------------------------------------------------
+/**
+ * @brief Devolve a string de um id internado.
+ */
+const char* textoDe(IdTexto id) {
+    return tabelaTextos.textos[id];
+}
 
-int main() {
-    // Inicializa a Tabela Hash
-    for (int i = 0; i < TAMANHO_HASH; i++) {
-        tabelaHash[i] = NULL;
+/**
+ * @brief Adota um conjunto de textos já internados (ex.: vindos de um arquivo
+ * mapeado), sem copiar nem recalcular hashes: só o índice é reconstruído.
+ * Deve ser chamada com a tabela vazia; os ids passam a ser os do arquivo.
+ * @param blob Início das strings.
+ * @param deslocamentos Posição de cada texto no blob.
+ * @param hashes Hash de cada texto.
+ * @param numTextos Quantidade de textos.
+ */
+void adotarTextos(const char *blob, const uint32_t *deslocamentos, const uint64_t *hashes, uint32_t numTextos) {
+    TabelaTextos *tabela = &tabelaTextos;
+    tabela->textos = (const char**)malloc(numTextos * sizeof(char*));
+    tabela->hashes = (uint64_t*)malloc(numTextos * sizeof(uint64_t));
+    if (tabela->textos == NULL || tabela->hashes == NULL) {
+        perror("Erro ao alocar memoria para TabelaTextos");
+        exit(EXIT_FAILURE);
     }
+    for (uint32_t id = 0; id < numTextos; id++) {
+        tabela->textos[id] = blob + deslocamentos[id];
+    }
+    memcpy(tabela->hashes, hashes, numTextos * sizeof(uint64_t));
+    tabela->numTextos = numTextos;
+    tabela->capacidadeTextos = numTextos;
 
-    // --- MONTAGEM FIXA DO MAPA DA MANSÃO (Árvore Binária) ---
-    // Estrutura:         Saguão
-    //                   /      \
-    //              Biblioteca   Cozinha
-    //               /    \       /     \
-    //            Quarto  Jardim  Despensa Escritório
-
-    Sala *saguao = criarSala("Saguão Principal", "Um casaco de inverno molhado no chão.");
-    Sala *biblioteca = criarSala("Biblioteca Antiga", "Restos de charuto de alta qualidade (aponta para Alfredo).");
-    Sala *cozinha = criarSala("Cozinha Industrial", "Uma faca de cozinha usada e jogada na pia (aponta para Carlos).");
-    Sala *quarto = criarSala("Quarto Principal", "Um frasco de perfume caro e vazio.");
-    Sala *jardim = criarSala("Jardim de Inverno", "Um par de sapatos enlameados na entrada (aponta para Carlos).");
-    Sala *despensa = criarSala("Despensa de Vinhos", "Uma garrafa de vinho tinto de safra rara, quase vazia (aponta para Alfredo).");
-    Sala *escritorio = criarSala("Escritório Secreto", "Um fio de cabelo loiro em cima da mesa (aponta para Berta).");
-    
-    // Conexões da Árvore Binária
-    saguao->esquerda = biblioteca;
-    saguao->direita = cozinha;
+    size_t capacidade = TEXTOS_CAPACIDADE_INICIAL;
+    while (capacidade * HASH_CARGA_NUM < (size_t)(numTextos + 1) * HASH_CARGA_DEN) {
+        capacidade *= 2;
+    }
+    reconstruirIndiceTextos(tabela, capacidade);
+}
 
-    biblioteca->esquerda = quarto;
-    biblioteca->direita = jardim;
+/**
+ * @brief Prepara a tabela de textos, reservando o id TEXTO_VAZIO para "".
+ */
+void inicializarTextos() {
+    internarTexto("");
+}
 
-    cozinha->esquerda = despensa;
-    cozinha->direita = escritorio;
+/**
+ * @brief Libera toda a memória da tabela de textos.
+ */
+void liberarTextos() {
+    arenaDestruir(&tabelaTextos.memoria);
+    free(tabelaTextos.textos);
+    free(tabelaTextos.hashes);
+    free(tabelaTextos.controle);
+    free(tabelaTextos.ids);
+    memset(&tabelaTextos, 0, sizeof(tabelaTextos));
+}
 
-    // Inicia a Lógica do Jogo
-    printf("============================================\n");
-    printf("   🕵️‍♂️ DETECTIVE QUEST: O MISTÉRIO DA MANSÃO 🕵️‍♀️\n");
-    printf("   Explore a mansão para coletar pistas.\n");
-    printf("============================================\n");
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE MANSÃO (Grafo de cômodos) --------------------
+// -------------------------------------------------------------------
 
-    explorarSalas(saguao);
-    
-    // Finaliza o Jogo e Inicia o Julgamento
-    verificarSuspeitoFinal();
+/**
+ * @brief Cria um novo cômodo, ainda sem saídas, na arena da mansão.
+ * @param nome O nome exclusivo do cômodo.
+ * @param pista A pista estática associada a este cômodo.
+ * @return Um ponteiro para a nova Sala criada.
+ */
+Sala* criarSala(const char *nome, const char *pista) {
+    Sala *novaSala = (Sala*)arenaAlocarNo(&arenaMansao, NO_SALA);
+    novaSala->nome = internarTexto(nome);
+    novaSala->pista = internarTexto(pista);
+    novaSala->indice = SEM_SALA;
+    novaSala->numSaidas = 0;
+    novaSala->capacidadeSaidas = 0;
+    novaSala->saidas = NULL;
+    return novaSala;
+}
+
+/**
+ * @brief Abre uma porta de 'origem' para 'destino' (a volta é criada por compilarMansao).
+ * A primeira saída de uma sala é a esquerda ('e') e a segunda, a direita ('d').
+ */
+void conectarSalas(Sala *origem, Sala *destino) {
+    if (origem->numSaidas == origem->capacidadeSaidas) {
+        // O array antigo fica na arena; só a montagem do mapa cresce salas
+        uint32_t capacidade = origem->capacidadeSaidas ? origem->capacidadeSaidas * 2 : 2;
+        Sala **saidas = (Sala**)arenaAlocar(&arenaMansao, capacidade * sizeof(Sala*));
+        if (origem->numSaidas > 0) {
+            memcpy(saidas, origem->saidas, origem->numSaidas * sizeof(Sala*));
+        }
+        origem->saidas = saidas;
+        origem->capacidadeSaidas = capacidade;
+    }
+    origem->saidas[origem->numSaidas++] = destino;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE MANSÃO SOB DEMANDA (Cache de salas) --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Tamanho que um .dqm com este cabeçalho deve ter (sem confiar nele).
+ */
+static uint64_t tamanhoDoMapa(const CabecalhoMapa *cabecalho) {
+    return sizeof(CabecalhoMapa)
+        + (uint64_t)cabecalho->numSalas * (sizeof(SalaQuente) + sizeof(SalaFria) + sizeof(RotaSala) + 2 * sizeof(IdSala))
+        - sizeof(IdSala) // filhosRota tem numSalas - 1 entradas
+        + (uint64_t)cabecalho->numSaidas * sizeof(IdSala)
+        + (uint64_t)cabecalho->numTextos * (sizeof(uint64_t) + sizeof(uint32_t))
+        + cabecalho->tamanhoBlob;
+}
+
+/**
+ * @brief Interrompe o programa: o arquivo mudou ou está corrompido e a partida
+ * já começou, então não há estado consistente para onde voltar.
+ */
+static void mapaCorrompido(const SalasSobDemanda *sd) {
+    fprintf(stderr, "%s: arquivo de mapa corrompido\n", sd->caminho);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Lê 'bytes' bytes do arquivo de mapa a partir de 'posicao'.
+ */
+static void lerDoMapa(const SalasSobDemanda *sd, uint64_t posicao, void *destino, size_t bytes) {
+    ssize_t lidos = pread(sd->fd, destino, bytes, (off_t)posicao);
+    if (lidos < 0) {
+        perror("Erro ao ler arquivo do mapa");
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)lidos != bytes) {
+        mapaCorrompido(sd);
+    }
+}
+
+/**
+ * @brief Copia um texto do blob do arquivo, sem interná-lo.
+ * @param destino Recebe o texto com o '\0' (até 'tamanho' bytes).
+ */
+static void lerTextoDoMapa(const SalasSobDemanda *sd, IdTexto id, char *destino, size_t tamanho) {
+    uint32_t deslocamento;
+    if (id >= sd->numTextos) {
+        mapaCorrompido(sd);
+    }
+    lerDoMapa(sd, sd->posDeslocamentos + (uint64_t)id * sizeof(uint32_t), &deslocamento, sizeof(deslocamento));
+    if (deslocamento >= sd->tamanhoBlob) {
+        mapaCorrompido(sd);
+    }
+    size_t bytes = sd->tamanhoBlob - deslocamento < tamanho ? (size_t)(sd->tamanhoBlob - deslocamento) : tamanho;
+    lerDoMapa(sd, sd->posBlob + deslocamento, destino, bytes);
+    if (memchr(destino, '\0', bytes) == NULL) {
+        mapaCorrompido(sd);
+    }
+}
+
+/**
+ * @brief Lê a rota de uma sala direto do arquivo, conferindo os limites.
+ */
+static RotaSala lerRotaDoMapa(const SalasSobDemanda *sd, IdSala sala) {
+    RotaSala rota;
+    lerDoMapa(sd, sd->posRotas + (uint64_t)sala * sizeof(RotaSala), &rota, sizeof(rota));
+    if ((sala == SALA_ENTRADA ? rota.pai != SEM_SALA : rota.pai >= sd->numSalas)
+        || (uint64_t)rota.primeiroFilho + rota.numFilhos > sd->numSalas - 1
+        || rota.ordem >= rota.fim || rota.fim > sd->numSalas) {
+        mapaCorrompido(sd);
+    }
+    return rota;
+}
+
+/**
+ * @brief Decodifica uma sala do arquivo em um slot do cache: saídas copiadas,
+ * rota conferida e nome e pista internados.
+ */
+static void decodificarSala(SalasSobDemanda *sd, IdSala sala, SalaCarregada *carregada) {
+    SalaQuente quente;
+    SalaFria fria;
+    lerDoMapa(sd, sd->posQuentes + (uint64_t)sala * sizeof(SalaQuente), &quente, sizeof(quente));
+    lerDoMapa(sd, sd->posFrias + (uint64_t)sala * sizeof(SalaFria), &fria, sizeof(fria));
+    if ((uint64_t)quente.primeiraSaida + quente.numSaidas > sd->numSaidas) {
+        mapaCorrompido(sd);
+    }
+    carregada->rota = lerRotaDoMapa(sd, sala);
+
+    if (quente.numSaidas > carregada->capacidadeSaidas) {
+        free(carregada->saidas);
+        carregada->saidas = (IdSala*)malloc(quente.numSaidas * sizeof(IdSala));
+        if (carregada->saidas == NULL) {
+            perror("Erro ao alocar memoria para a Mansao");
+            exit(EXIT_FAILURE);
+        }
+        carregada->capacidadeSaidas = quente.numSaidas;
+    }
+    carregada->numSaidas = quente.numSaidas;
+    if (quente.numSaidas > 0) {
+        lerDoMapa(sd, sd->posSaidas + (uint64_t)quente.primeiraSaida * sizeof(IdSala),
+                  carregada->saidas, quente.numSaidas * sizeof(IdSala));
+    }
+    for (uint32_t k = 0; k < quente.numSaidas; k++) {
+        if (carregada->saidas[k] >= sd->numSalas) {
+            mapaCorrompido(sd);
+        }
+    }
+
+    char texto[MAX_LINHA_MAPA];
+    lerTextoDoMapa(sd, fria.nome, texto, sizeof(texto));
+    carregada->nome = internarTexto(texto);
+    lerTextoDoMapa(sd, fria.pista, texto, sizeof(texto));
+    carregada->pista = internarTexto(texto);
+}
+
+/**
+ * @brief Devolve uma sala decodificada, lendo-a do arquivo se ela não estiver
+ * no cache (no lugar da usada há mais tempo).
+ * @return O slot da sala, válido até a próxima chamada.
+ */
+static const SalaCarregada* carregarSala(SalasSobDemanda *sd, IdSala sala) {
+    if (sala >= sd->numSalas) {
+        mapaCorrompido(sd);
+    }
+    uint32_t slot = 0;
+    while (slot < SALAS_EM_CACHE && sd->salaDoSlot[slot] != sala) {
+        slot++;
+    }
+    if (slot < SALAS_EM_CACHE) {
+        METRICA(metricaSomar(&metricas.salasEmCache, 1);)
+    } else {
+        slot = 0;
+        for (uint32_t i = 1; i < SALAS_EM_CACHE; i++) {
+            if (sd->usoDoSlot[i] < sd->usoDoSlot[slot]) {
+                slot = i;
+            }
+        }
+        sd->salaDoSlot[slot] = SEM_SALA; // Até a decodificação terminar
+        decodificarSala(sd, sala, &sd->slots[slot]);
+        sd->salaDoSlot[slot] = sala;
+        METRICA(metricaSomar(&metricas.salasCarregadas, 1);)
+    }
+    sd->usoDoSlot[slot] = ++sd->relogio;
+    return &sd->slots[slot];
+}
+
+/**
+ * @brief Abre uma mansão .dqm no modo sob demanda: só o cabeçalho é lido e
+ * conferido; as salas vêm do arquivo conforme o jogo entra nelas.
+ * Os nomes e pistas são internados na tabela de textos atual (que não
+ * precisa estar vazia), então os ids não são os do arquivo.
+ * @param caminho O arquivo .dqm (deve existir enquanto a mansão estiver aberta).
+ * @param mansao Recebe a mansão, a ser fechada com fecharMansaoSobDemanda().
+ * @return 1 em caso de sucesso, 0 se o arquivo for inválido.
+ */
+int abrirMansaoSobDemanda(const char *caminho, Mansao *mansao) {
+    int fd = open(caminho, O_RDONLY);
+    if (fd < 0) {
+        perror("Erro ao abrir arquivo do mapa");
+        return 0;
+    }
+    CabecalhoMapa cabecalho;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || pread(fd, &cabecalho, sizeof(cabecalho), 0) != (ssize_t)sizeof(cabecalho)
+        || memcmp(cabecalho.magica, MAPA_MAGICA, 4) != 0 || cabecalho.versao != MAPA_VERSAO
+        || cabecalho.numSalas == 0 || cabecalho.numTextos == 0 || cabecalho.tamanhoBlob == 0
+        || tamanhoDoMapa(&cabecalho) != (uint64_t)info.st_size) {
+        fprintf(stderr, "%s: arquivo de mapa invalido\n", caminho);
+        close(fd);
+        return 0;
+    }
+
+    SalasSobDemanda *sd = (SalasSobDemanda*)calloc(1, sizeof(SalasSobDemanda));
+    if (sd == NULL) {
+        perror("Erro ao alocar memoria para a Mansao");
+        exit(EXIT_FAILURE);
+    }
+    sd->fd = fd;
+    sd->caminho = caminho;
+    sd->numSalas = cabecalho.numSalas;
+    sd->numSaidas = cabecalho.numSaidas;
+    sd->numTextos = cabecalho.numTextos;
+    sd->tamanhoBlob = cabecalho.tamanhoBlob;
+    // Mesma ordem das seções de carregarMansao
+    sd->posQuentes = sizeof(CabecalhoMapa) + (uint64_t)cabecalho.numTextos * sizeof(uint64_t);
+    sd->posFrias = sd->posQuentes + (uint64_t)cabecalho.numSalas * sizeof(SalaQuente);
+    sd->posRotas = sd->posFrias + (uint64_t)cabecalho.numSalas * sizeof(SalaFria);
+    sd->posSaidas = sd->posRotas + (uint64_t)cabecalho.numSalas * sizeof(RotaSala);
+    sd->posFilhosRota = sd->posSaidas + (uint64_t)cabecalho.numSaidas * sizeof(IdSala);
+    sd->posSalasPorNome = sd->posFilhosRota + (uint64_t)(cabecalho.numSalas - 1) * sizeof(IdSala);
+    sd->posDeslocamentos = sd->posSalasPorNome + (uint64_t)cabecalho.numSalas * sizeof(IdSala);
+    sd->posBlob = sd->posDeslocamentos + (uint64_t)cabecalho.numTextos * sizeof(uint32_t);
+    for (uint32_t i = 0; i < SALAS_EM_CACHE; i++) {
+        sd->salaDoSlot[i] = SEM_SALA;
+    }
+
+    memset(mansao, 0, sizeof(*mansao));
+    mansao->numSalas = cabecalho.numSalas;
+    mansao->numSaidas = cabecalho.numSaidas;
+    mansao->sobDemanda = sd;
+    return 1;
+}
+
+/**
+ * @brief Fecha o arquivo e libera o cache de uma mansão sob demanda
+ * (não faz nada nas mansões em memória).
+ */
+void fecharMansaoSobDemanda(Mansao *mansao) {
+    SalasSobDemanda *sd = mansao->sobDemanda;
+    if (sd == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < SALAS_EM_CACHE; i++) {
+        free(sd->slots[i].saidas);
+    }
+    close(sd->fd);
+    free(sd);
+    mansao->sobDemanda = NULL;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE NAVEGAÇÃO (Mansão compacta) --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Compara dois nomes sem diferenciar maiúsculas (ASCII), só nos 'n' primeiros bytes.
+ */
+static int compararNomes(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        int ca = tolower((unsigned char)a[i]), cb = tolower((unsigned char)b[i]);
+        if (ca != cb || ca == '\0') {
+            return ca - cb;
+        }
+    }
+    return 0;
+}
+
+// Par usado só para ordenar as salas pelo nome
+typedef struct NomeSala {
+    IdTexto nome;
+    IdSala sala;
+} NomeSala;
+
+static int compararNomeSala(const void *a, const void *b) {
+    const NomeSala *x = (const NomeSala*)a, *y = (const NomeSala*)b;
+    int comparacao = compararNomes(textoDe(x->nome), textoDe(y->nome), SIZE_MAX);
+    if (comparacao != 0) {
+        return comparacao;
+    }
+    return x->sala < y->sala ? -1 : x->sala > y->sala;
+}
+
+/**
+ * @brief Calcula as rotas (árvore de largura, intervalos de pré-ordem) e o
+ * índice de salas por nome de uma mansão cujas saídas já estão prontas.
+ * Os arrays são alocados na arena da mansão.
+ */
+static void construirRotas(Mansao *mansao) {
+    uint32_t n = mansao->numSalas;
+    RotaSala *rotas = (RotaSala*)arenaAlocar(&arenaMansao, n * sizeof(RotaSala));
+    IdSala *filhos = (IdSala*)arenaAlocar(&arenaMansao, (n > 1 ? n - 1 : 1) * sizeof(IdSala));
+    IdSala *salasPorNome = (IdSala*)arenaAlocar(&arenaMansao, n * sizeof(IdSala));
+    IdSala *fila = (IdSala*)malloc(n * sizeof(IdSala));
+    NomeSala *nomes = (NomeSala*)malloc(n * sizeof(NomeSala));
+    if (fila == NULL || nomes == NULL) {
+        perror("Erro ao alocar memoria para a Mansao");
+        exit(EXIT_FAILURE);
+    }
+
+    // Árvore de largura: cada sala fica com o pai que a alcançou primeiro.
+    // Os filhos de uma sala são descobertos juntos, então ficam contíguos.
+    for (uint32_t i = 0; i < n; i++) {
+        rotas[i].pai = SEM_SALA;
+        rotas[i].numFilhos = 0;
+        rotas[i].fim = 1; // Tamanho da subárvore, até a pré-ordem
+    }
+    uint32_t fim = 0, numFilhos = 0;
+    fila[fim++] = SALA_ENTRADA;
+    for (uint32_t i = 0; i < fim; i++) {
+        IdSala sala = fila[i];
+        const SalaQuente *quente = &mansao->quentes[sala];
+        rotas[sala].primeiroFilho = numFilhos;
+        for (uint32_t k = 0; k < quente->numSaidas; k++) {
+            IdSala vizinha = mansao->saidas[quente->primeiraSaida + k];
+            if (vizinha == SALA_ENTRADA || rotas[vizinha].pai != SEM_SALA) {
+                continue;
+            }
+            rotas[vizinha].pai = sala;
+            filhos[numFilhos++] = vizinha;
+            rotas[sala].numFilhos++;
+            fila[fim++] = vizinha;
+        }
+    }
+    // Tamanho das subárvores, das folhas para a raiz
+    for (uint32_t i = fim; i-- > 1; ) {
+        rotas[rotas[fila[i]].pai].fim += rotas[fila[i]].fim;
+    }
+    // Pré-ordem sem recursão: cada filho começa logo depois dos irmãos anteriores
+    rotas[SALA_ENTRADA].ordem = 0;
+    for (uint32_t i = 0; i < fim; i++) {
+        const RotaSala *rota = &rotas[fila[i]];
+        uint32_t proxima = rota->ordem + 1;
+        for (uint32_t k = 0; k < rota->numFilhos; k++) {
+            RotaSala *filho = &rotas[filhos[rota->primeiroFilho + k]];
+            filho->ordem = proxima;
+            proxima += filho->fim;
+        }
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        rotas[i].fim += rotas[i].ordem;
+        nomes[i].nome = mansao->frias[i].nome;
+        nomes[i].sala = i;
+    }
+
+    qsort(nomes, n, sizeof(NomeSala), compararNomeSala);
+    for (uint32_t i = 0; i < n; i++) {
+        salasPorNome[i] = nomes[i].sala;
+    }
+    free(nomes);
+    free(fila);
+
+    mansao->rotas = rotas;
+    mansao->filhosRota = filhos;
+    mansao->salasPorNome = salasPorNome;
+}
+
+/**
+ * @brief Verifica se 'sala' declarou uma porta para 'destino'.
+ */
+static int temSaida(const Sala *sala, const Sala *destino) {
+    for (uint32_t k = 0; k < sala->numSaidas; k++) {
+        if (sala->saidas[k] == destino) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Achata o grafo de Salas em uma Mansao compacta, em ordem de largura.
+ * Toda porta vira de mão dupla: cada sala tem primeiro as saídas que declarou
+ * e depois as voltas para quem declarou uma porta até ela. Os arrays são
+ * alocados na arena da mansão.
+ * @param entrada A sala de entrada do grafo montado com criarSala()/conectarSalas().
+ * @param mansao Recebe o layout plano, já com as rotas.
+ */
+void compilarMansao(Sala *entrada, Mansao *mansao) {
+    // A fila do BFS é a própria ordem final das salas
+    size_t capacidade = 64, fim = 0;
+    Sala **fila = (Sala**)malloc(capacidade * sizeof(Sala*));
+    if (fila == NULL) {
+        perror("Erro ao alocar memoria para a Mansao");
+        exit(EXIT_FAILURE);
+    }
+    entrada->indice = SALA_ENTRADA;
+    fila[fim++] = entrada;
+    for (size_t i = 0; i < fim; i++) {
+        for (uint32_t k = 0; k < fila[i]->numSaidas; k++) {
+            Sala *vizinha = fila[i]->saidas[k];
+            if (vizinha->indice != SEM_SALA) {
+                continue;
+            }
+            if (fim == capacidade) {
+                capacidade *= 2;
+                fila = (Sala**)realloc(fila, capacidade * sizeof(Sala*));
+                if (fila == NULL) {
+                    perror("Erro ao alocar memoria para a Mansao");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            vizinha->indice = (IdSala)fim;
+            fila[fim++] = vizinha;
+        }
+    }
+
+    // Quantas saídas cada sala terá: as declaradas mais as voltas que faltam
+    SalaQuente *quentes = (SalaQuente*)arenaAlocar(&arenaMansao, fim * sizeof(SalaQuente));
+    SalaFria *frias = (SalaFria*)arenaAlocar(&arenaMansao, fim * sizeof(SalaFria));
+    uint32_t *proxima = (uint32_t*)malloc(fim * sizeof(uint32_t)); // Próxima volta livre de cada sala
+    if (proxima == NULL) {
+        perror("Erro ao alocar memoria para a Mansao");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < fim; i++) {
+        quentes[i].numSaidas = fila[i]->numSaidas;
+    }
+    for (size_t i = 0; i < fim; i++) {
+        for (uint32_t k = 0; k < fila[i]->numSaidas; k++) {
+            if (!temSaida(fila[i]->saidas[k], fila[i])) {
+                quentes[fila[i]->saidas[k]->indice].numSaidas++;
+            }
+        }
+    }
+    uint32_t numSaidas = 0;
+    for (size_t i = 0; i < fim; i++) {
+        quentes[i].primeiraSaida = numSaidas;
+        numSaidas += quentes[i].numSaidas;
+    }
+
+    IdSala *saidas = (IdSala*)arenaAlocar(&arenaMansao, (numSaidas ? numSaidas : 1) * sizeof(IdSala));
+    for (size_t i = 0; i < fim; i++) {
+        frias[i].nome = fila[i]->nome;
+        frias[i].pista = fila[i]->pista;
+        for (uint32_t k = 0; k < fila[i]->numSaidas; k++) {
+            saidas[quentes[i].primeiraSaida + k] = fila[i]->saidas[k]->indice;
+        }
+        proxima[i] = quentes[i].primeiraSaida + fila[i]->numSaidas;
+    }
+    // Voltas, na ordem das salas de origem
+    for (size_t i = 0; i < fim; i++) {
+        for (uint32_t k = 0; k < fila[i]->numSaidas; k++) {
+            const Sala *vizinha = fila[i]->saidas[k];
+            if (!temSaida(vizinha, fila[i])) {
+                saidas[proxima[vizinha->indice]++] = (IdSala)i;
+            }
+        }
+    }
+    free(proxima);
+    free(fila);
+
+    mansao->numSalas = (uint32_t)fim;
+    mansao->numSaidas = numSaidas;
+    mansao->quentes = quentes;
+    mansao->saidas = saidas;
+    mansao->frias = frias;
+    mansao->sobDemanda = NULL;
+    construirRotas(mansao);
+}
+
+/**
+ * @brief Sala alcançada pela saída 'k' (0 = esquerda, 1 = direita) de 'sala'.
+ * @return O índice da sala, ou SEM_SALA se não houver essa saída.
+ */
+IdSala mansaoSaida(const Mansao *mansao, IdSala sala, uint32_t k) {
+    if (mansao->sobDemanda != NULL) {
+        const SalaCarregada *carregada = carregarSala(mansao->sobDemanda, sala);
+        return k < carregada->numSaidas ? carregada->saidas[k] : SEM_SALA;
+    }
+    const SalaQuente *quente = &mansao->quentes[sala];
+    return k < quente->numSaidas ? mansao->saidas[quente->primeiraSaida + k] : SEM_SALA;
+}
+
+/**
+ * @brief Quantas saídas uma sala tem.
+ */
+uint32_t mansaoNumSaidas(const Mansao *mansao, IdSala sala) {
+    if (mansao->sobDemanda != NULL) {
+        return carregarSala(mansao->sobDemanda, sala)->numSaidas;
+    }
+    return mansao->quentes[sala].numSaidas;
+}
+
+/**
+ * @brief Id do nome de uma sala.
+ */
+IdTexto mansaoNome(const Mansao *mansao, IdSala sala) {
+    if (mansao->sobDemanda != NULL) {
+        return carregarSala(mansao->sobDemanda, sala)->nome;
+    }
+    return mansao->frias[sala].nome;
+}
+
+/**
+ * @brief Id da pista de uma sala (TEXTO_VAZIO se não houver).
+ */
+IdTexto mansaoPista(const Mansao *mansao, IdSala sala) {
+    if (mansao->sobDemanda != NULL) {
+        return carregarSala(mansao->sobDemanda, sala)->pista;
+    }
+    return mansao->frias[sala].pista;
+}
+
+/**
+ * @brief Rota de uma sala. No modo sob demanda, uma sala fora do cache tem só
+ * a rota lida do arquivo (sem entrar no cache).
+ */
+static RotaSala rotaDaSala(const Mansao *mansao, IdSala sala) {
+    SalasSobDemanda *sd = mansao->sobDemanda;
+    if (sd == NULL) {
+        return mansao->rotas[sala];
+    }
+    for (uint32_t slot = 0; slot < SALAS_EM_CACHE; slot++) {
+        if (sd->salaDoSlot[slot] == sala) {
+            return sd->slots[slot].rota;
+        }
+    }
+    if (sala >= sd->numSalas) {
+        mapaCorrompido(sd);
+    }
+    return lerRotaDoMapa(sd, sala);
+}
+
+/**
+ * @brief Uma posição de um dos índices da mansão (filhosRota ou salasPorNome),
+ * do array em memória ou lida do arquivo.
+ */
+static IdSala salaDoIndice(const Mansao *mansao, const IdSala *indice, uint64_t posicaoNoArquivo, uint32_t i) {
+    SalasSobDemanda *sd = mansao->sobDemanda;
+    if (sd == NULL) {
+        return indice[i];
+    }
+    IdSala sala;
+    lerDoMapa(sd, posicaoNoArquivo + (uint64_t)i * sizeof(IdSala), &sala, sizeof(sala));
+    if (sala >= sd->numSalas) {
+        mapaCorrompido(sd);
+    }
+    return sala;
+}
+
+/**
+ * @brief Nome de uma sala para comparação. No modo sob demanda ele é copiado
+ * do arquivo para 'buffer', sem internar (a busca por nome passa por salas
+ * que o jogador não visita).
+ */
+static const char* nomeParaBusca(const Mansao *mansao, IdSala sala, char buffer[MAX_LINHA_MAPA]) {
+    SalasSobDemanda *sd = mansao->sobDemanda;
+    if (sd == NULL) {
+        return textoDe(mansao->frias[sala].nome);
+    }
+    SalaFria fria;
+    lerDoMapa(sd, sd->posFrias + (uint64_t)sala * sizeof(SalaFria), &fria, sizeof(fria));
+    lerTextoDoMapa(sd, fria.nome, buffer, MAX_LINHA_MAPA);
+    return buffer;
+}
+
+/**
+ * @brief Próxima sala no caminho de 'sala' até 'destino', em O(log saídas).
+ * Destino fora da subárvore: sobe para o pai. Dentro: desce para o último
+ * filho que começa antes dele na pré-ordem.
+ * @return A próxima sala, ou SEM_SALA se já estiver no destino.
+ */
+IdSala proximoPasso(const Mansao *mansao, IdSala sala, IdSala destino) {
+    if (sala == destino) {
+        return SEM_SALA;
+    }
+    RotaSala rota = rotaDaSala(mansao, sala);
+    uint32_t alvo = rotaDaSala(mansao, destino).ordem;
+    if (alvo < rota.ordem || alvo >= rota.fim) {
+        return rota.pai;
+    }
+    uint64_t posFilhos = mansao->sobDemanda != NULL ? mansao->sobDemanda->posFilhosRota : 0;
+    uint32_t inicio = 0, fim = rota.numFilhos; // Procura em [inicio, fim)
+    while (fim - inicio > 1) {
+        uint32_t meio = inicio + (fim - inicio) / 2;
+        IdSala filho = salaDoIndice(mansao, mansao->filhosRota, posFilhos, rota.primeiroFilho + meio);
+        if (rotaDaSala(mansao, filho).ordem <= alvo) {
+            inicio = meio;
+        } else {
+            fim = meio;
+        }
+    }
+    return salaDoIndice(mansao, mansao->filhosRota, posFilhos, rota.primeiroFilho + inicio);
+}
+
+/**
+ * @brief A primeira sala, em ordem alfabética, cujo nome começa com 'prefixo'
+ * (sem diferenciar maiúsculas). Busca binária no índice de nomes.
+ * @return O índice da sala, ou SEM_SALA se nenhuma casar.
+ */
+IdSala procurarSala(const Mansao *mansao, const char *prefixo) {
+    char buffer[MAX_LINHA_MAPA];
+    uint64_t posNomes = mansao->sobDemanda != NULL ? mansao->sobDemanda->posSalasPorNome : 0;
+    uint32_t inicio = 0, fim = mansao->numSalas; // Primeira com nome >= prefixo
+    while (inicio < fim) {
+        uint32_t meio = inicio + (fim - inicio) / 2;
+        IdSala sala = salaDoIndice(mansao, mansao->salasPorNome, posNomes, meio);
+        if (compararNomes(nomeParaBusca(mansao, sala, buffer), prefixo, SIZE_MAX) < 0) {
+            inicio = meio + 1;
+        } else {
+            fim = meio;
+        }
+    }
+    if (inicio == mansao->numSalas) {
+        return SEM_SALA;
+    }
+    IdSala sala = salaDoIndice(mansao, mansao->salasPorNome, posNomes, inicio);
+    return compararNomes(nomeParaBusca(mansao, sala, buffer), prefixo, strlen(prefixo)) == 0 ? sala : SEM_SALA;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE ARQUIVO DE MAPA --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Remove espaços do início e do fim de um campo (modifica a string).
+ */
+static char* aparar(char *texto) {
+    while (isspace((unsigned char)*texto)) {
+        texto++;
+    }
+    char *fim = texto + strlen(texto);
+    while (fim > texto && isspace((unsigned char)fim[-1])) {
+        fim--;
+    }
+    *fim = '\0';
+    return texto;
+}
+
+/**
+ * @brief Divide uma linha em campos separados por '|', já aparados.
+ * Campos ausentes ficam como "".
+ * @param linha A linha (modificada no lugar).
+ * @param campos Recebe MAX_CAMPOS_LINHA ponteiros.
+ */
+static void dividirCampos(char *linha, char *campos[MAX_CAMPOS_LINHA]) {
+    int numCampos = 0;
+    for (int i = 0; i < MAX_CAMPOS_LINHA; i++) {
+        campos[i] = "";
+    }
+    for (char *campo = linha; campo != NULL && numCampos < MAX_CAMPOS_LINHA; numCampos++) {
+        char *separador = strchr(campo, '|');
+        if (separador != NULL) {
+            *separador = '\0';
+        }
+        campos[numCampos] = aparar(campo);
+        campo = separador != NULL ? separador + 1 : NULL;
+    }
+}
+
+/**
+ * @brief Grava uma mansão compacta e a tabela de textos atual no formato .dqm.
+ * @param destino Caminho do arquivo a ser criado.
+ * @param mansao A mansão (salas já em ordem de largura, com as rotas).
+ * @return 1 em caso de sucesso, 0 em caso de erro.
+ */
+int gravarMansao(const char *destino, const Mansao *mansao) {
+    FILE *saida = fopen(destino, "wb");
+    if (saida == NULL) {
+        perror("Erro ao criar arquivo do mapa");
+        return 0;
+    }
+
+    uint32_t numTextos = tabelaTextos.numTextos;
+    uint32_t *deslocamentos = (uint32_t*)malloc(numTextos * sizeof(uint32_t));
+    if (deslocamentos == NULL) {
+        perror("Erro ao alocar memoria para o mapa");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t tamanhoBlob = 0;
+    for (uint32_t id = 0; id < numTextos; id++) {
+        deslocamentos[id] = (uint32_t)tamanhoBlob;
+        tamanhoBlob += strlen(textoDe(id)) + 1;
+    }
+
+    CabecalhoMapa cabecalho;
+    memset(&cabecalho, 0, sizeof(cabecalho));
+    memcpy(cabecalho.magica, MAPA_MAGICA, 4);
+    cabecalho.versao = MAPA_VERSAO;
+    cabecalho.numSalas = mansao->numSalas;
+    cabecalho.numTextos = numTextos;
+    cabecalho.numSaidas = mansao->numSaidas;
+    cabecalho.tamanhoBlob = tamanhoBlob;
+
+    fwrite(&cabecalho, sizeof(cabecalho), 1, saida);
+    fwrite(tabelaTextos.hashes, sizeof(uint64_t), numTextos, saida);
+    fwrite(mansao->quentes, sizeof(SalaQuente), mansao->numSalas, saida);
+    fwrite(mansao->frias, sizeof(SalaFria), mansao->numSalas, saida);
+    fwrite(mansao->rotas, sizeof(RotaSala), mansao->numSalas, saida);
+    fwrite(mansao->saidas, sizeof(IdSala), mansao->numSaidas, saida);
+    fwrite(mansao->filhosRota, sizeof(IdSala), mansao->numSalas - 1, saida);
+    fwrite(mansao->salasPorNome, sizeof(IdSala), mansao->numSalas, saida);
+    fwrite(deslocamentos, sizeof(uint32_t), numTextos, saida);
+    for (uint32_t id = 0; id < numTextos; id++) {
+        fwrite(textoDe(id), 1, strlen(textoDe(id)) + 1, saida);
+    }
+    free(deslocamentos);
+
+    int ok = !ferror(saida);
+    if (fclose(saida) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        perror("Erro ao gravar arquivo do mapa");
+    }
+    return ok;
+}
+
+/**
+ * @brief Escreve um array de índices como inicializador C, com SEM_SALA pelo nome.
+ * Um array vazio vira um elemento só (C não aceita inicializador vazio).
+ */
+static void escreverIndicesC(FILE *saida, const char *declaracao, const uint32_t *valores, uint32_t n) {
+    fprintf(saida, "%s[] = {", declaracao);
+    for (uint32_t i = 0; i < (n > 0 ? n : 1); i++) {
+        if (i % 12 == 0) {
+            fprintf(saida, "\n   ");
+        }
+        if (n == 0 || valores[i] == SEM_SALA) {
+            fprintf(saida, " SEM_SALA,");
+        } else {
+            fprintf(saida, " %u,", valores[i]);
+        }
+    }
+    fprintf(saida, "\n};\n\n");
+}
+
+/**
+ * @brief Grava uma mansão compacta e a tabela de textos atual como tabelas C
+ * constantes, com as mesmas seções do .dqm. Compilado com
+ * -DDQ_MANSAO_EMBUTIDA='"arquivo.h"', o arquivo substitui a mansão padrão,
+ * que já vem pronta no executável (ver abrirMansaoEmbutida).
+ * @param destino Caminho do arquivo a ser criado.
+ * @param origem A descrição de onde a mansão veio (só para o comentário).
+ * @param mansao A mansão (salas já em ordem de largura, com as rotas).
+ * @return 1 em caso de sucesso, 0 em caso de erro.
+ */
+int gravarMansaoC(const char *destino, const char *origem, const Mansao *mansao) {
+    FILE *saida = fopen(destino, "w");
+    if (saida == NULL) {
+        perror("Erro ao criar arquivo do mapa");
+        return 0;
+    }
+    uint32_t numTextos = tabelaTextos.numTextos;
+    fprintf(saida, "// Mansão embutida gerada por --converter a partir de %s: %u salas, %u textos.\n"
+                   "// Não edite; gere de novo a partir da descrição.\n\n", origem, mansao->numSalas, numTextos);
+
+    fprintf(saida, "static const uint64_t hashesEmbutidos[] = {");
+    for (uint32_t id = 0; id < numTextos; id++) {
+        fprintf(saida, "%s0x%016llxull,", id % 4 == 0 ? "\n    " : " ", (unsigned long long)tabelaTextos.hashes[id]);
+    }
+    fprintf(saida, "\n};\n\n");
+
+    // Um literal por texto, cada um com o '\0' explícito (o do fim do blob é o do próprio literal)
+    fprintf(saida, "static const char blobEmbutido[] =");
+    uint32_t *deslocamentos = (uint32_t*)malloc(numTextos * sizeof(uint32_t));
+    if (deslocamentos == NULL) {
+        perror("Erro ao alocar memoria para o mapa");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t tamanhoBlob = 0;
+    for (uint32_t id = 0; id < numTextos; id++) {
+        deslocamentos[id] = tamanhoBlob;
+        fprintf(saida, "\n    \"");
+        for (const unsigned char *c = (const unsigned char*)textoDe(id); *c != '\0'; c++, tamanhoBlob++) {
+            if (*c == '"' || *c == '\\') {
+                fprintf(saida, "\\%c", *c);
+            } else if (*c < 0x20 || *c == 0x7F) {
+                fprintf(saida, "\\%03o", *c);
+            } else {
+                fputc(*c, saida);
+            }
+        }
+        tamanhoBlob++;
+        fprintf(saida, "%s\"", id + 1 < numTextos ? "\\0" : "");
+    }
+    fprintf(saida, ";\n\n");
+    escreverIndicesC(saida, "static const uint32_t deslocamentosEmbutidos", deslocamentos, numTextos);
+    free(deslocamentos);
+
+    fprintf(saida, "static const SalaQuente quentesEmbutidos[] = {\n");
+    for (uint32_t i = 0; i < mansao->numSalas; i++) {
+        fprintf(saida, "    {%u, %u},\n", mansao->quentes[i].primeiraSaida, mansao->quentes[i].numSaidas);
+    }
+    fprintf(saida, "};\n\nstatic const SalaFria friasEmbutidas[] = {\n");
+    for (uint32_t i = 0; i < mansao->numSalas; i++) {
+        fprintf(saida, "    {%u, %u}, // %s\n", mansao->frias[i].nome, mansao->frias[i].pista,
+                textoDe(mansao->frias[i].nome));
+    }
+    fprintf(saida, "};\n\nstatic const RotaSala rotasEmbutidas[] = {\n");
+    for (uint32_t i = 0; i < mansao->numSalas; i++) {
+        const RotaSala *rota = &mansao->rotas[i];
+        if (rota->pai == SEM_SALA) {
+            fprintf(saida, "    {SEM_SALA, ");
+        } else {
+            fprintf(saida, "    {%u, ", rota->pai);
+        }
+        fprintf(saida, "%u, %u, %u, %u},\n", rota->ordem, rota->fim, rota->primeiroFilho, rota->numFilhos);
+    }
+    fprintf(saida, "};\n\n");
+    escreverIndicesC(saida, "static const IdSala saidasEmbutidas", mansao->saidas, mansao->numSaidas);
+    escreverIndicesC(saida, "static const IdSala filhosRotaEmbutidos", mansao->filhosRota, mansao->numSalas - 1);
+    escreverIndicesC(saida, "static const IdSala salasPorNomeEmbutidas", mansao->salasPorNome, mansao->numSalas);
+
+    int ok = !ferror(saida);
+    if (fclose(saida) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        perror("Erro ao gravar arquivo do mapa");
+    }
+    return ok;
+}
+
+/**
+ * @brief Converte a descrição em texto de uma mansão para o formato binário .dqm.
+ * Cada linha descreve uma sala: "nome | pista | saída | saída | ...", com "-"
+ * (ou campo vazio) para ausência; a primeira saída é a esquerda e a segunda, a
+ * direita. As portas valem nos dois sentidos e podem formar ciclos. A primeira
+ * sala é a entrada; linhas vazias e iniciadas por '#' são ignoradas. Os nomes
+ * das salas são únicos. Um destino "*.h" recebe a mansão como tabelas C
+ * constantes (gravarMansaoC), para ser compilada junto com o jogo.
+ * @param origem Caminho do arquivo de texto.
+ * @param destino Caminho do arquivo binário (ou do cabeçalho C) a ser gerado.
+ * @return EXIT_SUCCESS ou EXIT_FAILURE.
+ */
+int converterMapa(const char *origem, const char *destino) {
+    FILE *entrada = fopen(origem, "r");
+    if (entrada == NULL) {
+        perror("Erro ao abrir descricao do mapa");
+        return EXIT_FAILURE;
+    }
+
+    inicializarTextos();
+
+    // Passo 1: cria as salas; as saídas ficam pendentes (por nome) até todas existirem
+    typedef struct Pendencia {
+        Sala *sala;
+        uint32_t numSaidas;
+        IdTexto saidas[MAX_CAMPOS_LINHA - 2];
+    } Pendencia;
+    Pendencia *salas = NULL;
+    uint32_t numSalas = 0, capacidadeSalas = 0;
+    uint32_t *salaDoNome = NULL; // id do nome -> índice da sala (SEM_SALA se não for sala)
+    uint32_t capacidadeNomes = 0;
+    char linha[MAX_LINHA_MAPA];
+    int numeroLinha = 0;
+    int erro = 0;
+
+    while (!erro && fgets(linha, sizeof(linha), entrada) != NULL) {
+        numeroLinha++;
+        linha[strcspn(linha, "\r\n")] = '\0';
+        char *conteudo = aparar(linha);
+        if (conteudo[0] == '\0' || conteudo[0] == '#') {
+            continue;
+        }
+
+        char *campos[MAX_CAMPOS_LINHA];
+        dividirCampos(conteudo, campos);
+        if (campos[0][0] == '\0') {
+            fprintf(stderr, "%s:%d: sala sem nome\n", origem, numeroLinha);
+            erro = 1;
+            break;
+        }
+
+        if (numSalas == capacidadeSalas) {
+            capacidadeSalas = capacidadeSalas ? capacidadeSalas * 2 : 64;
+            salas = (Pendencia*)realloc(salas, capacidadeSalas * sizeof(Pendencia));
+            if (salas == NULL) {
+                perror("Erro ao alocar memoria para o mapa");
+                exit(EXIT_FAILURE);
+            }
+        }
+        Pendencia *pendencia = &salas[numSalas];
+        pendencia->sala = criarSala(campos[0], strcmp(campos[1], "-") == 0 ? "" : campos[1]);
+        pendencia->numSaidas = 0;
+        for (int c = 2; c < MAX_CAMPOS_LINHA; c++) {
+            if (campos[c][0] != '\0' && strcmp(campos[c], "-") != 0) {
+                pendencia->saidas[pendencia->numSaidas++] = internarTexto(campos[c]);
+            }
+        }
+
+        if (tabelaTextos.numTextos > capacidadeNomes) {
+            uint32_t capacidade = capacidadeNomes ? capacidadeNomes : 64;
+            while (capacidade < tabelaTextos.numTextos) {
+                capacidade *= 2;
+            }
+            salaDoNome = (uint32_t*)realloc(salaDoNome, capacidade * sizeof(uint32_t));
+            if (salaDoNome == NULL) {
+                perror("Erro ao alocar memoria para o mapa");
+                exit(EXIT_FAILURE);
+            }
+            for (uint32_t i = capacidadeNomes; i < capacidade; i++) {
+                salaDoNome[i] = SEM_SALA;
+            }
+            capacidadeNomes = capacidade;
+        }
+        IdTexto nome = pendencia->sala->nome;
+        if (salaDoNome[nome] != SEM_SALA) {
+            fprintf(stderr, "%s:%d: sala \"%s\" repetida\n", origem, numeroLinha, campos[0]);
+            erro = 1;
+            break;
+        }
+        salaDoNome[nome] = numSalas++;
+    }
+    fclose(entrada);
+
+    // Passo 2: liga cada sala às saídas citadas pelo nome
+    for (uint32_t i = 0; !erro && i < numSalas; i++) {
+        for (uint32_t k = 0; k < salas[i].numSaidas && !erro; k++) {
+            IdTexto nome = salas[i].saidas[k];
+            uint32_t indice = nome < capacidadeNomes ? salaDoNome[nome] : SEM_SALA;
+            if (indice == SEM_SALA) {
+                fprintf(stderr, "%s: sala \"%s\" nao foi definida\n", origem, textoDe(nome));
+                erro = 1;
+            } else {
+                conectarSalas(salas[i].sala, salas[indice].sala);
+            }
+        }
+    }
+    // As voltas já entram aqui para que uma sala que só declara portas (sem ser
+    // citada por ninguém) também seja alcançável a partir da entrada
+    for (uint32_t i = 0; !erro && i < numSalas; i++) {
+        for (uint32_t k = 0; k < salas[i].numSaidas; k++) {
+            Sala *vizinha = salas[salaDoNome[salas[i].saidas[k]]].sala;
+            if (!temSaida(vizinha, salas[i].sala)) {
+                conectarSalas(vizinha, salas[i].sala);
+            }
+        }
+    }
+    if (!erro && numSalas == 0) {
+        fprintf(stderr, "%s: nenhuma sala definida\n", origem);
+        erro = 1;
+    }
+
+    // Passo 3: achata em ordem de largura e grava
+    if (!erro) {
+        Mansao mansao;
+        compilarMansao(salas[0].sala, &mansao);
+        if (mansao.numSalas < numSalas) {
+            fprintf(stderr, "%s: %u salas inalcançáveis a partir da entrada foram descartadas\n",
+                    origem, numSalas - mansao.numSalas);
+        }
+        size_t tamanho = strlen(destino);
+        if (tamanho >= 2 && strcmp(destino + tamanho - 2, ".h") == 0) {
+            erro = !gravarMansaoC(destino, origem, &mansao);
+        } else {
+            erro = !gravarMansao(destino, &mansao);
+        }
+        if (!erro) {
+            printf("Mapa convertido: %u salas, %u textos -> %s\n", mansao.numSalas, tabelaTextos.numTextos, destino);
+        }
+    }
+
+    free(salas);
+    free(salaDoNome);
+    arenaDestruir(&arenaMansao);
+    liberarTextos();
+    return erro ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Desfaz o mapeamento de um arquivo de mapa.
+ * @param mapa O mapa aberto por carregarMansao().
+ */
+void fecharMapa(MapaArquivo *mapa) {
+    if (mapa->base != NULL) {
+        munmap(mapa->base, mapa->tamanho);
+        mapa->base = NULL;
+        mapa->tamanho = 0;
+    }
+}
+
+/**
+ * @brief Carrega uma mansão no formato .dqm mapeando o arquivo em memória.
+ * As salas e as strings são usadas direto do mapeamento: nada é copiado,
+ * alocado por sala ou interpretado linha a linha.
+ * Deve ser chamada com a tabela de textos vazia.
+ * @param caminho O arquivo .dqm.
+ * @param mapa Recebe o mapeamento, a ser desfeito com fecharMapa().
+ * @param mansao Recebe a mansão compacta apontando para o mapeamento.
+ * @return 1 em caso de sucesso, 0 se o arquivo for inválido.
+ */
+int carregarMansao(const char *caminho, MapaArquivo *mapa, Mansao *mansao) {
+    int fd = open(caminho, O_RDONLY);
+    if (fd < 0) {
+        perror("Erro ao abrir arquivo do mapa");
+        return 0;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CabecalhoMapa)) {
+        fprintf(stderr, "%s: arquivo de mapa invalido\n", caminho);
+        close(fd);
+        return 0;
+    }
+    void *base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("Erro ao mapear arquivo do mapa");
+        return 0;
+    }
+    mapa->base = base;
+    mapa->tamanho = (size_t)info.st_size;
+
+    // Validação do cabeçalho e dos limites antes de confiar em qualquer índice
+    const CabecalhoMapa *cabecalho = (const CabecalhoMapa*)base;
+    if (memcmp(cabecalho->magica, MAPA_MAGICA, 4) != 0 || cabecalho->versao != MAPA_VERSAO
+        || cabecalho->numSalas == 0 || cabecalho->numTextos == 0 || cabecalho->tamanhoBlob == 0
+        || tamanhoDoMapa(cabecalho) != mapa->tamanho) {
+        fprintf(stderr, "%s: arquivo de mapa invalido\n", caminho);
+        fecharMapa(mapa);
+        return 0;
+    }
+
+    uint32_t numSalas = cabecalho->numSalas;
+    const uint64_t *hashes = (const uint64_t*)(cabecalho + 1);
+    const SalaQuente *quentes = (const SalaQuente*)(hashes + cabecalho->numTextos);
+    const SalaFria *frias = (const SalaFria*)(quentes + numSalas);
+    const RotaSala *rotas = (const RotaSala*)(frias + numSalas);
+    const IdSala *saidas = (const IdSala*)(rotas + numSalas);
+    const IdSala *filhosRota = saidas + cabecalho->numSaidas;
+    const IdSala *salasPorNome = filhosRota + (numSalas - 1);
+    const uint32_t *deslocamentos = (const uint32_t*)(salasPorNome + numSalas);
+    const char *blob = (const char*)(deslocamentos + cabecalho->numTextos);
+
+    int valido = blob[cabecalho->tamanhoBlob - 1] == '\0';
+    for (uint32_t id = 0; valido && id < cabecalho->numTextos; id++) {
+        valido = deslocamentos[id] < cabecalho->tamanhoBlob;
+    }
+    valido = valido && blob[deslocamentos[0]] == '\0'; // Só depois de conferir o deslocamento
+    for (uint32_t k = 0; valido && k < cabecalho->numSaidas; k++) {
+        valido = saidas[k] < numSalas;
+    }
+    for (uint32_t k = 0; valido && k + 1 < numSalas; k++) {
+        valido = filhosRota[k] < numSalas;
+    }
+    // Rotas coerentes garantem que proximoPasso sempre chega ao destino
+    valido = valido && rotas[SALA_ENTRADA].pai == SEM_SALA && rotas[SALA_ENTRADA].ordem == 0
+             && rotas[SALA_ENTRADA].fim == numSalas;
+    for (uint32_t i = 0; valido && i < numSalas; i++) {
+        const RotaSala *rota = &rotas[i];
+        valido = frias[i].nome < cabecalho->numTextos && frias[i].pista < cabecalho->numTextos
+            && salasPorNome[i] < numSalas
+            && (uint64_t)quentes[i].primeiraSaida + quentes[i].numSaidas <= cabecalho->numSaidas
+            && (uint64_t)rota->primeiroFilho + rota->numFilhos <= numSalas - 1
+            && rota->ordem < rota->fim && rota->fim <= numSalas
+            && (i == SALA_ENTRADA || (rota->pai < numSalas && rotas[rota->pai].ordem < rota->ordem
+                                      && rota->fim <= rotas[rota->pai].fim));
+        for (uint32_t k = 0; valido && k < rota->numFilhos; k++) {
+            IdSala filho = filhosRota[rota->primeiroFilho + k];
+            valido = rotas[filho].pai == i
+                && (k == 0 || rotas[filhosRota[rota->primeiroFilho + k - 1]].fim <= rotas[filho].ordem);
+        }
+    }
+    if (!valido) {
+        fprintf(stderr, "%s: arquivo de mapa corrompido\n", caminho);
+        fecharMapa(mapa);
+        return 0;
+    }
+
+    adotarTextos(blob, deslocamentos, hashes, cabecalho->numTextos);
+
+    mansao->numSalas = numSalas;
+    mansao->numSaidas = cabecalho->numSaidas;
+    mansao->quentes = quentes;
+    mansao->saidas = saidas;
+    mansao->frias = frias;
+    mansao->rotas = rotas;
+    mansao->filhosRota = filhosRota;
+    mansao->salasPorNome = salasPorNome;
+    mansao->sobDemanda = NULL;
+    return 1;
+}
+
+/**
+ * @brief Abre a mansão embutida no executável. As tabelas já vêm prontas (e
+ * conferidas quando foram geradas), então nada é alocado ou copiado por sala:
+ * só o índice dos textos é montado, como em carregarMansao.
+ * Deve ser chamada com a tabela de textos vazia.
+ * @param mansao Recebe a mansão compacta apontando para as tabelas constantes.
+ */
+void abrirMansaoEmbutida(Mansao *mansao) {
+    uint32_t numSalas = (uint32_t)(sizeof(quentesEmbutidos) / sizeof(quentesEmbutidos[0]));
+    adotarTextos(blobEmbutido, deslocamentosEmbutidos, hashesEmbutidos,
+                 (uint32_t)(sizeof(deslocamentosEmbutidos) / sizeof(deslocamentosEmbutidos[0])));
+    mansao->numSalas = numSalas;
+    // As faixas de saídas são contíguas e em ordem: a última termina no fim do array
+    mansao->numSaidas = quentesEmbutidos[numSalas - 1].primeiraSaida + quentesEmbutidos[numSalas - 1].numSaidas;
+    mansao->quentes = quentesEmbutidos;
+    mansao->saidas = saidasEmbutidas;
+    mansao->frias = friasEmbutidas;
+    mansao->rotas = rotasEmbutidas;
+    mansao->filhosRota = filhosRotaEmbutidos;
+    mansao->salasPorNome = salasPorNomeEmbutidas;
+    mansao->sobDemanda = NULL;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE PISTAS (B-tree) --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Calcula o prefixo inline de uma pista (8 primeiros bytes, big-endian).
+ * A ordem numérica dos prefixos coincide com a ordem de strcmp.
+ * @param pista A string da pista.
+ * @return O prefixo preenchido com zeros à direita.
+ */
+static uint64_t prefixoPista(const char *pista) {
+    uint64_t prefixo = 0;
+    int i = 0;
+    for (; i < 8 && pista[i] != '\0'; i++) {
+        prefixo = (prefixo << 8) | (unsigned char)pista[i];
+    }
+    return i == 0 ? 0 : prefixo << (8 * (8 - i));
+}
+
+/**
+ * @brief Compara uma pista com a chave 'i' de um nó: id, depois prefixo, depois texto.
+ * @return Negativo, zero ou positivo, como strcmp.
+ */
+static int compararChave(const PistaColetada *no, int i, uint64_t prefixo, IdTexto pista) {
+    METRICA(metricaSomar(&metricas.btreeComparacoes, 1);)
+    if (pista == no->pistas[i]) {
+        return 0;
+    }
+    if (prefixo != no->prefixos[i]) {
+        return prefixo < no->prefixos[i] ? -1 : 1;
+    }
+    return strcmp(textoDe(pista) + 8, textoDe(no->pistas[i]) + 8);
+}
+
+/**
+ * @brief Aloca um nó vazio da B-tree na arena da partida.
+ */
+static PistaColetada* criarNoPistas(Arena *arena, int folha) {
+    PistaColetada *no = (PistaColetada*)arenaAlocarNo(arena, NO_PISTAS);
+    no->referencias = 1;
+    no->numChaves = 0;
+    no->folha = folha;
+    return no;
+}
+
+/**
+ * @brief Soma uma referência aos filhos de um nó (que passam a ser dele e de uma cópia).
+ */
+static void reterFilhosPistas(PistaColetada *no, int primeiro, int numFilhos) {
+    if (!no->folha) {
+        for (int f = primeiro; f < primeiro + numFilhos; f++) {
+            no->filhos[f]->referencias++;
+        }
+    }
+}
+
+/**
+ * @brief Garante que um nó do caminho da inserção seja só da versão atual.
+ * Um nó exclusivo volta como está, para ser alterado no lugar; um nó que
+ * outra versão também alcança é copiado, e a cópia divide os filhos com ele.
+ * @param no O nó, alcançado por uma referência que passa a ser da cópia.
+ */
+static PistaColetada* privatizarNoPistas(Arena *arena, PistaColetada *no) {
+    if (no->referencias == 1) {
+        return no;
+    }
+    PistaColetada *copia = (PistaColetada*)arenaAlocarNo(arena, NO_PISTAS);
+    memcpy(copia, no, sizeof(PistaColetada));
+    copia->referencias = 1;
+    reterFilhosPistas(no, 0, no->numChaves + 1);
+    no->referencias--;
+    return copia;
+}
+
+/**
+ * @brief Larga uma referência a uma subárvore; os nós que ficam sem nenhuma
+ * voltam à lista livre da arena.
+ */
+static void soltarPistas(Arena *arena, PistaColetada *no) {
+    if (no == NULL || --no->referencias > 0) {
+        return;
+    }
+    if (!no->folha) {
+        for (int f = 0; f <= no->numChaves; f++) {
+            soltarPistas(arena, no->filhos[f]);
+        }
+    }
+    arenaDevolverNo(arena, NO_PISTAS, no);
+}
+
+/**
+ * @brief Divide o filho cheio 'i' de 'pai' (um nó privado), promovendo a
+ * chave do meio. Um filho exclusivo vira a metade esquerda no lugar; um filho
+ * compartilhado fica intacto, e as duas metades são nós novos.
+ */
+static void dividirFilho(Arena *arena, PistaColetada *pai, int i) {
+    METRICA(metricaSomar(&metricas.btreeDivisoes, 1);)
+    PistaColetada *cheio = pai->filhos[i];
+    PistaColetada *direito = criarNoPistas(arena, cheio->folha);
+    direito->numChaves = GRAU_BTREE - 1;
+    memcpy(direito->prefixos, cheio->prefixos + GRAU_BTREE, (GRAU_BTREE - 1) * sizeof(uint64_t));
+    memcpy(direito->pistas, cheio->pistas + GRAU_BTREE, (GRAU_BTREE - 1) * sizeof(IdTexto));
+    memcpy(direito->suspeitos, cheio->suspeitos + GRAU_BTREE, (GRAU_BTREE - 1) * sizeof(IdTexto));
+    if (!cheio->folha) {
+        memcpy(direito->filhos, cheio->filhos + GRAU_BTREE, GRAU_BTREE * sizeof(PistaColetada*));
+    }
+
+    PistaColetada *esquerdo = cheio;
+    if (cheio->referencias > 1) {
+        esquerdo = criarNoPistas(arena, cheio->folha);
+        memcpy(esquerdo->prefixos, cheio->prefixos, (GRAU_BTREE - 1) * sizeof(uint64_t));
+        memcpy(esquerdo->pistas, cheio->pistas, (GRAU_BTREE - 1) * sizeof(IdTexto));
+        memcpy(esquerdo->suspeitos, cheio->suspeitos, (GRAU_BTREE - 1) * sizeof(IdTexto));
+        if (!cheio->folha) {
+            memcpy(esquerdo->filhos, cheio->filhos, GRAU_BTREE * sizeof(PistaColetada*));
+        }
+        reterFilhosPistas(cheio, 0, 2 * GRAU_BTREE);
+        cheio->referencias--;
+    }
+    esquerdo->numChaves = GRAU_BTREE - 1;
+
+    memmove(pai->filhos + i + 2, pai->filhos + i + 1, (pai->numChaves - i) * sizeof(PistaColetada*));
+    memmove(pai->prefixos + i + 1, pai->prefixos + i, (pai->numChaves - i) * sizeof(uint64_t));
+    memmove(pai->pistas + i + 1, pai->pistas + i, (pai->numChaves - i) * sizeof(IdTexto));
+    memmove(pai->suspeitos + i + 1, pai->suspeitos + i, (pai->numChaves - i) * sizeof(IdTexto));
+    pai->filhos[i] = esquerdo;
+    pai->filhos[i + 1] = direito;
+    pai->prefixos[i] = cheio->prefixos[GRAU_BTREE - 1];
+    pai->pistas[i] = cheio->pistas[GRAU_BTREE - 1];
+    pai->suspeitos[i] = cheio->suspeitos[GRAU_BTREE - 1];
+    pai->numChaves++;
+}
+
+/**
+ * @brief Consulta o suspeito associado a uma pista coletada.
+ * @param raiz A raiz da B-tree de pistas (de qualquer versão).
+ * @param pista O id da pista procurada.
+ * @return O id do suspeito, ou TEXTO_INEXISTENTE se a pista não foi coletada.
+ */
+IdTexto suspeitoDaPista(const PistaColetada *raiz, IdTexto pista) {
+    uint64_t prefixo = prefixoPista(textoDe(pista));
+    while (raiz != NULL) {
+        int i = 0;
+        int comparacao = 1;
+        while (i < raiz->numChaves && (comparacao = compararChave(raiz, i, prefixo, pista)) > 0) {
+            i++;
+        }
+        if (i < raiz->numChaves && comparacao == 0) {
+            return raiz->suspeitos[i];
+        }
+        raiz = raiz->folha ? NULL : raiz->filhos[i];
+    }
+    return TEXTO_INEXISTENTE;
+}
+
+/**
+ * @brief Associa uma pista a um suspeito, devolvendo uma nova versão da árvore.
+ * Garante a ordenação alfabética e altura O(log n) mesmo com pistas chegando
+ * em ordem quase ordenada. A descida é iterativa, copiando os nós do caminho
+ * que outra versão também alcança e dividindo os cheios; essas versões
+ * continuam válidas.
+ * @param arena A arena da partida, de onde saem os nós.
+ * @param raiz A raiz da versão atual (NULL se vazia). A referência do
+ * chamador a ela passa para a raiz devolvida.
+ * @param pista O id da pista (chave).
+ * @param suspeito O id do suspeito (valor).
+ * @param anterior Recebe o suspeito associado antes, ou TEXTO_INEXISTENTE se a pista é nova.
+ * @return A raiz da nova versão (a própria 'raiz' se nada mudou).
+ */
+PistaColetada* inserirPista(Arena *arena, PistaColetada *raiz, IdTexto pista, IdTexto suspeito, IdTexto *anterior) {
+    if (raiz != NULL && raiz->referencias > 1) {
+        // Outra versão alcança a raiz: confere antes de copiar qualquer nó
+        *anterior = suspeitoDaPista(raiz, pista);
+        if (*anterior == suspeito) {
+            return raiz; // Nada muda: a versão atual é compartilhada inteira
+        }
+    }
+    *anterior = TEXTO_INEXISTENTE;
+    uint64_t prefixo = prefixoPista(textoDe(pista));
+
+    if (raiz == NULL) {
+        raiz = criarNoPistas(arena, 1);
+    } else if (raiz->numChaves == MAX_CHAVES_BTREE) {
+        PistaColetada *novaRaiz = criarNoPistas(arena, 0);
+        novaRaiz->filhos[0] = raiz;
+        dividirFilho(arena, novaRaiz, 0);
+        raiz = novaRaiz;
+    } else {
+        raiz = privatizarNoPistas(arena, raiz);
+    }
+
+    // Daqui em diante 'no' é sempre um nó privado desta versão
+    METRICA(uint64_t nivel = 1;)
+    PistaColetada *no = raiz;
+    while (1) {
+        int i = 0;
+        int comparacao = 1;
+        while (i < no->numChaves && (comparacao = compararChave(no, i, prefixo, pista)) > 0) {
+            i++;
+        }
+        if (i < no->numChaves && comparacao == 0) {
+            *anterior = no->suspeitos[i];
+            no->suspeitos[i] = suspeito; // Pista já coletada
+            return raiz;
+        }
+
+        if (no->folha) {
+            memmove(no->prefixos + i + 1, no->prefixos + i, (no->numChaves - i) * sizeof(uint64_t));
+            memmove(no->pistas + i + 1, no->pistas + i, (no->numChaves - i) * sizeof(IdTexto));
+            memmove(no->suspeitos + i + 1, no->suspeitos + i, (no->numChaves - i) * sizeof(IdTexto));
+            no->prefixos[i] = prefixo;
+            no->pistas[i] = pista;
+            no->suspeitos[i] = suspeito;
+            no->numChaves++;
+            METRICA(metricaSomar(&metricas.btreeInsercoes, 1);
+                    metricaSomar(&metricas.btreeNiveis, nivel);
+                    metricaMaximo(&metricas.btreeMaxProfundidade, nivel);)
+            return raiz;
+        }
+
+        if (no->filhos[i]->numChaves == MAX_CHAVES_BTREE) {
+            dividirFilho(arena, no, i);
+            comparacao = compararChave(no, i, prefixo, pista);
+            if (comparacao == 0) {
+                *anterior = no->suspeitos[i];
+                no->suspeitos[i] = suspeito;
+                return raiz;
+            }
+            if (comparacao > 0) {
+                i++;
+            }
+        } else {
+            no->filhos[i] = privatizarNoPistas(arena, no->filhos[i]);
+        }
+        no = no->filhos[i];
+        METRICA(nivel++;)
+    }
+}
+
+/**
+ * @brief Exibe todas as pistas coletadas em ordem (percurso "Em Ordem" da B-tree).
+ * @param sessao A sessão (para a saída).
+ * @param raiz O ponteiro para a raiz da árvore de pistas.
+ */
+void listarPistasColetadas(Sessao *sessao, const PistaColetada *raiz) {
+    if (raiz == NULL) {
+        return;
+    }
+    for (int i = 0; i < raiz->numChaves; i++) {
+        if (!raiz->folha) {
+            listarPistasColetadas(sessao, raiz->filhos[i]);
+        }
+        exibir(sessao, " -> %s\n", textoDe(raiz->pistas[i]));
+    }
+    if (!raiz->folha) {
+        listarPistasColetadas(sessao, raiz->filhos[raiz->numChaves]);
+    }
+}
+
+/**
+ * @brief Lista, em ordem, as pistas que começam com 'prefixo' (diferencia maiúsculas).
+ * Desce até a primeira chave >= prefixo e para na primeira que não casa, então
+ * o custo é O(log n + resultado).
+ * @param comprimento strlen(prefixo).
+ * @param encontradas Contador de pistas listadas, incrementado aqui.
+ * @return 0 quando já passou do intervalo do prefixo (a busca pode parar).
+ */
+int listarPistasComPrefixo(Sessao *sessao, const PistaColetada *raiz, const char *prefixo,
+                           size_t comprimento, size_t *encontradas) {
+    if (raiz == NULL) {
+        return 1;
+    }
+    int i = 0;
+    while (i < raiz->numChaves && strcmp(textoDe(raiz->pistas[i]), prefixo) < 0) {
+        i++;
+    }
+    for (; i <= raiz->numChaves; i++) {
+        if (!raiz->folha && !listarPistasComPrefixo(sessao, raiz->filhos[i], prefixo, comprimento, encontradas)) {
+            return 0;
+        }
+        if (i == raiz->numChaves) {
+            break;
+        }
+        const char *pista = textoDe(raiz->pistas[i]);
+        if (strncmp(pista, prefixo, comprimento) != 0) {
+            return 0;
+        }
+        exibir(sessao, " -> %s\n", pista);
+        (*encontradas)++;
+    }
+    return 1;
+}
+
+/**
+ * @brief Copia os pares pista/suspeito da árvore, em ordem, para 'destino'.
+ * @return Quantas pistas foram copiadas.
+ */
+size_t copiarPistasEmOrdem(const PistaColetada *raiz, ItemHash *destino) {
+    if (raiz == NULL) {
+        return 0;
+    }
+    size_t n = 0;
+    for (int i = 0; i < raiz->numChaves; i++) {
+        if (!raiz->folha) {
+            n += copiarPistasEmOrdem(raiz->filhos[i], destino + n);
+        }
+        destino[n].pista = raiz->pistas[i];
+        destino[n++].suspeito = raiz->suspeitos[i];
+    }
+    if (!raiz->folha) {
+        n += copiarPistasEmOrdem(raiz->filhos[raiz->numChaves], destino + n);
+    }
+    return n;
+}
+
+/**
+ * @brief Quantas chaves cabem em uma subárvore cheia da altura dada (0 = folha).
+ */
+static size_t capacidadeSubarvore(int altura) {
+    size_t capacidade = MAX_CHAVES_BTREE;
+    while (altura-- > 0 && capacidade < SIZE_MAX / (2 * GRAU_BTREE)) {
+        capacidade = capacidade * (2 * GRAU_BTREE) + MAX_CHAVES_BTREE;
+    }
+    return capacidade;
+}
+
+/**
+ * @brief Monta uma subárvore com as n pistas ordenadas, repartindo-as por igual
+ * entre o menor número de filhos que comporta todas.
+ */
+static PistaColetada* montarSubarvore(Arena *arena, const ItemHash *itens, size_t n, int altura) {
+    PistaColetada *no = criarNoPistas(arena, altura == 0);
+    if (altura == 0) {
+        for (size_t i = 0; i < n; i++) {
+            no->pistas[i] = itens[i].pista;
+            no->suspeitos[i] = itens[i].suspeito;
+            no->prefixos[i] = prefixoPista(textoDe(itens[i].pista));
+        }
+        no->numChaves = (int)n;
+        return no;
+    }
+
+    size_t capacidadeFilho = capacidadeSubarvore(altura - 1);
+    size_t numFilhos = (n + 1 + capacidadeFilho) / (capacidadeFilho + 1); // teto((n + 1) / (cap + 1))
+    size_t restantes = n - (numFilhos - 1);
+    size_t base = restantes / numFilhos, extra = restantes % numFilhos;
+    size_t usado = 0;
+    for (size_t f = 0; f < numFilhos; f++) {
+        size_t tamanho = base + (f < extra ? 1 : 0);
+        no->filhos[f] = montarSubarvore(arena, itens + usado, tamanho, altura - 1);
+        usado += tamanho;
+        if (f + 1 < numFilhos) {
+            no->pistas[f] = itens[usado].pista;
+            no->suspeitos[f] = itens[usado].suspeito;
+            no->prefixos[f] = prefixoPista(textoDe(itens[usado].pista));
+            usado++;
+        }
+    }
+    no->numChaves = (int)numFilhos - 1;
+    return no;
+}
+
+/**
+ * @brief Monta a B-tree de uma vez a partir de pares com as pistas já
+ * ordenadas e sem repetição (como os de copiarPistasEmOrdem), sem nenhuma inserção.
+ * @return A raiz da nova árvore (NULL se n == 0).
+ */
+PistaColetada* construirPistas(Arena *arena, const ItemHash *itens, size_t n) {
+    if (n == 0) {
+        return NULL;
+    }
+    int altura = 0;
+    while (capacidadeSubarvore(altura) < n) {
+        altura++;
+    }
+    return montarSubarvore(arena, itens, n, altura);
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE ASSOCIAÇÃO (Tabela Hash) --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Inicializa uma tabela hash vazia com a capacidade informada.
+ * @param tabela A tabela a ser inicializada.
+ * @param capacidade Número de slots (potência de 2, múltiplo do grupo).
+ */
+static void criarTabelaHash(TabelaHash *tabela, size_t capacidade) {
+    tabela->controle = (int8_t*)malloc(capacidade);
+    tabela->itens = (ItemHash*)malloc(capacidade * sizeof(ItemHash));
+    if (tabela->controle == NULL || tabela->itens == NULL) {
+        perror("Erro ao alocar memoria para TabelaHash");
+        exit(EXIT_FAILURE);
+    }
+    METRICA(metricaSomar(&metricas.tabelasHash, 1);
+            metricaSomar(&metricas.bytesHash, capacidade * (1 + sizeof(ItemHash)));)
+    memset(tabela->controle, CTRL_VAZIO, capacidade);
+    tabela->capacidade = capacidade;
+    tabela->ocupados = 0;
+}
+
+/**
+ * @brief Inicializa uma tabela hash de associações pista/suspeito.
+ */
+void inicializarHash(TabelaHash *tabela) {
+    criarTabelaHash(tabela, HASH_CAPACIDADE_INICIAL);
+}
+
+#ifdef DQ_METRICAS
+static void registrarSondagem(uint64_t grupos, uint64_t comparacoes) {
+    metricaSomar(&metricas.hashSondagens, 1);
+    metricaSomar(&metricas.hashGrupos, grupos);
+    metricaMaximo(&metricas.hashMaxGrupos, grupos);
+    metricaSomar(&metricas.hashComparacoes, comparacoes);
+}
+#endif
+
+/**
+ * @brief Localiza o slot de uma pista ou o primeiro slot livre da sequência de sondagem.
+ * A sondagem percorre grupos inteiros em ordem triangular (1, 2, 3...), o que
+ * visita todos os grupos quando o número de grupos é potência de 2.
+ * @param tabela A tabela consultada.
+ * @param pista O id da chave procurada.
+ * @param hash O hash completo da chave (pré-calculado na tabela de textos).
+ * @param encontrado Recebe 1 se a chave já está na tabela, 0 caso contrário.
+ * @return O índice do slot da chave ou do slot livre onde ela deve entrar.
+ */
+static size_t sondarHash(const TabelaHash *tabela, IdTexto pista, uint64_t hash, int *encontrado) {
+    size_t mascaraGrupos = tabela->capacidade / HASH_LARGURA_GRUPO - 1;
+    size_t grupo = (size_t)(hash >> 7) & mascaraGrupos;
+    int8_t tag = (int8_t)(hash & 0x7F);
+    METRICA(uint64_t comparacoes = 0;)
+
+    for (size_t passo = 1; ; passo++) {
+        size_t base = grupo * HASH_LARGURA_GRUPO;
+        uint32_t candidatos = grupoCorresponder(tabela->controle + base, tag);
+        while (candidatos != 0) {
+            size_t slot = base + (size_t)__builtin_ctz(candidatos);
+            METRICA(comparacoes++;)
+            if (tabela->itens[slot].pista == pista) {
+                METRICA(registrarSondagem(passo, comparacoes);)
+                *encontrado = 1;
+                return slot;
+            }
+            candidatos &= candidatos - 1;
+        }
+        uint32_t vazios = grupoCorresponder(tabela->controle + base, CTRL_VAZIO);
+        if (vazios != 0) {
+            METRICA(registrarSondagem(passo, comparacoes);)
+            *encontrado = 0;
+            return base + (size_t)__builtin_ctz(vazios);
+        }
+        grupo = (grupo + passo) & mascaraGrupos;
+    }
+}
+
+/**
+ * @brief Dobra a capacidade da tabela e reinsere os itens (sem recalcular hashes).
+ * @param tabela A tabela a ser expandida.
+ */
+static void redimensionarHash(TabelaHash *tabela) {
+    METRICA(metricaSomar(&metricas.hashRedimensionamentos, 1);)
+    TabelaHash nova;
+    criarTabelaHash(&nova, tabela->capacidade * 2);
+
+    for (size_t i = 0; i < tabela->capacidade; i++) {
+        if (tabela->controle[i] == CTRL_VAZIO) {
+            continue;
+        }
+        const ItemHash *item = &tabela->itens[i];
+        uint64_t hash = tabelaTextos.hashes[item->pista];
+        int encontrado;
+        size_t slot = sondarHash(&nova, item->pista, hash, &encontrado);
+        nova.controle[slot] = (int8_t)(hash & 0x7F);
+        nova.itens[slot] = *item;
+        nova.ocupados++;
+    }
+
+    free(tabela->controle);
+    free(tabela->itens);
+    *tabela = nova;
+}
+
+/**
+ * @brief Insere a associação pista/suspeito na tabela hash.
+ * Se a pista já existir, a associação mais recente substitui a anterior.
+ * @param tabela A tabela da sessão.
+ * @param pista O id da pista (chave).
+ * @param suspeito O id do suspeito (valor).
+ * @return O suspeito associado antes, ou TEXTO_INEXISTENTE se a pista é nova.
+ */
+IdTexto inserirNaHash(TabelaHash *tabela, IdTexto pista, IdTexto suspeito) {
+    if (tabela->capacidade == 0) {
+        inicializarHash(tabela);
+    }
+    if ((tabela->ocupados + 1) * HASH_CARGA_DEN > tabela->capacidade * HASH_CARGA_NUM) {
+        redimensionarHash(tabela);
+    }
+
+    uint64_t hash = tabelaTextos.hashes[pista];
+    int encontrado;
+    size_t slot = sondarHash(tabela, pista, hash, &encontrado);
+    ItemHash *item = &tabela->itens[slot];
+
+    IdTexto anterior = encontrado ? item->suspeito : TEXTO_INEXISTENTE;
+    if (!encontrado) {
+        item->pista = pista;
+        tabela->controle[slot] = (int8_t)(hash & 0x7F);
+        tabela->ocupados++;
+    }
+    item->suspeito = suspeito;
+    return anterior;
+}
+
+/**
+ * @brief Consulta o suspeito correspondente a uma pista.
+ * @param tabela A tabela da sessão.
+ * @param pista O id da pista (chave).
+ * @return O id do suspeito ou TEXTO_INEXISTENTE se a pista não estiver na hash.
+ */
+IdTexto encontrarSuspeito(const TabelaHash *tabela, IdTexto pista) {
+    if (tabela->capacidade == 0) {
+        return TEXTO_INEXISTENTE;
+    }
+    int encontrado;
+    size_t slot = sondarHash(tabela, pista, tabelaTextos.hashes[pista], &encontrado);
+    return encontrado ? tabela->itens[slot].suspeito : TEXTO_INEXISTENTE;
+}
+
+/**
+ * @brief Esvazia a tabela hash mantendo a capacidade já alocada.
+ */
+void limparHash(TabelaHash *tabela) {
+    if (tabela->capacidade > 0) {
+        memset(tabela->controle, CTRL_VAZIO, tabela->capacidade);
+    }
+    tabela->ocupados = 0;
+}
+
+/**
+ * @brief Prepara o índice reverso suspeito -> pistas, vazio.
+ * @param indice O índice a ser criado.
+ * @param numSuspeitos Quantas listas (suspeitos do motor mais o "Desconhecido").
+ */
+void criarEvidencias(IndiceEvidencias *indice, uint32_t numSuspeitos) {
+    indice->listas = (ListaEvidencias*)calloc(numSuspeitos, sizeof(ListaEvidencias));
+    if (indice->listas == NULL) {
+        perror("Erro ao alocar memoria para as evidencias");
+        exit(EXIT_FAILURE);
+    }
+    indice->numSuspeitos = numSuspeitos;
+}
+
+/**
+ * @brief Acrescenta uma pista à lista de um suspeito. Deve ser chamada na
+ * primeira vez que a pista é associada a esse suspeito (em qualquer linha da
+ * investigação), o que a tabela 'indexadas' da sessão registra.
+ * @param indice O índice da sessão.
+ * @param suspeito O índice do suspeito no motor de regras.
+ * @param pista O id da pista.
+ */
+void anotarEvidencia(IndiceEvidencias *indice, uint32_t suspeito, IdTexto pista) {
+    ListaEvidencias *lista = &indice->listas[suspeito];
+    if (lista->tamanho == lista->capacidade) {
+        lista->capacidade = lista->capacidade ? lista->capacidade * 2 : 8;
+        lista->pistas = (IdTexto*)realloc(lista->pistas, lista->capacidade * sizeof(IdTexto));
+        if (lista->pistas == NULL) {
+            perror("Erro ao alocar memoria para as evidencias");
+            exit(EXIT_FAILURE);
+        }
+    }
+    lista->pistas[lista->tamanho++] = pista;
+}
+
+/**
+ * @brief Copia as pistas que hoje apontam para um suspeito, em O(pistas dele * log n).
+ * A lista nunca encolhe: uma pista reassociada a outro suspeito, ou fora da
+ * linha atual (desfeita, ou coletada em outra linha), continua lá e é
+ * descartada aqui, conferindo a versão atual das pistas.
+ * @param raiz A versão atual das pistas coletadas (pista -> suspeito).
+ * @param indice O índice reverso da sessão.
+ * @param suspeito O índice do suspeito no motor de regras.
+ * @param idSuspeito O id do nome do mesmo suspeito (o valor guardado na hash).
+ * @param resultado Recebe um array com as pistas (liberar com free), ou NULL.
+ * @return Quantas pistas apontam para o suspeito.
+ */
+uint32_t evidenciasContra(const PistaColetada *raiz, const IndiceEvidencias *indice, uint32_t suspeito,
+                          IdTexto idSuspeito, IdTexto **resultado) {
+    const ListaEvidencias *lista = &indice->listas[suspeito];
+    *resultado = NULL;
+    if (lista->tamanho == 0) {
+        return 0;
+    }
+    *resultado = (IdTexto*)malloc(lista->tamanho * sizeof(IdTexto));
+    if (*resultado == NULL) {
+        perror("Erro ao alocar memoria para as evidencias");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < lista->tamanho; i++) {
+        if (suspeitoDaPista(raiz, lista->pistas[i]) == idSuspeito) {
+            (*resultado)[n++] = lista->pistas[i];
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Esvazia todas as listas mantendo a memória já alocada.
+ */
+void limparEvidencias(IndiceEvidencias *indice) {
+    for (uint32_t s = 0; s < indice->numSuspeitos; s++) {
+        indice->listas[s].tamanho = 0;
+    }
+}
+
+/**
+ * @brief Libera a memória do índice reverso.
+ */
+void liberarEvidencias(IndiceEvidencias *indice) {
+    for (uint32_t s = 0; s < indice->numSuspeitos; s++) {
+        free(indice->listas[s].pistas);
+    }
+    free(indice->listas);
+    indice->listas = NULL;
+    indice->numSuspeitos = 0;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE REGRAS (Aho-Corasick) --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Cadastra uma regra de atribuição (só vale após compilarRegras()).
+ * @param motor O motor de regras.
+ * @param suspeito Nome do suspeito apontado.
+ * @param palavra Palavra-chave procurada na pista (não vazia).
+ * @param prioridade Prioridade da regra (maior vence).
+ * @param peso Peso somado ao suspeito em caso de empate de prioridade.
+ */
+void adicionarRegra(MotorRegras *motor, const char *suspeito, const char *palavra, int prioridade, int peso) {
+    IdTexto idSuspeito = internarTexto(suspeito);
+    uint32_t indice = 0;
+    while (indice < motor->numSuspeitos && motor->suspeitos[indice] != idSuspeito) {
+        indice++;
+    }
+    if (indice == motor->numSuspeitos) {
+        if (motor->numSuspeitos == motor->capacidadeSuspeitos) {
+            motor->capacidadeSuspeitos = motor->capacidadeSuspeitos ? motor->capacidadeSuspeitos * 2 : 8;
+            motor->suspeitos = (IdTexto*)realloc(motor->suspeitos, motor->capacidadeSuspeitos * sizeof(IdTexto));
+            if (motor->suspeitos == NULL) {
+                perror("Erro ao alocar memoria para MotorRegras");
+                exit(EXIT_FAILURE);
+            }
+        }
+        motor->suspeitos[motor->numSuspeitos++] = idSuspeito;
+    }
+
+    if (motor->numRegras == motor->capacidadeRegras) {
+        motor->capacidadeRegras = motor->capacidadeRegras ? motor->capacidadeRegras * 2 : 16;
+        motor->regras = (Regra*)realloc(motor->regras, motor->capacidadeRegras * sizeof(Regra));
+        if (motor->regras == NULL) {
+            perror("Erro ao alocar memoria para MotorRegras");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Regra *regra = &motor->regras[motor->numRegras++];
+    regra->palavra = internarTexto(palavra);
+    regra->suspeito = indice;
+    regra->prioridade = prioridade;
+    regra->peso = peso;
+    regra->proxima = -1;
+}
+
+/**
+ * @brief Cadastra as regras originais do jogo (usadas quando não há arquivo de regras).
+ */
+void carregarRegrasPadrao(MotorRegras *motor) {
+    adicionarRegra(motor, "Alfredo", "cigarro", 3, 1);
+    adicionarRegra(motor, "Alfredo", "vinho", 3, 1);
+    adicionarRegra(motor, "Berta", "cabelo loiro", 2, 1);
+    adicionarRegra(motor, "Berta", "carta", 2, 1);
+    adicionarRegra(motor, "Carlos", "faca", 1, 1);
+    adicionarRegra(motor, "Carlos", "sapato sujo", 1, 1);
+}
+
+/**
+ * @brief Lê regras de um arquivo de texto, uma por linha:
+ * "suspeito | palavra-chave | prioridade | peso" (prioridade e peso valem 1 se omitidos).
+ * Linhas vazias e iniciadas por '#' são ignoradas.
+ * @return 1 em caso de sucesso, 0 em caso de erro.
+ */
+int carregarRegras(MotorRegras *motor, const char *caminho) {
+    FILE *arquivo = fopen(caminho, "r");
+    if (arquivo == NULL) {
+        perror("Erro ao abrir arquivo de regras");
+        return 0;
+    }
+
+    char linha[MAX_LINHA_MAPA];
+    int numeroLinha = 0;
+    int ok = 1;
+    while (ok && fgets(linha, sizeof(linha), arquivo) != NULL) {
+        numeroLinha++;
+        linha[strcspn(linha, "\r\n")] = '\0';
+        char *conteudo = aparar(linha);
+        if (conteudo[0] == '\0' || conteudo[0] == '#') {
+            continue;
+        }
+        char *campos[MAX_CAMPOS_LINHA];
+        dividirCampos(conteudo, campos);
+        int prioridade = campos[2][0] != '\0' ? atoi(campos[2]) : 1;
+        int peso = campos[3][0] != '\0' ? atoi(campos[3]) : 1;
+        if (campos[0][0] == '\0' || campos[1][0] == '\0') {
+            fprintf(stderr, "%s:%d: regra precisa de suspeito e palavra-chave\n", caminho, numeroLinha);
+            ok = 0;
+        } else {
+            adicionarRegra(motor, campos[0], campos[1], prioridade, peso);
+        }
+    }
+    fclose(arquivo);
+    if (ok && motor->numRegras == 0) {
+        fprintf(stderr, "%s: nenhuma regra definida\n", caminho);
+        ok = 0;
+    }
+    return ok;
+}
+
+/**
+ * @brief Garante espaço para mais um estado no autômato (linha zerada).
+ * @return O índice do novo estado.
+ */
+static uint32_t novoEstado(MotorRegras *motor, uint32_t *capacidade) {
+    if (motor->numEstados == *capacidade) {
+        *capacidade = *capacidade ? *capacidade * 2 : 64;
+        motor->transicoes = (uint32_t*)realloc(motor->transicoes, (size_t)*capacidade * motor->numClasses * sizeof(uint32_t));
+        motor->regraDoEstado = (int32_t*)realloc(motor->regraDoEstado, *capacidade * sizeof(int32_t));
+        if (motor->transicoes == NULL || motor->regraDoEstado == NULL) {
+            perror("Erro ao alocar memoria para MotorRegras");
+            exit(EXIT_FAILURE);
+        }
+    }
+    uint32_t estado = motor->numEstados++;
+    memset(motor->transicoes + (size_t)estado * motor->numClasses, 0, motor->numClasses * sizeof(uint32_t));
+    motor->regraDoEstado[estado] = -1;
+    return estado;
+}
+
+/**
+ * @brief Constrói o autômato de Aho-Corasick a partir das regras cadastradas.
+ * Monta a trie das palavras-chave e, em largura, resolve as falhas direto
+ * nas transições, de modo que a varredura nunca volta atrás.
+ */
+void compilarRegras(MotorRegras *motor) {
+    motor->desconhecido = internarTexto("Desconhecido");
+
+    // Alfabeto comprimido: só bytes presentes em alguma palavra ganham classe própria
+    memset(motor->classeDoByte, 0, sizeof(motor->classeDoByte));
+    motor->numClasses = 1;
+    for (uint32_t r = 0; r < motor->numRegras; r++) {
+        for (const unsigned char *c = (const unsigned char*)textoDe(motor->regras[r].palavra); *c; c++) {
+            if (motor->classeDoByte[*c] == 0) {
+                motor->classeDoByte[*c] = (uint8_t)motor->numClasses++;
+            }
+        }
+    }
+
+    // Trie (o estado 0 é a raiz; transição 0 = "sem filho" durante a montagem)
+    uint32_t capacidade = 0;
+    motor->numEstados = 0;
+    novoEstado(motor, &capacidade);
+    for (uint32_t r = 0; r < motor->numRegras; r++) {
+        uint32_t estado = 0;
+        for (const unsigned char *c = (const unsigned char*)textoDe(motor->regras[r].palavra); *c; c++) {
+            size_t posicao = (size_t)estado * motor->numClasses + motor->classeDoByte[*c];
+            if (motor->transicoes[posicao] == 0) {
+                uint32_t filho = novoEstado(motor, &capacidade);
+                motor->transicoes[posicao] = filho;
+            }
+            estado = motor->transicoes[posicao];
+        }
+        motor->regras[r].proxima = motor->regraDoEstado[estado];
+        motor->regraDoEstado[estado] = (int32_t)r;
+    }
+
+    // Falhas em largura: cada linha vira uma transição completa do autômato
+    uint32_t *falha = (uint32_t*)malloc(motor->numEstados * sizeof(uint32_t));
+    uint32_t *fila = (uint32_t*)malloc(motor->numEstados * sizeof(uint32_t));
+    motor->saidaSufixo = (uint32_t*)realloc(motor->saidaSufixo, motor->numEstados * sizeof(uint32_t));
+    if (falha == NULL || fila == NULL || motor->saidaSufixo == NULL) {
+        perror("Erro ao alocar memoria para MotorRegras");
+        exit(EXIT_FAILURE);
+    }
+    size_t inicio = 0, fim = 0;
+    falha[0] = 0;
+    motor->saidaSufixo[0] = SEM_ESTADO;
+    for (uint32_t c = 0; c < motor->numClasses; c++) {
+        uint32_t filho = motor->transicoes[c];
+        if (filho != 0) {
+            falha[filho] = 0;
+            motor->saidaSufixo[filho] = SEM_ESTADO;
+            fila[fim++] = filho;
+        }
+    }
+    while (inicio < fim) {
+        uint32_t estado = fila[inicio++];
+        uint32_t *linha = motor->transicoes + (size_t)estado * motor->numClasses;
+        const uint32_t *linhaFalha = motor->transicoes + (size_t)falha[estado] * motor->numClasses;
+        for (uint32_t c = 0; c < motor->numClasses; c++) {
+            uint32_t filho = linha[c];
+            if (filho == 0) {
+                linha[c] = linhaFalha[c];
+                continue;
+            }
+            uint32_t f = linhaFalha[c];
+            falha[filho] = f;
+            motor->saidaSufixo[filho] = motor->regraDoEstado[f] >= 0 ? f : motor->saidaSufixo[f];
+            fila[fim++] = filho;
+        }
+    }
+    free(falha);
+    free(fila);
+}
+
+/**
+ * @brief Prepara os acumuladores de pontuação para os suspeitos do motor.
+ */
+void criarPlacar(const MotorRegras *motor, PlacarSuspeitos *placar) {
+    size_t n = motor->numSuspeitos ? motor->numSuspeitos : 1;
+    placar->prioridade = (int*)malloc(n * sizeof(int));
+    placar->peso = (int*)malloc(n * sizeof(int));
+    placar->tocados = (uint32_t*)malloc(n * sizeof(uint32_t));
+    if (placar->prioridade == NULL || placar->peso == NULL || placar->tocados == NULL) {
+        perror("Erro ao alocar memoria para PlacarSuspeitos");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++) {
+        placar->prioridade[i] = INT_MIN;
+        placar->peso[i] = 0;
+    }
+    placar->numTocados = 0;
+}
+
+/**
+ * @brief Libera os acumuladores de pontuação.
+ */
+void liberarPlacar(PlacarSuspeitos *placar) {
+    free(placar->prioridade);
+    free(placar->peso);
+    free(placar->tocados);
+    memset(placar, 0, sizeof(*placar));
+}
+
+/**
+ * @brief Índice de um suspeito no motor a partir do nome internado.
+ * @return O índice, numSuspeitos para "Desconhecido" ou SEM_SUSPEITO se não for suspeito.
+ */
+uint32_t indiceDoSuspeito(const MotorRegras *motor, IdTexto suspeito) {
+    for (uint32_t i = 0; i < motor->numSuspeitos; i++) {
+        if (motor->suspeitos[i] == suspeito) {
+            return i;
+        }
+    }
+    return suspeito == motor->desconhecido ? motor->numSuspeitos : SEM_SUSPEITO;
+}
+
+/**
+ * @brief Decide a qual suspeito uma pista aponta, em uma única passada pelo texto.
+ * @param motor O motor com as regras compiladas.
+ * @param pista O texto da pista.
+ * @param placar Acumuladores de trabalho (devolvidos zerados).
+ * @return O índice do suspeito em motor->suspeitos, ou SEM_SUSPEITO.
+ */
+uint32_t atribuirSuspeito(const MotorRegras *motor, const char *pista, PlacarSuspeitos *placar) {
+    uint32_t estado = 0;
+    for (const unsigned char *c = (const unsigned char*)pista; *c; c++) {
+        estado = motor->transicoes[(size_t)estado * motor->numClasses + motor->classeDoByte[*c]];
+        uint32_t saida = motor->regraDoEstado[estado] >= 0 ? estado : motor->saidaSufixo[estado];
+        for (; saida != SEM_ESTADO; saida = motor->saidaSufixo[saida]) {
+            for (int32_t r = motor->regraDoEstado[saida]; r >= 0; r = motor->regras[r].proxima) {
+                const Regra *regra = &motor->regras[r];
+                if (placar->prioridade[regra->suspeito] == INT_MIN) {
+                    placar->tocados[placar->numTocados++] = regra->suspeito;
+                }
+                if (regra->prioridade > placar->prioridade[regra->suspeito]) {
+                    placar->prioridade[regra->suspeito] = regra->prioridade;
+                }
+                placar->peso[regra->suspeito] += regra->peso;
+            }
+        }
+    }
+
+    uint32_t vencedor = SEM_SUSPEITO;
+    for (uint32_t i = 0; i < placar->numTocados; i++) {
+        uint32_t s = placar->tocados[i];
+        if (vencedor == SEM_SUSPEITO
+            || placar->prioridade[s] > placar->prioridade[vencedor]
+            || (placar->prioridade[s] == placar->prioridade[vencedor]
+                && (placar->peso[s] > placar->peso[vencedor]
+                    || (placar->peso[s] == placar->peso[vencedor] && s < vencedor)))) {
+            vencedor = s;
+        }
+    }
+    for (uint32_t i = 0; i < placar->numTocados; i++) {
+        placar->prioridade[placar->tocados[i]] = INT_MIN;
+        placar->peso[placar->tocados[i]] = 0;
+    }
+    placar->numTocados = 0;
+    return vencedor;
+}
+
+/**
+ * @brief Libera o motor de regras.
+ */
+void liberarRegras(MotorRegras *motor) {
+    free(motor->regras);
+    free(motor->suspeitos);
+    free(motor->transicoes);
+    free(motor->regraDoEstado);
+    free(motor->saidaSufixo);
+    memset(motor, 0, sizeof(*motor));
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE RANKING (Heap indexado) --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Ordem do heap: mais pistas primeiro; no empate, quem foi cadastrado antes.
+ */
+static int rankingAntes(const RankingSuspeitos *ranking, uint32_t a, uint32_t b) {
+    if (ranking->contagem[a] != ranking->contagem[b]) {
+        return ranking->contagem[a] > ranking->contagem[b];
+    }
+    return a < b;
+}
+
+static void rankingTrocar(RankingSuspeitos *ranking, uint32_t i, uint32_t j) {
+    uint32_t a = ranking->heap[i], b = ranking->heap[j];
+    ranking->heap[i] = b;
+    ranking->heap[j] = a;
+    ranking->posicao[b] = i;
+    ranking->posicao[a] = j;
+}
+
+static void rankingSubir(RankingSuspeitos *ranking, uint32_t i) {
+    while (i > 0) {
+        uint32_t pai = (i - 1) / 2;
+        if (!rankingAntes(ranking, ranking->heap[i], ranking->heap[pai])) {
+            break;
+        }
+        rankingTrocar(ranking, i, pai);
+        i = pai;
+    }
+}
+
+static void rankingDescer(RankingSuspeitos *ranking, uint32_t i) {
+    while (1) {
+        uint32_t maior = i;
+        uint32_t esquerda = 2 * i + 1, direita = 2 * i + 2;
+        if (esquerda < ranking->tamanho && rankingAntes(ranking, ranking->heap[esquerda], ranking->heap[maior])) {
+            maior = esquerda;
+        }
+        if (direita < ranking->tamanho && rankingAntes(ranking, ranking->heap[direita], ranking->heap[maior])) {
+            maior = direita;
+        }
+        if (maior == i) {
+            return;
+        }
+        rankingTrocar(ranking, i, maior);
+        i = maior;
+    }
+}
+
+/**
+ * @brief Zera as contagens. Com todas iguais, a ordem de cadastro já é um heap válido.
+ */
+void zerarRanking(RankingSuspeitos *ranking) {
+    for (uint32_t i = 0; i < ranking->tamanho; i++) {
+        ranking->contagem[i] = 0;
+        ranking->heap[i] = i;
+        ranking->posicao[i] = i;
+    }
+}
+
+/**
+ * @brief Prepara o ranking para os suspeitos do motor (mais o "Desconhecido").
+ */
+void criarRanking(const MotorRegras *motor, RankingSuspeitos *ranking) {
+    ranking->tamanho = motor->numSuspeitos + 1;
+    ranking->contagem = (uint32_t*)malloc(ranking->tamanho * sizeof(uint32_t));
+    ranking->heap = (uint32_t*)malloc(ranking->tamanho * sizeof(uint32_t));
+    ranking->posicao = (uint32_t*)malloc(ranking->tamanho * sizeof(uint32_t));
+    if (ranking->contagem == NULL || ranking->heap == NULL || ranking->posicao == NULL) {
+        perror("Erro ao alocar memoria para RankingSuspeitos");
+        exit(EXIT_FAILURE);
+    }
+    zerarRanking(ranking);
+}
+
+/**
+ * @brief Soma (ou subtrai, com delta negativo) pistas de um suspeito em O(log n).
+ */
+void rankingAjustar(RankingSuspeitos *ranking, uint32_t suspeito, int delta) {
+    ranking->contagem[suspeito] += (uint32_t)delta;
+    if (delta > 0) {
+        rankingSubir(ranking, ranking->posicao[suspeito]);
+    } else {
+        rankingDescer(ranking, ranking->posicao[suspeito]);
+    }
+}
+
+/**
+ * @brief Os k suspeitos com mais pistas, em ordem, sem alterar o heap.
+ * Percorre o heap a partir da raiz guardando a fronteira de candidatos,
+ * então o custo depende só de k.
+ * @param saida Recebe até k índices de suspeitos.
+ * @param k Quantos suspeitos (no máximo MAX_RANKING).
+ * @return Quantos índices foram escritos em saida.
+ */
+uint32_t rankingTopo(const RankingSuspeitos *ranking, uint32_t *saida, uint32_t k) {
+    uint32_t fronteira[MAX_RANKING + 1]; // Posições do heap ainda não emitidas
+    uint32_t numFronteira = 0, n = 0;
+    if (k > MAX_RANKING) {
+        k = MAX_RANKING;
+    }
+    if (ranking->tamanho > 0) {
+        fronteira[numFronteira++] = 0;
+    }
+    while (n < k && numFronteira > 0) {
+        uint32_t melhor = 0;
+        for (uint32_t i = 1; i < numFronteira; i++) {
+            if (rankingAntes(ranking, ranking->heap[fronteira[i]], ranking->heap[fronteira[melhor]])) {
+                melhor = i;
+            }
+        }
+        uint32_t posicao = fronteira[melhor];
+        saida[n++] = ranking->heap[posicao];
+        fronteira[melhor] = fronteira[--numFronteira];
+        // Cada emissão tira um e põe até dois: a fronteira nunca passa de k + 1
+        for (uint32_t filho = 2 * posicao + 1; filho <= 2 * posicao + 2; filho++) {
+            if (filho < ranking->tamanho) {
+                fronteira[numFronteira++] = filho;
+            }
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Libera o ranking.
+ */
+void liberarRanking(RankingSuspeitos *ranking) {
+    free(ranking->contagem);
+    free(ranking->heap);
+    free(ranking->posicao);
+    memset(ranking, 0, sizeof(*ranking));
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE BUSCA (Índice de trechos) --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Empacota os 'n' primeiros bytes de 'texto' (em minúsculas) e o comprimento.
+ * Bytes fora do ASCII (acentos em UTF-8) entram como estão.
+ */
+static uint32_t chaveTrecho(const char *texto, int n) {
+    uint32_t chave = (uint32_t)n << 24;
+    for (int i = 0; i < n; i++) {
+        chave |= (uint32_t)(unsigned char)tolower((unsigned char)texto[i]) << (8 * i);
+    }
+    return chave;
+}
+
+/**
+ * @brief Slot da chave ou o slot livre onde ela entraria.
+ */
+static size_t sondarTrechos(const IndiceTrechos *indice, uint32_t chave) {
+    size_t mascara = indice->capacidade - 1;
+    size_t i = (size_t)((chave * 2654435761u) >> 8) & mascara;
+    while (indice->slots[i].chave != 0 && indice->slots[i].chave != chave) {
+        i = (i + 1) & mascara;
+    }
+    return i;
+}
+
+/**
+ * @brief Dobra a capacidade do índice, movendo as listas (sem copiar as pistas).
+ */
+static void crescerTrechos(IndiceTrechos *indice) {
+    IndiceTrechos novo = {NULL, indice->capacidade ? indice->capacidade * 2 : TRECHOS_CAPACIDADE_INICIAL, 0};
+    novo.slots = (ListaTrecho*)calloc(novo.capacidade, sizeof(ListaTrecho));
+    if (novo.slots == NULL) {
+        perror("Erro ao alocar memoria para o indice de trechos");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < indice->capacidade; i++) {
+        if (indice->slots[i].chave != 0) {
+            novo.slots[sondarTrechos(&novo, indice->slots[i].chave)] = indice->slots[i];
+            novo.ocupados++;
+        }
+    }
+    free(indice->slots);
+    *indice = novo;
+}
+
+/**
+ * @brief Acrescenta uma pista à lista de um trecho (uma vez só por pista).
+ */
+static void anotarTrecho(IndiceTrechos *indice, uint32_t chave, IdTexto pista) {
+    if ((indice->ocupados + 1) * HASH_CARGA_DEN > indice->capacidade * HASH_CARGA_NUM) {
+        crescerTrechos(indice);
+    }
+    ListaTrecho *lista = &indice->slots[sondarTrechos(indice, chave)];
+    if (lista->chave == 0) {
+        lista->chave = chave;
+        indice->ocupados++;
+    }
+    // As pistas são indexadas uma de cada vez, então a repetição só pode ser a última
+    if (lista->tamanho > 0 && lista->pistas[lista->tamanho - 1] == pista) {
+        return;
+    }
+    if (lista->tamanho == lista->capacidade) {
+        lista->capacidade = lista->capacidade ? lista->capacidade * 2 : 4;
+        lista->pistas = (IdTexto*)realloc(lista->pistas, lista->capacidade * sizeof(IdTexto));
+        if (lista->pistas == NULL) {
+            perror("Erro ao alocar memoria para o indice de trechos");
+            exit(EXIT_FAILURE);
+        }
+    }
+    lista->pistas[lista->tamanho++] = pista;
+}
+
+/**
+ * @brief Indexa todos os trechos de 1 a TRECHO_MAX bytes de uma pista recém-coletada.
+ */
+void indexarPista(IndiceTrechos *indice, IdTexto pista) {
+    const char *texto = textoDe(pista);
+    size_t comprimento = strlen(texto);
+    for (size_t i = 0; i < comprimento; i++) {
+        for (int n = 1; n <= TRECHO_MAX && i + n <= comprimento; n++) {
+            anotarTrecho(indice, chaveTrecho(texto + i, n), pista);
+        }
+    }
+}
+
+/**
+ * @brief A lista de pistas de um trecho, ou NULL se nenhuma pista o contém.
+ */
+static const ListaTrecho* listaDoTrecho(const IndiceTrechos *indice, uint32_t chave) {
+    if (indice->capacidade == 0) {
+        return NULL;
+    }
+    const ListaTrecho *lista = &indice->slots[sondarTrechos(indice, chave)];
+    return lista->chave == 0 || lista->tamanho == 0 ? NULL : lista;
+}
+
+/**
+ * @brief Verifica se 'texto' contém 'termo', sem diferenciar maiúsculas (ASCII).
+ */
+static int contemTrecho(const char *texto, const char *termo) {
+    for (; *texto != '\0'; texto++) {
+        size_t i = 0;
+        while (termo[i] != '\0' && tolower((unsigned char)texto[i]) == tolower((unsigned char)termo[i])) {
+            i++;
+        }
+        if (termo[i] == '\0') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int compararTextos(const void *a, const void *b) {
+    return strcmp(textoDe(*(const IdTexto*)a), textoDe(*(const IdTexto*)b));
+}
+
+/**
+ * @brief Coloca em '*resultado' (alocado aqui) as pistas que contêm 'termo', em ordem alfabética.
+ * O custo é proporcional à menor lista de trigramas do termo, não ao total de pistas.
+ * O índice pode ter pistas de fora da linha atual da investigação; só as que
+ * estão em 'raiz' entram no resultado.
+ * @return Quantas pistas foram encontradas.
+ */
+size_t buscarTrecho(const IndiceTrechos *indice, const PistaColetada *raiz, const char *termo, IdTexto **resultado) {
+    *resultado = NULL;
+    size_t comprimento = strlen(termo);
+    if (comprimento == 0) {
+        return 0;
+    }
+
+    // Termo curto: a própria lista é a resposta. Termo longo: a menor lista de trigramas.
+    const ListaTrecho *menor = NULL;
+    if (comprimento <= TRECHO_MAX) {
+        menor = listaDoTrecho(indice, chaveTrecho(termo, (int)comprimento));
+    } else {
+        for (size_t i = 0; i + TRECHO_MAX <= comprimento; i++) {
+            const ListaTrecho *lista = listaDoTrecho(indice, chaveTrecho(termo + i, TRECHO_MAX));
+            if (lista == NULL) {
+                return 0;
+            }
+            if (menor == NULL || lista->tamanho < menor->tamanho) {
+                menor = lista;
+            }
+        }
+    }
+    if (menor == NULL) {
+        return 0;
+    }
+
+    *resultado = (IdTexto*)malloc(menor->tamanho * sizeof(IdTexto));
+    if (*resultado == NULL) {
+        perror("Erro ao alocar memoria para a busca");
+        exit(EXIT_FAILURE);
+    }
+    size_t encontradas = 0;
+    for (uint32_t i = 0; i < menor->tamanho; i++) {
+        if ((comprimento <= TRECHO_MAX || contemTrecho(textoDe(menor->pistas[i]), termo))
+            && suspeitoDaPista(raiz, menor->pistas[i]) != TEXTO_INEXISTENTE) {
+            (*resultado)[encontradas++] = menor->pistas[i];
+        }
+    }
+    qsort(*resultado, encontradas, sizeof(IdTexto), compararTextos);
+    return encontradas;
+}
+
+/**
+ * @brief Esvazia as listas do índice, mantendo a memória para a próxima partida.
+ */
+void limparTrechos(IndiceTrechos *indice) {
+    for (size_t i = 0; i < indice->capacidade; i++) {
+        indice->slots[i].tamanho = 0;
+    }
+}
+
+/**
+ * @brief Libera toda a memória do índice de trechos.
+ */
+void liberarTrechos(IndiceTrechos *indice) {
+    for (size_t i = 0; i < indice->capacidade; i++) {
+        free(indice->slots[i].pistas);
+    }
+    free(indice->slots);
+    indice->slots = NULL;
+    indice->capacidade = 0;
+    indice->ocupados = 0;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE BITSET (Salas visitadas) --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Quantas palavras de 64 bits um bitset plano de n salas ocupa (formato do .dqs).
+ */
+static size_t palavrasBitset(uint32_t n) {
+    return ((size_t)n + 63) / 64;
+}
+
+/**
+ * @brief Níveis internos que a trie precisa para cobrir n salas.
+ */
+static uint32_t alturaBits(uint32_t n) {
+    uint32_t altura = 0;
+    for (uint64_t cobertas = (uint64_t)1 << BITS_FOLHA; cobertas < n; cobertas <<= BITS_RAMO) {
+        altura++;
+    }
+    return altura;
+}
+
+/**
+ * @brief Filho seguido no nível 'nivel' (1 = logo acima das folhas) a caminho da sala i.
+ */
+static uint32_t ramoDaSala(uint32_t i, uint32_t nivel) {
+    return (i >> (BITS_FOLHA + BITS_RAMO * (nivel - 1))) & (RAMOS_BITS - 1);
+}
+
+static int bitLigado(const NoBits *raiz, uint32_t altura, uint32_t i) {
+    for (uint32_t nivel = altura; nivel > 0 && raiz != NULL; nivel--) {
+        raiz = raiz->filhos[ramoDaSala(i, nivel)];
+    }
+    return raiz != NULL && (int)((raiz->palavras[(i >> 6) & (RAMOS_BITS - 1)] >> (i & 63)) & 1);
+}
+
+/**
+ * @brief Nó da trie sem nenhuma sala, com uma referência.
+ */
+static NoBits* criarNoBits(Arena *arena) {
+    NoBits *no = (NoBits*)arenaAlocarNo(arena, NO_BITS);
+    memset(no, 0, sizeof(NoBits));
+    no->referencias = 1;
+    return no;
+}
+
+/**
+ * @brief Garante que um nó do nível 'nivel' seja só da versão atual, como
+ * privatizarNoPistas (um nó novo e vazio se 'no' for NULL).
+ */
+static NoBits* privatizarNoBits(Arena *arena, NoBits *no, uint32_t nivel) {
+    if (no == NULL) {
+        return criarNoBits(arena);
+    }
+    if (no->referencias == 1) {
+        return no;
+    }
+    NoBits *copia = (NoBits*)arenaAlocarNo(arena, NO_BITS);
+    memcpy(copia, no, sizeof(NoBits));
+    copia->referencias = 1;
+    for (uint32_t f = 0; nivel > 0 && f < RAMOS_BITS; f++) {
+        if (no->filhos[f] != NULL) {
+            no->filhos[f]->referencias++;
+        }
+    }
+    no->referencias--;
+    return copia;
+}
+
+/**
+ * @brief Larga uma referência a uma subárvore do nível 'nivel'; os nós que
+ * ficam sem nenhuma voltam à lista livre da arena.
+ */
+static void soltarBits(Arena *arena, NoBits *no, uint32_t nivel) {
+    if (no == NULL || --no->referencias > 0) {
+        return;
+    }
+    for (uint32_t f = 0; nivel > 0 && f < RAMOS_BITS; f++) {
+        soltarBits(arena, no->filhos[f], nivel - 1);
+    }
+    arenaDevolverNo(arena, NO_BITS, no);
+}
+
+/**
+ * @brief Liga o bit da sala i, devolvendo uma nova versão do conjunto (no
+ * máximo altura + 1 nós novos; as outras versões continuam válidas). A
+ * referência do chamador a 'raiz' passa para a raiz devolvida.
+ */
+static NoBits* ligarBit(Arena *arena, NoBits *raiz, uint32_t altura, uint32_t i) {
+    NoBits *nova = privatizarNoBits(arena, raiz, altura);
+    NoBits *no = nova;
+    for (uint32_t nivel = altura; nivel > 0; nivel--) {
+        NoBits **filho = &no->filhos[ramoDaSala(i, nivel)];
+        *filho = privatizarNoBits(arena, *filho, nivel - 1);
+        no = *filho;
+    }
+    no->palavras[(i >> 6) & (RAMOS_BITS - 1)] |= (uint64_t)1 << (i & 63);
+    return nova;
+}
+
+/**
+ * @brief Escreve a subárvore de um nível, que começa na palavra 'inicio', no
+ * bitset plano 'palavras' (já zerado, com 'numPalavras' palavras).
+ */
+static void copiarBits(const NoBits *no, uint32_t nivel, uint64_t *palavras, size_t inicio, size_t numPalavras) {
+    if (no == NULL || inicio >= numPalavras) {
+        return;
+    }
+    if (nivel == 0) {
+        for (size_t k = 0; k < RAMOS_BITS && inicio + k < numPalavras; k++) {
+            palavras[inicio + k] = no->palavras[k];
+        }
+        return;
+    }
+    size_t porFilho = (size_t)1 << (BITS_RAMO * nivel); // Palavras cobertas por cada filho
+    for (size_t f = 0; f < RAMOS_BITS; f++) {
+        copiarBits(no->filhos[f], nivel - 1, palavras, inicio + f * porFilho, numPalavras);
+    }
+}
+
+/**
+ * @brief Monta a subárvore de um nível a partir de um bitset plano, sem
+ * criar nós para as faixas sem nenhum bit ligado.
+ */
+static NoBits* montarBits(Arena *arena, const uint64_t *palavras, size_t inicio, size_t numPalavras, uint32_t nivel) {
+    if (inicio >= numPalavras) {
+        return NULL;
+    }
+    NoBits *no = criarNoBits(arena);
+    int vazio = 1;
+    if (nivel == 0) {
+        for (size_t k = 0; k < RAMOS_BITS && inicio + k < numPalavras; k++) {
+            no->palavras[k] = palavras[inicio + k];
+            vazio = vazio && palavras[inicio + k] == 0;
+        }
+    } else {
+        size_t porFilho = (size_t)1 << (BITS_RAMO * nivel);
+        for (size_t f = 0; f < RAMOS_BITS; f++) {
+            no->filhos[f] = montarBits(arena, palavras, inicio + f * porFilho, numPalavras, nivel - 1);
+            vazio = vazio && no->filhos[f] == NULL;
+        }
+    }
+    if (vazio) {
+        arenaDevolverNo(arena, NO_BITS, no);
+        return NULL;
+    }
+    return no;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE MOMENTOS (Desfazer e marcas) --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Registra o estado atual da investigação: só as raízes das estruturas
+ * persistentes (uma referência a cada) e uma cópia do ranking (O(suspeitos)).
+ * Reaproveita um momento esquecido, se houver.
+ */
+static Momento* capturarMomento(Sessao *sessao) {
+    const RankingSuspeitos *ranking = &sessao->ranking;
+    Momento *momento = sessao->momentosLivres;
+    if (momento != NULL) {
+        sessao->momentosLivres = momento->proximoLivre;
+    } else {
+        momento = (Momento*)arenaAlocar(&sessao->memoria, sizeof(Momento));
+        momento->ranking = (uint32_t*)arenaAlocar(&sessao->memoria, 3 * (size_t)ranking->tamanho * sizeof(uint32_t));
+    }
+    memcpy(momento->ranking, ranking->contagem, ranking->tamanho * sizeof(uint32_t));
+    memcpy(momento->ranking + ranking->tamanho, ranking->heap, ranking->tamanho * sizeof(uint32_t));
+    memcpy(momento->ranking + 2 * ranking->tamanho, ranking->posicao, ranking->tamanho * sizeof(uint32_t));
+    momento->pistas = sessao->raizPistas;
+    momento->visitadas = sessao->visitadas;
+    momento->coletadas = sessao->coletadas;
+    if (momento->pistas != NULL) {
+        momento->pistas->referencias++;
+    }
+    if (momento->visitadas != NULL) {
+        momento->visitadas->referencias++;
+    }
+    if (momento->coletadas != NULL) {
+        momento->coletadas->referencias++;
+    }
+    momento->salaAtual = sessao->salaAtual;
+    momento->totalPistasColetadas = sessao->totalPistasColetadas;
+    momento->proximoLivre = NULL;
+    return momento;
+}
+
+/**
+ * @brief Esquece um momento: larga as referências dele (liberando os nós que
+ * só ele alcançava) e o guarda para a próxima captura.
+ */
+static void liberarMomento(Sessao *sessao, Momento *momento) {
+    soltarPistas(&sessao->memoria, momento->pistas);
+    soltarBits(&sessao->memoria, momento->visitadas, sessao->alturaBits);
+    soltarBits(&sessao->memoria, momento->coletadas, sessao->alturaBits);
+    momento->proximoLivre = sessao->momentosLivres;
+    sessao->momentosLivres = momento;
+}
+
+/**
+ * @brief Volta a sessão a um momento registrado (a pilha de desfazer e as
+ * marcas não mudam aqui).
+ */
+static void restaurarMomento(Sessao *sessao, const Momento *momento) {
+    RankingSuspeitos *ranking = &sessao->ranking;
+    memcpy(ranking->contagem, momento->ranking, ranking->tamanho * sizeof(uint32_t));
+    memcpy(ranking->heap, momento->ranking + ranking->tamanho, ranking->tamanho * sizeof(uint32_t));
+    memcpy(ranking->posicao, momento->ranking + 2 * ranking->tamanho, ranking->tamanho * sizeof(uint32_t));
+    // Segura as raízes do momento antes de largar as atuais (podem ser as mesmas)
+    if (momento->pistas != NULL) {
+        momento->pistas->referencias++;
+    }
+    if (momento->visitadas != NULL) {
+        momento->visitadas->referencias++;
+    }
+    if (momento->coletadas != NULL) {
+        momento->coletadas->referencias++;
+    }
+    soltarPistas(&sessao->memoria, sessao->raizPistas);
+    soltarBits(&sessao->memoria, sessao->visitadas, sessao->alturaBits);
+    soltarBits(&sessao->memoria, sessao->coletadas, sessao->alturaBits);
+    sessao->raizPistas = momento->pistas;
+    sessao->visitadas = momento->visitadas;
+    sessao->coletadas = momento->coletadas;
+    sessao->salaAtual = momento->salaAtual;
+    sessao->totalPistasColetadas = momento->totalPistasColetadas;
+}
+
+/**
+ * @brief Empilha o estado atual antes de um movimento, para 'u' desfazê-lo.
+ * Com a pilha cheia, o momento mais antigo é esquecido.
+ */
+static void guardarMomento(Sessao *sessao) {
+    if (sessao->desfazer == NULL) {
+        sessao->desfazer = (Momento**)malloc(MAX_DESFAZER * sizeof(Momento*));
+        if (sessao->desfazer == NULL) {
+            perror("Erro ao alocar memoria para a pilha de desfazer");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (sessao->numDesfazer == MAX_DESFAZER) {
+        liberarMomento(sessao, sessao->desfazer[sessao->inicioDesfazer]);
+        sessao->inicioDesfazer = (sessao->inicioDesfazer + 1) % MAX_DESFAZER;
+        sessao->numDesfazer--;
+    }
+    sessao->desfazer[(sessao->inicioDesfazer + sessao->numDesfazer) % MAX_DESFAZER] = capturarMomento(sessao);
+    sessao->numDesfazer++;
+}
+
+/**
+ * @brief Desempilha o momento mais recente (NULL se a pilha estiver vazia).
+ */
+static Momento* retirarMomento(Sessao *sessao) {
+    if (sessao->numDesfazer == 0) {
+        return NULL;
+    }
+    sessao->numDesfazer--;
+    return sessao->desfazer[(sessao->inicioDesfazer + sessao->numDesfazer) % MAX_DESFAZER];
+}
+
+/**
+ * @brief Esquece a pilha de desfazer e as marcas sem largar referências:
+ * só depois de reiniciar a arena da sessão, onde os momentos e os nós viviam.
+ */
+static void esquecerMomentos(Sessao *sessao) {
+    sessao->inicioDesfazer = 0;
+    sessao->numDesfazer = 0;
+    sessao->numMarcas = 0;
+    sessao->momentosLivres = NULL;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE INSTANTÂNEO (Salvar e retomar) --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Assinatura da tabela de textos: o hash do último texto internado.
+ */
+static uint64_t assinaturaTextos() {
+    return tabelaTextos.numTextos > 0 ? tabelaTextos.hashes[tabelaTextos.numTextos - 1] : 0;
+}
+
+/**
+ * @brief Serializa a sessão no formato .dqs em um único buffer.
+ * @param sessao A sessão (em qualquer estado).
+ * @param tamanho Recebe o tamanho do buffer.
+ * @return O buffer (liberar com free).
+ */
+uint8_t* serializarSessao(const Sessao *sessao, size_t *tamanho) {
+    // Cada pista distinta da versão atual veio de pelo menos uma coleta
+    ItemHash *pares = (ItemHash*)malloc(((size_t)sessao->totalPistasColetadas + 1) * sizeof(ItemHash));
+    size_t numPalavras = palavrasBitset(sessao->mansao->numSalas);
+    uint64_t *palavras = (uint64_t*)calloc(numPalavras + 1, sizeof(uint64_t));
+    if (pares == NULL || palavras == NULL) {
+        perror("Erro ao alocar memoria para o instantaneo");
+        exit(EXIT_FAILURE);
+    }
+    CabecalhoSessao cabecalho;
+    memset(&cabecalho, 0, sizeof(cabecalho));
+    memcpy(cabecalho.magica, SESSAO_MAGICA, 4);
+    cabecalho.versao = SESSAO_VERSAO;
+    cabecalho.assinaturaTextos = assinaturaTextos();
+    cabecalho.numTextos = tabelaTextos.numTextos;
+    cabecalho.numSalas = sessao->mansao->numSalas;
+    cabecalho.numRanking = sessao->ranking.tamanho;
+    cabecalho.estado = (uint32_t)sessao->estado;
+    cabecalho.salaAtual = sessao->salaAtual;
+    cabecalho.totalPistasColetadas = (uint32_t)sessao->totalPistasColetadas;
+    cabecalho.numPistas = (uint32_t)copiarPistasEmOrdem(sessao->raizPistas, pares);
+    cabecalho.partida = sessao->diario != NULL ? sessao->saida.partida : 0;
+
+    size_t bytesBitset = numPalavras * sizeof(uint64_t);
+    *tamanho = sizeof(cabecalho) + cabecalho.numPistas * sizeof(ItemHash) + 2 * bytesBitset;
+    uint8_t *buffer = (uint8_t*)malloc(*tamanho);
+    if (buffer == NULL) {
+        perror("Erro ao alocar memoria para o instantaneo");
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t *p = buffer;
+    memcpy(p, &cabecalho, sizeof(cabecalho));
+    p += sizeof(cabecalho);
+    memcpy(p, pares, cabecalho.numPistas * sizeof(ItemHash));
+    p += cabecalho.numPistas * sizeof(ItemHash);
+    copiarBits(sessao->visitadas, sessao->alturaBits, palavras, 0, numPalavras);
+    memcpy(p, palavras, bytesBitset);
+    p += bytesBitset;
+    memset(palavras, 0, bytesBitset);
+    copiarBits(sessao->coletadas, sessao->alturaBits, palavras, 0, numPalavras);
+    memcpy(p, palavras, bytesBitset);
+    free(palavras);
+    free(pares);
+    return buffer;
+}
+
+/**
+ * @brief Restaura uma sessão a partir de um buffer .dqs.
+ * A B-tree e as tries de salas são montadas de uma vez, sem inserções, e o
+ * ranking é refeito a partir dos pares. A sessão deve ter sido criada com criarSessao
+ * sobre a mesma mansão e as mesmas regras do instantâneo.
+ * @return 1 em caso de sucesso, 0 se o buffer for inválido ou incompatível.
+ */
+int desserializarSessao(Sessao *sessao, const uint8_t *buffer, size_t tamanho) {
+    CabecalhoSessao cabecalho;
+    if (tamanho < sizeof(cabecalho)) {
+        fprintf(stderr, "Instantaneo invalido: arquivo truncado\n");
+        return 0;
+    }
+    memcpy(&cabecalho, buffer, sizeof(cabecalho));
+    if (memcmp(cabecalho.magica, SESSAO_MAGICA, 4) != 0 || cabecalho.versao != SESSAO_VERSAO) {
+        fprintf(stderr, "Instantaneo invalido: assinatura ou versao desconhecida\n");
+        return 0;
+    }
+    if (cabecalho.numTextos != tabelaTextos.numTextos || cabecalho.assinaturaTextos != assinaturaTextos() ||
+        cabecalho.numSalas != sessao->mansao->numSalas || cabecalho.numRanking != sessao->ranking.tamanho) {
+        fprintf(stderr, "Instantaneo de outra mansao ou de outras regras\n");
+        return 0;
+    }
+    size_t numPalavras = palavrasBitset(cabecalho.numSalas);
+    size_t bytesBitset = numPalavras * sizeof(uint64_t);
+    size_t esperado = sizeof(cabecalho) + (size_t)cabecalho.numPistas * sizeof(ItemHash) + 2 * bytesBitset;
+    if (tamanho != esperado || cabecalho.estado > JOGO_FIM || cabecalho.salaAtual >= cabecalho.numSalas) {
+        fprintf(stderr, "Instantaneo invalido: tamanhos inconsistentes\n");
+        return 0;
+    }
+
+    // Pares: ids válidos, suspeitos das regras (ou o "Desconhecido") e pistas
+    // estritamente crescentes na ordem da B-tree
+    const uint8_t *p = buffer + sizeof(cabecalho);
+    ItemHash *pares = (ItemHash*)malloc(((size_t)cabecalho.numPistas + 1) * sizeof(ItemHash));
+    uint64_t *palavras = (uint64_t*)malloc((numPalavras + 1) * sizeof(uint64_t));
+    if (pares == NULL || palavras == NULL) {
+        perror("Erro ao alocar memoria para o instantaneo");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(pares, p, cabecalho.numPistas * sizeof(ItemHash));
+    p += cabecalho.numPistas * sizeof(ItemHash);
+    for (uint32_t i = 0; i < cabecalho.numPistas; i++) {
+        if (pares[i].pista >= tabelaTextos.numTextos || pares[i].suspeito >= tabelaTextos.numTextos ||
+            indiceDoSuspeito(sessao->motor, pares[i].suspeito) == SEM_SUSPEITO ||
+            (i > 0 && strcmp(textoDe(pares[i - 1].pista), textoDe(pares[i].pista)) >= 0)) {
+            fprintf(stderr, "Instantaneo invalido: pistas fora de ordem\n");
+            free(palavras);
+            free(pares);
+            return 0;
+        }
+    }
+
+    // Cada coleta liga o bit da sala e cada pista distinta veio de ao menos uma
+    uint64_t coletas = 0;
+    const uint8_t *bitsColetadas = p + bytesBitset;
+    for (size_t w = 0; w < numPalavras; w++) {
+        uint64_t palavra;
+        memcpy(&palavra, bitsColetadas + w * sizeof(uint64_t), sizeof(palavra));
+        coletas += (uint64_t)__builtin_popcountll(palavra);
+    }
+    if (coletas != cabecalho.totalPistasColetadas || cabecalho.numPistas > cabecalho.totalPistasColetadas) {
+        fprintf(stderr, "Instantaneo invalido: total de pistas nao confere com as coletas\n");
+        free(palavras);
+        free(pares);
+        return 0;
+    }
+
+    arenaReiniciar(&sessao->memoria);
+    esquecerMomentos(sessao);
+    memcpy(palavras, p, bytesBitset);
+    p += bytesBitset;
+    sessao->visitadas = montarBits(&sessao->memoria, palavras, 0, numPalavras, sessao->alturaBits);
+    memcpy(palavras, p, bytesBitset);
+    sessao->coletadas = montarBits(&sessao->memoria, palavras, 0, numPalavras, sessao->alturaBits);
+
+    sessao->raizPistas = construirPistas(&sessao->memoria, pares, cabecalho.numPistas);
+    // Os índices não vão no arquivo: são refeitos a partir dos pares (as
+    // listas de evidências ficam em ordem alfabética)
+    limparHash(&sessao->indexadas);
+    limparTrechos(&sessao->trechos);
+    limparEvidencias(&sessao->evidencias);
+    zerarRanking(&sessao->ranking);
+    for (uint32_t i = 0; i < cabecalho.numPistas; i++) {
+        inserirNaHash(&sessao->indexadas, pares[i].pista, pares[i].suspeito);
+        indexarPista(&sessao->trechos, pares[i].pista);
+        uint32_t indice = indiceDoSuspeito(sessao->motor, pares[i].suspeito);
+        anotarEvidencia(&sessao->evidencias, indice, pares[i].pista);
+        rankingAjustar(&sessao->ranking, indice, +1);
+    }
+    sessao->totalPistasColetadas = (int)cabecalho.totalPistasColetadas;
+    sessao->estado = (EstadoJogo)cabecalho.estado;
+    sessao->salaAtual = cabecalho.salaAtual;
+    sessao->vitoria = 0;
+    sessao->saida.partida = cabecalho.partida;
+    free(palavras);
+    free(pares);
+    return 1;
+}
+
+/**
+ * @brief Salva a sessão em um arquivo .dqs (uma única escrita).
+ * @return 1 em caso de sucesso, 0 caso contrário.
+ */
+int salvarSessao(const Sessao *sessao, const char *caminho) {
+    size_t tamanho;
+    uint8_t *buffer = serializarSessao(sessao, &tamanho);
+    int ok = 0;
+    int fd = open(caminho, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        ok = write(fd, buffer, tamanho) == (ssize_t)tamanho;
+        if (close(fd) != 0) {
+            ok = 0;
+        }
+    }
+    if (!ok) {
+        perror("Erro ao salvar a sessao");
+    }
+    free(buffer);
+    return ok;
+}
+
+/**
+ * @brief Retoma uma sessão salva por salvarSessao (uma única leitura).
+ * @return 1 em caso de sucesso, 0 caso contrário.
+ */
+int retomarSessao(Sessao *sessao, const char *caminho) {
+    int fd = open(caminho, O_RDONLY);
+    if (fd < 0) {
+        perror("Erro ao abrir a sessao salva");
+        return 0;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        perror("Erro ao ler a sessao salva");
+        close(fd);
+        return 0;
+    }
+    size_t tamanho = (size_t)info.st_size;
+    uint8_t *buffer = (uint8_t*)malloc(tamanho > 0 ? tamanho : 1);
+    if (buffer == NULL) {
+        perror("Erro ao alocar memoria para o instantaneo");
+        exit(EXIT_FAILURE);
+    }
+    ssize_t lidos = read(fd, buffer, tamanho);
+    close(fd);
+    int ok = lidos == (ssize_t)tamanho && desserializarSessao(sessao, buffer, tamanho);
+    if (lidos != (ssize_t)tamanho) {
+        perror("Erro ao ler a sessao salva");
+    }
+    free(buffer);
+    return ok;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE DIÁRIO (Gravação em grupo) --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief FNV-1a de 64 bits sobre bytes quaisquer, continuando de 'valor'.
+ */
+static uint64_t hashDeBytes(uint64_t valor, const void *dados, size_t n) {
+    const unsigned char *bytes = (const unsigned char*)dados;
+    for (size_t i = 0; i < n; i++) {
+        valor ^= bytes[i];
+        valor *= 1099511628211ULL;
+    }
+    return valor;
+}
+
+/**
+ * @brief Verificação de um registro: cobre partida, tipo, tamanho e carga.
+ */
+static uint64_t verificarRegistro(const RegistroDiario *registro, const void *carga) {
+    uint64_t valor = hashDeBytes(1469598103934665603ULL, &registro->partida,
+                                 sizeof(*registro) - offsetof(RegistroDiario, partida));
+    return hashDeBytes(valor, carga, registro->tamanho);
+}
+
+/**
+ * @brief Lê o registro que começa em 'pos', se ele estiver inteiro e íntegro.
+ * Um registro inválido que vai até o fim do arquivo é a cauda de uma gravação
+ * interrompida; um inválido com mais bytes depois dele é corrupção.
+ * @param registro Recebe o cabeçalho do registro (a carga vem logo depois).
+ * @return 1 se o registro é válido, 0 se é uma cauda cortada (ou o fim do
+ * arquivo), -1 se está corrompido antes do fim.
+ */
+static int lerRegistro(const uint8_t *dados, size_t tamanho, size_t pos, RegistroDiario *registro) {
+    size_t restantes = tamanho - pos;
+    if (restantes < sizeof(*registro)) {
+        return 0;
+    }
+    memcpy(registro, dados + pos, sizeof(*registro));
+    if (registro->tipo >= NUM_TIPOS_REGISTRO || registro->tamanho > DIARIO_MAX_CARGA) {
+        return -1; // Um cabeçalho gravado pela metade não chega a ser lido inteiro
+    }
+    if (restantes - sizeof(*registro) <= registro->tamanho) {
+        // Termina no fim do arquivo ou depois dele: válido só se estiver inteiro
+        return restantes - sizeof(*registro) == registro->tamanho
+            && verificarRegistro(registro, dados + pos + sizeof(*registro)) == registro->verificacao;
+    }
+    return verificarRegistro(registro, dados + pos + sizeof(*registro)) == registro->verificacao ? 1 : -1;
+}
+
+/**
+ * @brief Cabeçalho que amarra o diário à mansão e às regras desta execução.
+ */
+static void montarCabecalhoDiario(CabecalhoDiario *cabecalho, const Mansao *mansao) {
+    memset(cabecalho, 0, sizeof(*cabecalho));
+    memcpy(cabecalho->magica, DIARIO_MAGICA, 4);
+    cabecalho->versao = DIARIO_VERSAO;
+    cabecalho->assinaturaTextos = assinaturaTextos();
+    cabecalho->numTextos = tabelaTextos.numTextos;
+    cabecalho->numSalas = mansao->numSalas;
+}
+
+/**
+ * @brief Confere o cabeçalho de um diário existente contra a mansão e as regras atuais.
+ * @return 1 se o diário é desta mansão e destas regras, 0 caso contrário (com a mensagem).
+ */
+static int conferirCabecalhoDiario(const uint8_t *dados, size_t tamanho, const Mansao *mansao, const char *caminho) {
+    CabecalhoDiario lido, esperado;
+    montarCabecalhoDiario(&esperado, mansao);
+    if (tamanho < sizeof(lido)) {
+        fprintf(stderr, "%s: diario invalido: arquivo truncado\n", caminho);
+        return 0;
+    }
+    memcpy(&lido, dados, sizeof(lido));
+    if (memcmp(lido.magica, DIARIO_MAGICA, 4) != 0 || lido.versao != DIARIO_VERSAO) {
+        fprintf(stderr, "%s: diario invalido: assinatura ou versao desconhecida\n", caminho);
+        return 0;
+    }
+    if (memcmp(&lido, &esperado, sizeof(lido)) != 0) {
+        fprintf(stderr, "%s: diario de outra mansao ou de outras regras\n", caminho);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Escreve o buffer inteiro, continuando depois de escritas parciais
+ * e de interrupções por sinal.
+ */
+static int escreverTudo(int fd, const uint8_t *dados, size_t n) {
+    while (n > 0) {
+        ssize_t escritos = write(fd, dados, n);
+        if (escritos < 0) {
+            if (errno == EINTR) {
+                continue; // Interrompida por um sinal antes de escrever
+            }
+            return 0;
+        }
+        dados += escritos;
+        n -= (size_t)escritos;
+    }
+    return 1;
+}
+
+/**
+ * @brief Laço da thread gravadora: grava cada lote acumulado com um write e
+ * (salvo em DURABILIDADE_NENHUMA) um fdatasync, e avisa quem espera.
+ */
+static void* executarGravador(void *argumento) {
+    Diario *diario = (Diario*)argumento;
+    uint8_t *lote = NULL;
+    size_t capacidadeLote = 0;
+
+    pthread_mutex_lock(&diario->trava);
+    while (1) {
+        while (diario->usado == 0 && !diario->encerrar) {
+            pthread_cond_wait(&diario->pendente, &diario->trava);
+        }
+        if (diario->usado == 0) {
+            break; // Encerrando e sem nada pendente
+        }
+        // Troca os buffers: o próximo lote se acumula enquanto este é gravado
+        uint8_t *cheio = diario->buffer;
+        size_t capacidadeCheio = diario->capacidade;
+        size_t tamanho = diario->usado;
+        diario->buffer = lote;
+        diario->capacidade = capacidadeLote;
+        diario->usado = 0;
+        lote = cheio;
+        capacidadeLote = capacidadeCheio;
+        uint64_t ate = diario->aceitos;
+        pthread_cond_broadcast(&diario->gravado); // Libera quem esperava espaço
+        pthread_mutex_unlock(&diario->trava);
+
+        int ok = escreverTudo(diario->fd, lote, tamanho)
+              && (diario->nivel == DURABILIDADE_NENHUMA || fdatasync(diario->fd) == 0);
+
+        pthread_mutex_lock(&diario->trava);
+        if (!ok && !diario->falhou) {
+            perror("Erro ao gravar o diario");
+            diario->falhou = 1;
+        }
+        diario->gravados = ate;
+        diario->gravacoes++;
+        pthread_cond_broadcast(&diario->gravado);
+    }
+    pthread_mutex_unlock(&diario->trava);
+    free(lote);
+    return NULL;
+}
+
+/**
+ * @brief Prepara um diário vazio que só acumula os registros em memória.
+ */
+void abrirDiarioEmMemoria(Diario *diario) {
+    memset(diario, 0, sizeof(*diario));
+    diario->fd = -1;
+    diario->proximaPartida = 1;
+    pthread_mutex_init(&diario->trava, NULL);
+    pthread_cond_init(&diario->pendente, NULL);
+    pthread_cond_init(&diario->gravado, NULL);
+}
+
+/**
+ * @brief Abre (ou cria) um diário para acrescentar registros e inicia o gravador.
+ * Um diário existente precisa ser desta mansão e destas regras; um registro
+ * cortado no fim (queda no meio de uma gravação) é descartado, mas um
+ * registro corrompido antes do fim recusa o diário sem tocar no arquivo.
+ * @param diario O diário a abrir.
+ * @param caminho O arquivo .dqj.
+ * @param mansao A mansão da execução (já com as regras internadas).
+ * @param nivel Quando um registro conta como gravado.
+ * @return 1 em caso de sucesso, 0 caso contrário.
+ */
+int abrirDiario(Diario *diario, const char *caminho, const Mansao *mansao, NivelDurabilidade nivel) {
+    abrirDiarioEmMemoria(diario);
+    diario->nivel = nivel;
+    int fd = open(caminho, O_RDWR | O_CREAT | O_APPEND, 0644);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        perror("Erro ao abrir o diario");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+
+    size_t tamanho = (size_t)info.st_size;
+    if (tamanho == 0) {
+        CabecalhoDiario cabecalho;
+        montarCabecalhoDiario(&cabecalho, mansao);
+        if (!escreverTudo(fd, (const uint8_t*)&cabecalho, sizeof(cabecalho))
+            || (nivel != DURABILIDADE_NENHUMA && fsync(fd) != 0)) {
+            perror("Erro ao gravar o diario");
+            close(fd);
+            return 0;
+        }
+    } else {
+        void *base = mmap(NULL, tamanho, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            perror("Erro ao ler o diario");
+            close(fd);
+            return 0;
+        }
+        const uint8_t *dados = (const uint8_t*)base;
+        if (!conferirCabecalhoDiario(dados, tamanho, mansao, caminho)) {
+            munmap(base, tamanho);
+            close(fd);
+            return 0;
+        }
+        size_t pos = sizeof(CabecalhoDiario);
+        RegistroDiario registro;
+        int lido;
+        while ((lido = lerRegistro(dados, tamanho, pos, &registro)) > 0) {
+            if (registro.partida >= diario->proximaPartida) {
+                diario->proximaPartida = registro.partida + 1;
+            }
+            pos += sizeof(registro) + registro.tamanho;
+        }
+        munmap(base, tamanho);
+        if (lido < 0) {
+            fprintf(stderr, "%s: diario corrompido: registro invalido no byte %zu, antes do fim do arquivo\n",
+                    caminho, pos);
+            close(fd);
+            return 0;
+        }
+        if (pos < tamanho) {
+            fprintf(stderr, "%s: %zu bytes de um registro incompleto no fim foram descartados\n",
+                    caminho, tamanho - pos);
+            if (ftruncate(fd, (off_t)pos) != 0) {
+                perror("Erro ao truncar o diario");
+                close(fd);
+                return 0;
+            }
+        }
+    }
+
+    diario->fd = fd;
+    if (pthread_create(&diario->gravador, NULL, executarGravador, diario) != 0) {
+        perror("Erro ao criar thread");
+        exit(EXIT_FAILURE);
+    }
+    diario->temGravador = 1;
+    return 1;
+}
+
+/**
+ * @brief Reserva 'n' números de partida seguidos, depois dos que o diário já tem.
+ * @return O primeiro número reservado.
+ */
+uint64_t reservarPartidas(Diario *diario, uint64_t n) {
+    pthread_mutex_lock(&diario->trava);
+    uint64_t primeira = diario->proximaPartida;
+    diario->proximaPartida += n;
+    pthread_mutex_unlock(&diario->trava);
+    return primeira;
+}
+
+/**
+ * @brief Acrescenta os registros de um passo (já montados) ao diário.
+ * Em DURABILIDADE_SEMPRE, só retorna depois que eles foram sincronizados.
+ */
+static void anexarAoDiario(Diario *diario, const uint8_t *registros, size_t tamanho, uint32_t numRegistros) {
+    pthread_mutex_lock(&diario->trava);
+    // Freio: se o disco não acompanha, o jogo espera em vez de crescer sem limite
+    while (diario->temGravador && !diario->falhou && diario->usado > 0
+           && diario->usado + tamanho > DIARIO_LIMITE_PENDENTE) {
+        pthread_cond_wait(&diario->gravado, &diario->trava);
+    }
+    if (diario->falhou) {
+        pthread_mutex_unlock(&diario->trava);
+        return;
+    }
+    if (diario->usado + tamanho > diario->capacidade) {
+        size_t capacidade = diario->capacidade ? diario->capacidade : 64 * 1024;
+        while (capacidade < diario->usado + tamanho) {
+            capacidade *= 2;
+        }
+        diario->buffer = (uint8_t*)realloc(diario->buffer, capacidade);
+        if (diario->buffer == NULL) {
+            perror("Erro ao alocar memoria para o diario");
+            exit(EXIT_FAILURE);
+        }
+        diario->capacidade = capacidade;
+    }
+    memcpy(diario->buffer + diario->usado, registros, tamanho);
+    diario->usado += tamanho;
+    diario->registros += numRegistros;
+    uint64_t meu = ++diario->aceitos;
+    if (diario->temGravador) {
+        pthread_cond_signal(&diario->pendente);
+        while (diario->nivel == DURABILIDADE_SEMPRE && diario->gravados < meu && !diario->falhou) {
+            pthread_cond_wait(&diario->gravado, &diario->trava);
+        }
+    }
+    pthread_mutex_unlock(&diario->trava);
+}
+
+/**
+ * @brief Espera o gravador alcançar todos os registros aceitos até agora.
+ */
+void esperarDiario(Diario *diario) {
+    pthread_mutex_lock(&diario->trava);
+    while (diario->temGravador && diario->gravados < diario->aceitos && !diario->falhou) {
+        pthread_cond_wait(&diario->gravado, &diario->trava);
+    }
+    pthread_mutex_unlock(&diario->trava);
+}
+
+/**
+ * @brief Grava o que falta, encerra o gravador e fecha o arquivo.
+ * @return 1 se todos os registros foram gravados, 0 se houve erro de escrita.
+ */
+int fecharDiario(Diario *diario) {
+    if (diario->temGravador) {
+        pthread_mutex_lock(&diario->trava);
+        diario->encerrar = 1;
+        pthread_cond_signal(&diario->pendente);
+        pthread_mutex_unlock(&diario->trava);
+        pthread_join(diario->gravador, NULL);
+        diario->temGravador = 0;
+    }
+    int ok = !diario->falhou;
+    if (diario->fd >= 0 && close(diario->fd) != 0) {
+        perror("Erro ao fechar o diario");
+        ok = 0;
+    }
+    diario->fd = -1;
+    free(diario->buffer);
+    diario->buffer = NULL;
+    pthread_mutex_destroy(&diario->trava);
+    pthread_cond_destroy(&diario->pendente);
+    pthread_cond_destroy(&diario->gravado);
+    return ok;
+}
+
+/**
+ * @brief Monta um registro da sessão; ele só vai para o diário, junto com os
+ * outros do mesmo passo, em entregarRegistros.
+ */
+static void registrar(Sessao *sessao, TipoRegistro tipo, const void *carga, uint32_t tamanho) {
+    if (sessao->diario == NULL) {
+        return;
+    }
+    size_t necessario = sessao->usadoRegistros + sizeof(RegistroDiario) + tamanho;
+    if (necessario > sessao->capacidadeRegistros) {
+        size_t capacidade = sessao->capacidadeRegistros ? sessao->capacidadeRegistros : 1024;
+        while (capacidade < necessario) {
+            capacidade *= 2;
+        }
+        sessao->registros = (uint8_t*)realloc(sessao->registros, capacidade);
+        if (sessao->registros == NULL) {
+            perror("Erro ao alocar memoria para o diario");
+            exit(EXIT_FAILURE);
+        }
+        sessao->capacidadeRegistros = capacidade;
+    }
+    RegistroDiario registro;
+    registro.partida = sessao->saida.partida;
+    registro.tipo = (uint32_t)tipo;
+    registro.tamanho = tamanho;
+    registro.verificacao = verificarRegistro(&registro, carga);
+    memcpy(sessao->registros + sessao->usadoRegistros, &registro, sizeof(registro));
+    if (tamanho > 0) {
+        memcpy(sessao->registros + sessao->usadoRegistros + sizeof(registro), carga, tamanho);
+    }
+    sessao->usadoRegistros = necessario;
+    sessao->numRegistros++;
+}
+
+/**
+ * @brief Entrega ao diário os registros acumulados pela sessão (uma trava por passo).
+ */
+static void entregarRegistros(Sessao *sessao) {
+    if (sessao->diario == NULL || sessao->usadoRegistros == 0) {
+        return;
+    }
+    anexarAoDiario(sessao->diario, sessao->registros, sessao->usadoRegistros, sessao->numRegistros);
+    sessao->usadoRegistros = 0;
+    sessao->numRegistros = 0;
+}
+
+/**
+ * @brief Registra uma partida retomada de um .dqs (chamada depois de retomarSessao).
+ * Um instantâneo salvo fora do diário ganha um número novo de partida.
+ */
+void registrarRetomada(Sessao *sessao) {
+    if (sessao->diario == NULL) {
+        return;
+    }
+    if (sessao->saida.partida == 0) {
+        sessao->saida.partida = reservarPartidas(sessao->diario, 1);
+    }
+    registrar(sessao, REGISTRO_RETOMADA, NULL, 0);
+    entregarRegistros(sessao);
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE LÓGICA DE JOGO --------------------
+// -------------------------------------------------------------------
+
+/**
+ * @brief Prepara uma sessão vazia sobre uma mansão e um conjunto de regras.
+ * @param sessao A sessão a ser criada.
+ * @param mansao A mansão compartilhada (somente leitura).
+ * @param motor As regras compiladas compartilhadas (somente leitura).
+ */
+void criarSessao(Sessao *sessao, const Mansao *mansao, const MotorRegras *motor) {
+    memset(sessao, 0, sizeof(*sessao));
+    sessao->mansao = mansao;
+    sessao->motor = motor;
+    sessao->saida.destino = stdout;
+    inicializarHash(&sessao->indexadas);
+    criarEvidencias(&sessao->evidencias, motor->numSuspeitos + 1);
+    criarPlacar(motor, &sessao->placar);
+    criarRanking(motor, &sessao->ranking);
+    sessao->alturaBits = alturaBits(mansao->numSalas); // As tries começam vazias (NULL)
+}
+
+/**
+ * @brief Entra em um cômodo: mostra onde o jogador está e coleta a pista, se houver.
+ * A coleta é idempotente: o bit da sala em 'coletadas' é testado antes de
+ * qualquer trabalho, então voltar a um cômodo não cria nenhuma versão nova.
+ * @param sessao A sessão em andamento.
+ * @param sala O índice da sala em que o jogador entrou.
+ */
+static void entrarSala(Sessao *sessao, IdSala sala) {
+    const Mansao *mansao = sessao->mansao;
+    sessao->salaAtual = sala;
+
+    IdTexto idPista = mansaoPista(mansao, sala);
+    const char *pista = textoDe(idPista);
+    exibir(sessao, "\n--- Você está no cômodo: **%s** ---\n", textoDe(mansaoNome(mansao, sala)));
+    registrar(sessao, REGISTRO_SALA, &sala, sizeof(sala));
+    if (abrirEvento(sessao, "sala")) {
+        campoTexto(sessao, "sala", textoDe(mansaoNome(mansao, sala)));
+        campoLogico(sessao, "visitada", bitLigado(sessao->visitadas, sessao->alturaBits, sala));
+        fecharEvento(sessao);
+    }
+    if (bitLigado(sessao->visitadas, sessao->alturaBits, sala)) {
+        exibir(sessao, "   (Você já passou por aqui.)\n");
+    } else {
+        sessao->visitadas = ligarBit(&sessao->memoria, sessao->visitadas, sessao->alturaBits, sala);
+    }
+
+    if (idPista != TEXTO_VAZIO && bitLigado(sessao->coletadas, sessao->alturaBits, sala)) {
+        exibir(sessao, "   A pista deste cômodo já foi coletada.\n");
+    } else if (idPista != TEXTO_VAZIO) {
+        sessao->coletadas = ligarBit(&sessao->memoria, sessao->coletadas, sessao->alturaBits, sala);
+        exibir(sessao, "🔍 Você encontrou uma **Pista**!\n");
+        exibir(sessao, "   Pista: \"%s\"\n", pista);
+        if (abrirEvento(sessao, "pista")) {
+            campoTexto(sessao, "sala", textoDe(mansaoNome(mansao, sala)));
+            campoTexto(sessao, "pista", pista);
+            fecharEvento(sessao);
+        }
+
+        // Define a associação Suspeito/Pista pelas regras (uma passada pelo texto)
+        uint32_t indice = atribuirSuspeito(sessao->motor, pista, &sessao->placar);
+        if (indice == SEM_SUSPEITO) {
+            indice = sessao->motor->numSuspeitos; // "Desconhecido"
+        }
+        IdTexto suspeito = indice < sessao->motor->numSuspeitos ? sessao->motor->suspeitos[indice] : sessao->motor->desconhecido;
+
+        // Armazena a associação Pista-Suspeito em uma nova versão da B-tree
+        // (ordenada) e atualiza a contagem (uma pista já coletada não conta de novo)
+        IdTexto anterior;
+        sessao->raizPistas = inserirPista(&sessao->memoria, sessao->raizPistas, idPista, suspeito, &anterior);
+        if (anterior != suspeito) {
+            if (anterior != TEXTO_INEXISTENTE) {
+                rankingAjustar(&sessao->ranking, indiceDoSuspeito(sessao->motor, anterior), -1);
+            }
+            rankingAjustar(&sessao->ranking, indice, +1);
+        }
+
+        // Os índices de trechos e de evidências só crescem: cada pista entra
+        // uma vez, mesmo que seja coletada de novo depois de um desfazer
+        IdTexto indexada = inserirNaHash(&sessao->indexadas, idPista, suspeito);
+        if (indexada == TEXTO_INEXISTENTE) {
+            indexarPista(&sessao->trechos, idPista);
+        }
+        if (indexada != suspeito) {
+            anotarEvidencia(&sessao->evidencias, indice, idPista);
+        }
+        
+        sessao->totalPistasColetadas++;
+        uint32_t coleta[3] = {sala, idPista, suspeito};
+        registrar(sessao, REGISTRO_PISTA, coleta, sizeof(coleta));
+        exibir(sessao, "   **Pista Coletada e Associada a: %s**\n", textoDe(suspeito));
+        if (abrirEvento(sessao, "suspeito")) {
+            campoTexto(sessao, "pista", pista);
+            campoTexto(sessao, "suspeito", textoDe(suspeito));
+            campoNumero(sessao, "pistasContra", sessao->ranking.contagem[indice]);
+            fecharEvento(sessao);
+        }
+    } else {
+        exibir(sessao, "   Este cômodo não tem pistas a serem coletadas.\n");
+    }
+}
+
+/**
+ * @brief Nome do suspeito de um índice do ranking.
+ */
+static IdTexto nomeNoRanking(const Sessao *sessao, uint32_t indice) {
+    return indice < sessao->motor->numSuspeitos ? sessao->motor->suspeitos[indice] : sessao->motor->desconhecido;
+}
+
+/**
+ * @brief Evento do fim da partida (acusado vazio quando não houve acusação).
+ */
+static void eventoVeredito(Sessao *sessao, const char *acusado, int pistas) {
+    uint8_t carga[2 * sizeof(uint32_t) + MAX_SUSPEITO];
+    uint32_t resultado[2] = {(uint32_t)pistas, (uint32_t)sessao->vitoria};
+    size_t comprimento = strlen(acusado);
+    memcpy(carga, resultado, sizeof(resultado));
+    memcpy(carga + sizeof(resultado), acusado, comprimento);
+    registrar(sessao, REGISTRO_VEREDITO, carga, (uint32_t)(sizeof(resultado) + comprimento));
+    if (abrirEvento(sessao, "veredito")) {
+        campoTexto(sessao, "acusado", acusado);
+        campoNumero(sessao, "pistas", (uint64_t)pistas);
+        campoLogico(sessao, "vitoria", sessao->vitoria);
+        fecharEvento(sessao);
+    }
+}
+
+/**
+ * @brief Lista as pistas que apontam para um suspeito (pelo índice reverso).
+ */
+static void exibirEvidencias(Sessao *sessao, uint32_t indice) {
+    IdTexto *pistas;
+    uint32_t n = evidenciasContra(sessao->raizPistas, &sessao->evidencias, indice,
+                                  nomeNoRanking(sessao, indice), &pistas);
+    for (uint32_t i = 0; i < n; i++) {
+        exibir(sessao, "    - %s\n", textoDe(pistas[i]));
+    }
+    free(pistas);
+}
+
+/**
+ * @brief Abre a fase de julgamento: lista as pistas e pede o nome do acusado.
+ * Sem nenhuma pista coletada a partida termina aqui mesmo.
+ */
+static void iniciarAcusacao(Sessao *sessao) {
+    exibir(sessao, "\n============================================\n");
+    exibir(sessao, "        🚨 FASE DE ACUSAÇÃO 🚨\n");
+    exibir(sessao, "============================================\n");
+
+    if (sessao->totalPistasColetadas == 0) {
+        exibir(sessao, "⚠️ Você não coletou nenhuma pista. Acusação impossível.\n");
+        exibir(sessao, "FIM DE JOGO: O culpado escapou por falta de provas.\n");
+        sessao->vitoria = 0;
+        eventoVeredito(sessao, "", 0);
+        sessao->estado = JOGO_FIM;
+        return;
+    }
+
+    exibir(sessao, "Pistas Coletadas (em ordem alfabética):\n");
+    listarPistasColetadas(sessao, sessao->raizPistas);
+
+    // Um a mais que os 3 exibidos: o "Desconhecido" não é suspeito e fica de fora
+    uint32_t topo[4];
+    uint32_t numTopo = rankingTopo(&sessao->ranking, topo, 4);
+    uint32_t desconhecido = sessao->motor->numSuspeitos;
+    uint32_t exibidos = 0;
+    for (uint32_t i = 0; i < numTopo && exibidos < 3; i++) {
+        if (topo[i] == desconhecido) {
+            continue;
+        }
+        if (sessao->ranking.contagem[topo[i]] == 0) {
+            break;
+        }
+        if (exibidos == 0) {
+            exibir(sessao, "\nSuspeito mais provável: **%s**\n", textoDe(nomeNoRanking(sessao, topo[i])));
+        }
+        exibidos++;
+        exibir(sessao, " %u. %s (%u pista%s)\n", exibidos, textoDe(nomeNoRanking(sessao, topo[i])),
+               sessao->ranking.contagem[topo[i]], sessao->ranking.contagem[topo[i]] == 1 ? "" : "s");
+        exibirEvidencias(sessao, topo[i]);
+    }
+    if (exibidos == 0) {
+        exibir(sessao, "\nNenhuma pista aponta para um suspeito.\n");
+    }
+    uint32_t semSuspeito = sessao->ranking.contagem[desconhecido];
+    if (semSuspeito > 0) {
+        exibir(sessao, "Pistas sem suspeito (%u):\n", semSuspeito);
+        exibirEvidencias(sessao, desconhecido);
+    }
+
+    exibir(sessao, "\nCom base nas evidências, quem você acusa? (");
+    for (uint32_t i = 0; i < sessao->motor->numSuspeitos; i++) {
+        exibir(sessao, "%s%s", i > 0 ? ", " : "", textoDe(sessao->motor->suspeitos[i]));
+    }
+    exibir(sessao, "): ");
+    sessao->estado = JOGO_ACUSACAO;
+}
+
+/**
+ * @brief Julga a acusação: conta as pistas contra o acusado e encerra a partida.
+ * @param sessao A sessão em andamento.
+ * @param entrada O nome do acusado (só a primeira palavra é considerada).
+ */
+static void julgarAcusacao(Sessao *sessao, const char *entrada) {
+    char acusacao[MAX_SUSPEITO];
+    int pistasContraSuspeito = 0;
+
+    size_t n = 0;
+    while (isspace((unsigned char)*entrada)) {
+        entrada++;
+    }
+    while (entrada[n] != '\0' && !isspace((unsigned char)entrada[n]) && n + 1 < sizeof(acusacao)) {
+        acusacao[n] = entrada[n];
+        n++;
+    }
+    acusacao[n] = '\0';
+    
+    // Força a primeira letra para maiúscula para padronização na verificação
+    acusacao[0] = toupper((unsigned char)acusacao[0]);
+
+    // Verificação de Pistas: a contagem do acusado já está no ranking
+    // (um nome que nunca foi internado não tem nenhuma pista associada)
+    IdTexto idAcusado = procurarTexto(acusacao);
+    if (idAcusado != TEXTO_INEXISTENTE) {
+        uint32_t indice = indiceDoSuspeito(sessao->motor, idAcusado);
+        if (indice != SEM_SUSPEITO) {
+            pistasContraSuspeito = (int)sessao->ranking.contagem[indice];
+        }
+    }
+
+    exibir(sessao, "\n--- RESULTADO DO JULGAMENTO ---\n");
+    exibir(sessao, "Suspeito Acusado: **%s**\n", acusacao);
+    exibir(sessao, "Pistas que apontam para %s: **%d**\n", acusacao, pistasContraSuspeito);
+
+    if (pistasContraSuspeito >= 2) {
+        exibir(sessao, "\n🎉 **VITÓRIA!** A acusação contra %s é sustentada por %d pistas.\n", acusacao, pistasContraSuspeito);
+        exibir(sessao, "O caso está resolvido. O culpado foi levado à justiça!\n");
+    } else {
+        exibir(sessao, "\n😢 **FRACASSO.** Você precisa de pelo menos 2 pistas, mas só encontrou %d.\n", pistasContraSuspeito);
+        exibir(sessao, "O caso foi arquivado por falta de provas suficientes. O culpado escapou.\n");
+    }
+
+    sessao->vitoria = pistasContraSuspeito >= 2;
+    sessao->estado = JOGO_FIM;
+    eventoVeredito(sessao, acusacao, pistasContraSuspeito);
+}
+
+/**
+ * @brief Mostra as saídas da sala atual (as MAX_ATALHOS_SAIDA primeiras têm
+ * atalho: 'e', 'd' e depois os números) e pede o próximo movimento.
+ */
+static void exibirMenu(Sessao *sessao) {
+    if (sessao->saida.modo != SAIDA_TEXTO) {
+        return;
+    }
+    const Mansao *mansao = sessao->mansao;
+    uint32_t numSaidas = mansaoNumSaidas(mansao, sessao->salaAtual);
+    exibir(sessao, "\nSaídas:");
+    for (uint32_t k = 0; k < numSaidas && k < MAX_ATALHOS_SAIDA; k++) {
+        exibir(sessao, " [**%c**] %s", k == 0 ? 'e' : k == 1 ? 'd' : (char)('1' + k),
+               textoDe(mansaoNome(mansao, mansaoSaida(mansao, sessao->salaAtual, k))));
+    }
+    if (numSaidas > MAX_ATALHOS_SAIDA) {
+        exibir(sessao, " (e mais %u)", numSaidas - MAX_ATALHOS_SAIDA);
+    }
+    exibir(sessao, "\nOnde deseja ir? Uma saída, [**i** nome do cômodo] para ir direto, [**u**] desfazer, ou [**s**] Sair da mansão: ");
+}
+
+/**
+ * @brief Saída correspondente a um comando: 'e' é a 0, 'd' a 1 e '1'-'9' são 0-8.
+ * @return O número da saída, ou UINT32_MAX se o comando não for de movimento.
+ */
+static uint32_t saidaDoComando(char escolha) {
+    if (escolha == 'e' || escolha == 'd') {
+        return escolha == 'e' ? 0 : 1;
+    }
+    if (escolha >= '1' && escolha < '1' + MAX_ATALHOS_SAIDA) {
+        return (uint32_t)(escolha - '1');
+    }
+    return UINT32_MAX;
+}
+
+/**
+ * @brief Vai direto a um cômodo pelo nome (ou começo do nome),
+ * passando por cada sala do caminho como se o jogador andasse até lá.
+ * Cada passo custa O(log saídas) nas rotas pré-calculadas.
+ * @param termo O texto digitado depois do comando 'i'.
+ */
+static void irParaSala(Sessao *sessao, const char *termo) {
+    char nome[MAX_SUSPEITO];
+    while (isspace((unsigned char)*termo)) {
+        termo++;
+    }
+    size_t comprimento = strcspn(termo, "\r\n");
+    while (comprimento > 0 && isspace((unsigned char)termo[comprimento - 1])) {
+        comprimento--;
+    }
+    if (comprimento == 0 || comprimento >= sizeof(nome)) {
+        exibir(sessao, "Use 'i <nome do cômodo>' (até %d letras).\n", MAX_SUSPEITO - 1);
+        return;
+    }
+    for (size_t i = 0; i < comprimento; i++) {
+        nome[i] = termo[i] == '_' ? ' ' : termo[i]; // '_' ainda vale espaço, como nos roteiros e diários antigos
+    }
+    nome[comprimento] = '\0';
+
+    const Mansao *mansao = sessao->mansao;
+    IdSala destino = procurarSala(mansao, nome);
+    if (destino == SEM_SALA) {
+        exibir(sessao, "❌ Nenhum cômodo se chama \"%s\". Permanece em **%s**.\n", nome,
+               textoDe(mansaoNome(mansao, sessao->salaAtual)));
+        return;
+    }
+    if (destino == sessao->salaAtual) {
+        exibir(sessao, "Você já está em **%s**.\n", textoDe(mansaoNome(mansao, destino)));
+        return;
+    }
+    guardarMomento(sessao); // A viagem inteira se desfaz de uma vez
+    exibir(sessao, "\n🚶 Indo para **%s**...\n", textoDe(mansaoNome(mansao, destino)));
+    // O limite só importa para um mapa corrompido: um caminho nunca repete sala
+    for (uint32_t passos = 0; sessao->salaAtual != destino && passos < mansao->numSalas; passos++) {
+        IdSala proxima = proximoPasso(mansao, sessao->salaAtual, destino);
+        if (proxima == SEM_SALA) {
+            break;
+        }
+        entrarSala(sessao, proxima);
+    }
+}
+
+/**
+ * @brief Começa uma partida na entrada da mansão e mostra o primeiro menu.
+ * A sessão deve estar vazia (recém-criada ou reiniciada).
+ */
+void iniciarPartida(Sessao *sessao) {
+    sessao->estado = JOGO_EXPLORANDO;
+    sessao->vitoria = 0;
+    registrar(sessao, REGISTRO_INICIO, NULL, 0);
+    entrarSala(sessao, SALA_ENTRADA);
+    exibirMenu(sessao);
+    entregarRegistros(sessao);
+}
+
+/**
+ * @brief Mostra onde uma sessão restaurada parou e o menu da fase em que ela está.
+ */
+void apresentarRetomada(Sessao *sessao) {
+    exibir(sessao, "\n🔄 Investigação retomada (%d pista%s coletada%s).\n", sessao->totalPistasColetadas,
+           sessao->totalPistasColetadas == 1 ? "" : "s", sessao->totalPistasColetadas == 1 ? "" : "s");
+    if (sessao->estado == JOGO_EXPLORANDO) {
+        exibir(sessao, "\n--- Você está no cômodo: **%s** ---\n", textoDe(mansaoNome(sessao->mansao, sessao->salaAtual)));
+        exibirMenu(sessao);
+    } else if (sessao->estado == JOGO_ACUSACAO) {
+        iniciarAcusacao(sessao);
+    }
+}
+
+/**
+ * @brief Busca nas pistas coletadas: "trecho" acha as que o contêm em qualquer
+ * posição; "prefixo*" acha as que começam com ele.
+ * @param termo O texto digitado depois do comando 'b'.
+ */
+static void buscarPistas(Sessao *sessao, const char *termo) {
+    char busca[MAX_SUSPEITO];
+    while (isspace((unsigned char)*termo)) {
+        termo++;
+    }
+    size_t comprimento = strcspn(termo, "\r\n");
+    while (comprimento > 0 && isspace((unsigned char)termo[comprimento - 1])) {
+        comprimento--;
+    }
+    if (comprimento == 0 || comprimento >= sizeof(busca)) {
+        exibir(sessao, "Use 'b <trecho>' ou 'b <prefixo>*' (até %d letras).\n", MAX_SUSPEITO - 1);
+        return;
+    }
+    memcpy(busca, termo, comprimento);
+    busca[comprimento] = '\0';
+
+    size_t encontradas = 0;
+    if (busca[comprimento - 1] == '*') {
+        busca[--comprimento] = '\0';
+        exibir(sessao, "\n🔎 Pistas que começam com \"%s\":\n", busca);
+        listarPistasComPrefixo(sessao, sessao->raizPistas, busca, comprimento, &encontradas);
+    } else {
+        exibir(sessao, "\n🔎 Pistas que contêm \"%s\":\n", busca);
+        IdTexto *resultado;
+        encontradas = buscarTrecho(&sessao->trechos, sessao->raizPistas, busca, &resultado);
+        for (size_t i = 0; i < encontradas; i++) {
+            exibir(sessao, " -> %s\n", textoDe(resultado[i]));
+        }
+        free(resultado);
+    }
+    if (encontradas == 0) {
+        exibir(sessao, "   Nenhuma pista coletada corresponde à busca.\n");
+    }
+}
+
+/**
+ * @brief Mostra todas as evidências coletadas contra um suspeito.
+ * @param termo O nome digitado depois do comando 'v'.
+ */
+static void verEvidencias(Sessao *sessao, const char *termo) {
+    char nome[MAX_SUSPEITO];
+    while (isspace((unsigned char)*termo)) {
+        termo++;
+    }
+    size_t n = strcspn(termo, "\r\n");
+    while (n > 0 && isspace((unsigned char)termo[n - 1])) {
+        n--;
+    }
+    if (n >= sizeof(nome)) {
+        n = 0; // Nenhum suspeito tem um nome tão longo
+    }
+    memcpy(nome, termo, n);
+    nome[n] = '\0';
+    nome[0] = toupper((unsigned char)nome[0]);
+
+    IdTexto idSuspeito = procurarTexto(nome);
+    uint32_t indice = idSuspeito == TEXTO_INEXISTENTE ? SEM_SUSPEITO : indiceDoSuspeito(sessao->motor, idSuspeito);
+    if (indice == SEM_SUSPEITO) {
+        exibir(sessao, "Use 'v <suspeito>' com um destes nomes: ");
+        for (uint32_t i = 0; i < sessao->motor->numSuspeitos; i++) {
+            exibir(sessao, "%s%s", i > 0 ? ", " : "", textoDe(sessao->motor->suspeitos[i]));
+        }
+        exibir(sessao, ".\n");
+        return;
+    }
+    uint32_t contagem = sessao->ranking.contagem[indice];
+    exibir(sessao, "\n🗂️ Evidências contra %s (%u pista%s):\n", nome, contagem, contagem == 1 ? "" : "s");
+    if (contagem == 0) {
+        exibir(sessao, "   Nenhuma pista coletada aponta para este suspeito.\n");
+    }
+    exibirEvidencias(sessao, indice);
+}
+
+/**
+ * @brief Evento de desfazer, marcar ou voltar a uma marca, com o estado resultante.
+ */
+static void eventoMomento(Sessao *sessao, AcaoMomento acao) {
+    static const char *nomes[] = {"desfazer", "marcar", "voltar"};
+    uint32_t carga[2] = {(uint32_t)acao, sessao->salaAtual};
+    registrar(sessao, REGISTRO_MOMENTO, carga, sizeof(carga));
+    if (abrirEvento(sessao, "momento")) {
+        campoTexto(sessao, "acao", nomes[acao]);
+        campoTexto(sessao, "sala", textoDe(mansaoNome(sessao->mansao, sessao->salaAtual)));
+        campoNumero(sessao, "pistas", (uint64_t)sessao->totalPistasColetadas);
+        fecharEvento(sessao);
+    }
+}
+
+/**
+ * @brief Desfaz o último movimento (uma saída ou uma viagem com 'i'), em O(suspeitos).
+ */
+static void desfazerMovimento(Sessao *sessao) {
+    Momento *momento = retirarMomento(sessao);
+    if (momento == NULL) {
+        exibir(sessao, "Nada para desfazer.\n");
+        return;
+    }
+    restaurarMomento(sessao, momento);
+    liberarMomento(sessao, momento);
+    exibir(sessao, "\n↩️ Movimento desfeito.\n");
+    exibir(sessao, "\n--- Você está no cômodo: **%s** ---\n", textoDe(mansaoNome(sessao->mansao, sessao->salaAtual)));
+    eventoMomento(sessao, MOMENTO_DESFAZER);
+}
+
+/**
+ * @brief Marca o ponto atual da investigação para voltar a ele com 'r <n>'.
+ */
+static void marcarMomento(Sessao *sessao) {
+    if (sessao->numMarcas == MAX_MARCAS) {
+        exibir(sessao, "Já há %d pontos marcados, o máximo por partida. Use 'r <n>' para voltar a um deles.\n", MAX_MARCAS);
+        return;
+    }
+    if (sessao->numMarcas == sessao->capacidadeMarcas) {
+        sessao->capacidadeMarcas = sessao->capacidadeMarcas ? sessao->capacidadeMarcas * 2 : 8;
+        sessao->marcas = (Momento**)realloc(sessao->marcas, sessao->capacidadeMarcas * sizeof(Momento*));
+        if (sessao->marcas == NULL) {
+            perror("Erro ao alocar memoria para as marcas");
+            exit(EXIT_FAILURE);
+        }
+    }
+    sessao->marcas[sessao->numMarcas++] = capturarMomento(sessao);
+    exibir(sessao, "📌 Ponto %u marcado em **%s** (%d pista%s). Use 'r %u' para voltar a ele.\n", sessao->numMarcas,
+           textoDe(mansaoNome(sessao->mansao, sessao->salaAtual)), sessao->totalPistasColetadas,
+           sessao->totalPistasColetadas == 1 ? "" : "s", sessao->numMarcas);
+    eventoMomento(sessao, MOMENTO_MARCAR);
+}
+
+/**
+ * @brief Volta a um ponto marcado, abrindo uma linha alternativa da
+ * investigação. A linha atual não se perde: 'u' volta para ela.
+ * @param termo O número digitado depois do comando 'r'.
+ */
+static void voltarAMarca(Sessao *sessao, const char *termo) {
+    if (sessao->numMarcas == 0) {
+        exibir(sessao, "Nenhum ponto marcado ainda. Use 'm' para marcar.\n");
+        return;
+    }
+    char *fim;
+    unsigned long numero = strtoul(termo, &fim, 10);
+    while (isspace((unsigned char)*fim)) {
+        fim++;
+    }
+    if (fim == termo || *fim != '\0' || numero == 0 || numero > sessao->numMarcas) {
+        exibir(sessao, "Use 'r <n>' com um ponto de 1 a %u.\n", sessao->numMarcas);
+        return;
+    }
+    guardarMomento(sessao);
+    restaurarMomento(sessao, sessao->marcas[numero - 1]);
+    exibir(sessao, "\n⏪ De volta ao ponto %lu.\n", numero);
+    exibir(sessao, "\n--- Você está no cômodo: **%s** ---\n", textoDe(mansaoNome(sessao->mansao, sessao->salaAtual)));
+    eventoMomento(sessao, MOMENTO_VOLTAR);
+}
+
+/**
+ * @brief Avança a partida com uma entrada do jogador, sem bloquear e sem recursão.
+ * Explorando, o primeiro caractere não branco é o comando ('e', 'd', '1'-'9',
+ * 's', 'u', 'm', ou 'b'/'i'/'v'/'r' seguidos de um termo, que vai até o fim
+ * da linha ou até um ';');
+ * na acusação, a primeira palavra é o nome do acusado. NULL indica fim da
+ * entrada: sai da mansão, ou encerra a acusação sem resposta.
+ * @param sessao A sessão em andamento (já iniciada com iniciarPartida).
+ * @param entrada O comando do jogador, ou NULL.
+ * @return O estado da partida após o passo.
+ */
+EstadoJogo passo(Sessao *sessao, const char *entrada) {
+    METRICA(uint64_t inicioPasso = metricaAgoraNs();)
+    if (entrada == NULL) {
+        registrar(sessao, REGISTRO_FIM_DA_ENTRADA, NULL, 0);
+    } else {
+        size_t comprimento = strlen(entrada);
+        registrar(sessao, REGISTRO_COMANDO, entrada, (uint32_t)(comprimento < DIARIO_MAX_CARGA ? comprimento : DIARIO_MAX_CARGA));
+    }
+    if (sessao->estado == JOGO_EXPLORANDO) {
+        char escolha = 's'; // Fim da entrada: encerra a exploração
+        if (entrada != NULL) {
+            while (isspace((unsigned char)*entrada)) {
+                entrada++;
+            }
+            escolha = tolower((unsigned char)*entrada);
+        }
+
+        uint32_t saida = saidaDoComando(escolha);
+        if (escolha == 's') {
+            exibir(sessao, "\n✅ **Saindo da Mansão...** Iniciando a fase de Acusação!\n");
+            iniciarAcusacao(sessao);
+        } else if (escolha == 'b') {
+            buscarPistas(sessao, entrada + 1);
+        } else if (escolha == 'i') {
+            irParaSala(sessao, entrada + 1);
+        } else if (escolha == 'v') {
+            verEvidencias(sessao, entrada + 1);
+        } else if (escolha == 'u') {
+            desfazerMovimento(sessao);
+        } else if (escolha == 'm') {
+            marcarMomento(sessao);
+        } else if (escolha == 'r') {
+            voltarAMarca(sessao, entrada + 1);
+        } else if (saida == UINT32_MAX) {
+            exibir(sessao, "Escolha inválida. Use 'e', 'd' ou 1-9 para uma saída, 'i <cômodo>', 's', 'b <trecho>' para buscar nas pistas, 'v <suspeito>' para ver as evidências, 'u' para desfazer, 'm' para marcar o ponto atual ou 'r <n>' para voltar a ele.\n");
+        } else if (mansaoSaida(sessao->mansao, sessao->salaAtual, saida) != SEM_SALA) {
+            guardarMomento(sessao);
+            entrarSala(sessao, mansaoSaida(sessao->mansao, sessao->salaAtual, saida));
+        } else {
+            exibir(sessao, "❌ Não há cômodo nesta direção. Permanece em **%s**.\n",
+                   textoDe(mansaoNome(sessao->mansao, sessao->salaAtual)));
+            // Permite ao jogador tentar novamente na mesma sala
+            entrarSala(sessao, sessao->salaAtual);
+        }
+        if (sessao->estado == JOGO_EXPLORANDO) {
+            exibirMenu(sessao);
+        }
+    } else if (sessao->estado == JOGO_ACUSACAO) {
+        if (entrada == NULL) {
+            exibir(sessao, "Entrada inválida. FIM DE JOGO.\n");
+            sessao->vitoria = 0;
+            sessao->estado = JOGO_FIM;
+            eventoVeredito(sessao, "", 0);
+        } else {
+            julgarAcusacao(sessao, entrada);
+        }
+    }
+    entregarRegistros(sessao); // Todos os registros do passo de uma vez
+    METRICA(metricaPasso(metricaAgoraNs() - inicioPasso);
+            atenderPedidoMetricas();)
+    return sessao->estado;
+}
+
+/**
+ * @brief Continua uma partida já iniciada (ou retomada), lendo as entradas de uma fonte.
+ * Se 'arquivoPausa' não for NULL, a escolha 'p' durante a exploração salva a
+ * sessão nesse arquivo e interrompe a partida (o estado continua JOGO_EXPLORANDO).
+ * @param sessao A sessão em andamento.
+ * @param entrada De onde vêm as escolhas e o nome do acusado.
+ * @param arquivoPausa Onde salvar ao pausar, ou NULL para não permitir pausa.
+ * @return 1 se a acusação for sustentada (vitória), 0 caso contrário.
+ */
+int continuarPartida(Sessao *sessao, FonteEntrada *entrada, const char *arquivoPausa) {
+    char comando[MAX_SUSPEITO];
+    while (sessao->estado != JOGO_FIM) {
+        if (entrada->arquivo != NULL) {
+            descarregarSaida(&sessao->saida); // O jogador precisa ver a pergunta
+        }
+        int leu;
+        if (sessao->estado == JOGO_EXPLORANDO) {
+            leu = lerEscolha(entrada, &comando[0]);
+            comando[1] = '\0';
+            if (leu && arquivoPausa != NULL && tolower((unsigned char)comando[0]) == 'p') {
+                if (salvarSessao(sessao, arquivoPausa)) {
+                    exibir(sessao, "\n💾 Investigação salva em %s. Use --retomar para continuar.\n", arquivoPausa);
+                    descarregarSaida(&sessao->saida);
+                    return 0;
+                }
+                exibir(sessao, "Não foi possível salvar. Continue a exploração: ");
+                continue;
+            }
+            // 'b', 'i', 'v' e 'r' levam o resto da linha: "b <trecho>", "i <cômodo>", "v <suspeito>", "r <n>"
+            char letra = (char)tolower((unsigned char)comando[0]);
+            if (leu && (letra == 'b' || letra == 'i' || letra == 'v' || letra == 'r')) {
+                lerTermo(entrada, comando + 1, sizeof(comando) - 1);
+            }
+        } else {
+            leu = lerPalavra(entrada, comando, sizeof(comando));
+        }
+        passo(sessao, leu ? comando : NULL);
+    }
+    if (entrada->arquivo != NULL) {
+        descarregarSaida(&sessao->saida);
+    }
+    return sessao->vitoria;
+}
+
+/**
+ * @brief Joga uma partida inteira lendo as entradas de uma fonte (teclado ou roteiro).
+ * @param sessao A sessão, vazia.
+ * @param entrada De onde vêm as escolhas e o nome do acusado.
+ * @return 1 se a acusação for sustentada (vitória), 0 caso contrário.
+ */
+int jogarPartida(Sessao *sessao, FonteEntrada *entrada) {
+    iniciarPartida(sessao);
+    return continuarPartida(sessao, entrada, NULL);
+}
+
+/**
+ * @brief Descarta as pistas coletadas na partida.
+ * Os nós da B-tree vivem na arena da sessão, então basta reiniciá-la.
+ */
+void liberarPistas(Sessao *sessao) {
+    arenaReiniciar(&sessao->memoria);
+    sessao->raizPistas = NULL;
+    sessao->visitadas = NULL;
+    sessao->coletadas = NULL;
+    esquecerMomentos(sessao); // Os momentos apontavam para a arena
+}
+
+/**
+ * @brief Prepara uma nova partida na mesma sessão, reaproveitando a memória.
+ */
+void reiniciarSessao(Sessao *sessao) {
+    liberarPistas(sessao);
+    limparHash(&sessao->indexadas);
+    limparEvidencias(&sessao->evidencias);
+    zerarRanking(&sessao->ranking);
+    limparTrechos(&sessao->trechos);
+    sessao->totalPistasColetadas = 0;
+}
+
+/**
+ * @brief Libera a memória alocada para a Tabela Hash.
+ */
+void liberarHash(TabelaHash *tabela) {
+    free(tabela->controle);
+    free(tabela->itens);
+    tabela->controle = NULL;
+    tabela->itens = NULL;
+    tabela->capacidade = 0;
+    tabela->ocupados = 0;
+}
+
+/**
+ * @brief Libera toda a memória de uma sessão.
+ */
+void liberarSessao(Sessao *sessao) {
+    arenaDestruir(&sessao->memoria);
+    liberarHash(&sessao->indexadas);
+    liberarEvidencias(&sessao->evidencias);
+    liberarPlacar(&sessao->placar);
+    liberarRanking(&sessao->ranking);
+    liberarTrechos(&sessao->trechos);
+    descarregarSaida(&sessao->saida);
+    free(sessao->saida.buffer);
+    free(sessao->marcas);
+    free(sessao->desfazer);
+    free(sessao->registros);
+    sessao->registros = NULL;
+    sessao->usadoRegistros = 0;
+    sessao->marcas = NULL;
+    sessao->numMarcas = 0;
+    sessao->capacidadeMarcas = 0;
+    sessao->desfazer = NULL;
+    sessao->numDesfazer = 0;
+    sessao->momentosLivres = NULL;
+    sessao->visitadas = NULL;
+    sessao->coletadas = NULL;
+    sessao->raizPistas = NULL;
+}
+
+/**
+ * @brief Segundos de relógio monotônico (para medir o modo em lote).
+ */
+static double agoraSegundos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Lê um arquivo inteiro (ou a entrada padrão, se o caminho for "-") para a memória.
+ * @param tamanho Recebe o número de bytes lidos.
+ * @return O conteúdo terminado em '\0' (liberar com free), ou NULL em caso de erro.
+ */
+static char* lerArquivoInteiro(const char *caminho, size_t *tamanho) {
+    FILE *arquivo = strcmp(caminho, "-") == 0 ? stdin : fopen(caminho, "rb");
+    if (arquivo == NULL) {
+        perror("Erro ao abrir roteiro");
+        return NULL;
+    }
+    size_t capacidade = 64 * 1024, usado = 0;
+    char *conteudo = (char*)malloc(capacidade);
+    while (conteudo != NULL) {
+        usado += fread(conteudo + usado, 1, capacidade - usado - 1, arquivo);
+        if (usado < capacidade - 1) {
+            break;
+        }
+        capacidade *= 2;
+        conteudo = (char*)realloc(conteudo, capacidade);
+    }
+    if (arquivo != stdin) {
+        fclose(arquivo);
+    }
+    if (conteudo == NULL) {
+        perror("Erro ao alocar memoria para o roteiro");
+        exit(EXIT_FAILURE);
+    }
+    conteudo[usado] = '\0';
+    *tamanho = usado;
+    return conteudo;
+}
+
+// Trabalho compartilhado pelos trabalhadores do modo em lote
+typedef struct TrabalhoLote {
+    const Mansao *mansao;
+    const char **linhas;     // Início de cada partida no roteiro
+    size_t *tamanhos;
+    size_t numLinhas;
+    uint64_t totalPartidas;  // numLinhas * repeticoes
+    uint64_t proxima;        // Próxima partida a reservar (atômico)
+    ModoSaida modo;          // SAIDA_SILENCIOSA, ou SAIDA_NDJSON para os eventos
+    Diario *diario;          // Diário compartilhado pelas sessões, ou NULL
+    uint64_t primeiraPartida; // Número da partida 0 no diário e nos eventos
+} TrabalhoLote;
+
+// Resultado de um trabalhador
+typedef struct Trabalhador {
+    pthread_t thread;
+    TrabalhoLote *trabalho;
+    long partidas;
+    long vitorias;
+} Trabalhador;
+
+/**
+ * @brief Laço de um trabalhador: reserva blocos de partidas até acabar o lote,
+ * jogando todas na mesma sessão (reiniciada a cada partida).
+ */
+static void* executarTrabalhador(void *argumento) {
+    Trabalhador *trabalhador = (Trabalhador*)argumento;
+    TrabalhoLote *trabalho = trabalhador->trabalho;
+    Sessao sessao;
+    criarSessao(&sessao, trabalho->mansao, &motorRegras);
+    configurarSaida(&sessao, trabalho->modo, stdout);
+    sessao.diario = trabalho->diario;
+
+    while (1) {
+        uint64_t inicio = __atomic_fetch_add(&trabalho->proxima, LOTE_PARTIDAS_POR_TAREFA, __ATOMIC_RELAXED);
+        if (inicio >= trabalho->totalPartidas) {
+            break;
+        }
+        uint64_t fim = inicio + LOTE_PARTIDAS_POR_TAREFA;
+        if (fim > trabalho->totalPartidas) {
+            fim = trabalho->totalPartidas;
+        }
+        for (uint64_t i = inicio; i < fim; i++) {
+            size_t linha = (size_t)(i % trabalho->numLinhas);
+            FonteEntrada fonte = {NULL, trabalho->linhas[linha], 0, trabalho->tamanhos[linha]};
+            reiniciarSessao(&sessao);
+            sessao.saida.partida = trabalho->primeiraPartida + i;
+            trabalhador->vitorias += jogarPartida(&sessao, &fonte);
+            trabalhador->partidas++;
+        }
+    }
+
+    liberarSessao(&sessao);
+    return NULL;
+}
+
+/**
+ * @brief Modo em lote: cada linha não vazia do roteiro é uma partida completa,
+ * com os movimentos seguidos do acusado (ex.: "dds Berta"; um termo termina
+ * em ';', como em "i Jardim de Inverno;es Berta"). As partidas rodam
+ * sem saída (ou só com os eventos NDJSON, cada um com o número da partida) em
+ * um grupo de threads, cada uma com a sua Sessao sobre a mesma mansão, e ao
+ * final é exibida a vazão.
+ * @param caminho Arquivo de roteiros ("-" para a entrada padrão).
+ * @param repeticoes Quantas vezes o roteiro inteiro é repetido.
+ * @param numThreads Quantos trabalhadores rodam em paralelo.
+ * @param mansao A mansão explorada em todas as partidas.
+ * @param ndjson 1 para emitir os eventos das partidas no stdout (a vazão vai
+ * então para o stderr).
+ * @param diario Diário onde as partidas são registradas, ou NULL. A vazão
+ * inclui a espera pela gravação dos últimos registros.
+ * @return EXIT_SUCCESS ou EXIT_FAILURE.
+ */
+int executarLote(const char *caminho, long repeticoes, int numThreads, const Mansao *mansao, int ndjson, Diario *diario) {
+    size_t tamanho;
+    char *roteiro = lerArquivoInteiro(caminho, &tamanho);
+    if (roteiro == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    // Indexa as linhas com conteúdo (ignora vazias e comentários)
+    TrabalhoLote trabalho = {mansao, NULL, NULL, 0, 0, 0, ndjson ? SAIDA_NDJSON : SAIDA_SILENCIOSA, diario, 0};
+    size_t capacidade = 0;
+    for (size_t pos = 0; pos < tamanho; ) {
+        size_t fimLinha = pos;
+        while (fimLinha < tamanho && roteiro[fimLinha] != '\n') {
+            fimLinha++;
+        }
+        size_t p = pos;
+        while (p < fimLinha && isspace((unsigned char)roteiro[p])) {
+            p++;
+        }
+        if (p < fimLinha && roteiro[p] != '#') {
+            if (trabalho.numLinhas == capacidade) {
+                capacidade = capacidade ? capacidade * 2 : 64;
+                trabalho.linhas = (const char**)realloc(trabalho.linhas, capacidade * sizeof(char*));
+                trabalho.tamanhos = (size_t*)realloc(trabalho.tamanhos, capacidade * sizeof(size_t));
+                if (trabalho.linhas == NULL || trabalho.tamanhos == NULL) {
+                    perror("Erro ao alocar memoria para o roteiro");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            trabalho.linhas[trabalho.numLinhas] = roteiro + pos;
+            trabalho.tamanhos[trabalho.numLinhas] = fimLinha - pos;
+            trabalho.numLinhas++;
+        }
+        pos = fimLinha + 1;
+    }
+    trabalho.totalPartidas = repeticoes > 0 ? (uint64_t)trabalho.numLinhas * (uint64_t)repeticoes : 0;
+    if (diario != NULL) {
+        trabalho.primeiraPartida = reservarPartidas(diario, trabalho.totalPartidas);
+    }
+
+    if (numThreads < 1) {
+        numThreads = 1;
+    } else if (numThreads > MAX_TRABALHADORES) {
+        numThreads = MAX_TRABALHADORES;
+    }
+    if (mansao->sobDemanda != NULL && numThreads > 1) {
+        // O cache de salas não tem trava e a tabela de textos cresce durante o jogo
+        fprintf(stderr, "Mansão sob demanda: o lote roda em uma thread\n");
+        numThreads = 1;
+    }
+    Trabalhador *trabalhadores = (Trabalhador*)calloc((size_t)numThreads, sizeof(Trabalhador));
+    if (trabalhadores == NULL) {
+        perror("Erro ao alocar memoria para os trabalhadores");
+        exit(EXIT_FAILURE);
+    }
+
+    double inicio = agoraSegundos();
+    for (int t = 0; t < numThreads; t++) {
+        trabalhadores[t].trabalho = &trabalho;
+        if (pthread_create(&trabalhadores[t].thread, NULL, executarTrabalhador, &trabalhadores[t]) != 0) {
+            perror("Erro ao criar thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    long partidas = 0, vitorias = 0;
+    for (int t = 0; t < numThreads; t++) {
+        pthread_join(trabalhadores[t].thread, NULL);
+        partidas += trabalhadores[t].partidas;
+        vitorias += trabalhadores[t].vitorias;
+    }
+    if (diario != NULL) {
+        esperarDiario(diario);
+    }
+    double segundos = agoraSegundos() - inicio;
+
+    free(trabalhadores);
+    free(trabalho.linhas);
+    free(trabalho.tamanhos);
+    free(roteiro);
+
+    fprintf(ndjson ? stderr : stdout, "Lote: %ld partidas (%ld vitórias) em %.3f s com %d threads = %.0f partidas/s\n",
+            partidas, vitorias, segundos, numThreads, segundos > 0 ? partidas / segundos : 0.0);
+    if (diario != NULL) {
+        fprintf(ndjson ? stderr : stdout, "Diário: %llu registros em %llu gravações\n",
+                (unsigned long long)diario->registros, (unsigned long long)diario->gravacoes);
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE REPRODUÇÃO (Auditoria pelo diário) --------------------
+// -------------------------------------------------------------------
+
+// Um registro do diário na ordenação por partida
+typedef struct PosicaoRegistro {
+    uint64_t partida;
+    size_t pos;              // Deslocamento no arquivo (ordem de gravação)
+} PosicaoRegistro;
+
+/**
+ * @brief Comparador para qsort: por partida e, dentro dela, na ordem do arquivo.
+ */
+static int compararPosicoes(const void *a, const void *b) {
+    const PosicaoRegistro *x = (const PosicaoRegistro*)a, *y = (const PosicaoRegistro*)b;
+    if (x->partida != y->partida) {
+        return x->partida < y->partida ? -1 : 1;
+    }
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+/**
+ * @brief Compara um registro do diário com o próximo que a reprodução gerou.
+ * @param consumidos Bytes já conferidos no diário em memória (avança se igual).
+ * @return 1 se são iguais, 0 se divergem.
+ */
+static int conferirRegistro(const Diario *gerados, size_t *consumidos, const uint8_t *registro, size_t tamanho) {
+    if (gerados->usado - *consumidos < tamanho ||
+        memcmp(gerados->buffer + *consumidos, registro, tamanho) != 0) {
+        return 0;
+    }
+    *consumidos += tamanho;
+    return 1;
+}
+
+/**
+ * @brief Reconstrói as partidas de um diário: cada uma é jogada de novo com
+ * os comandos registrados, e tudo o que ela gera (salas, pistas, momentos,
+ * veredito) é comparado, byte a byte, com o que foi registrado.
+ * @param caminho O diário (.dqj).
+ * @param mansao A mansão das partidas (com as mesmas regras).
+ * @param arquivoSalvar Se não for NULL, a última partida reconstruída é salva
+ * nele como instantâneo (.dqs), para ser retomada.
+ * @return EXIT_SUCCESS se todas as partidas conferem, EXIT_FAILURE se alguma
+ * diverge ou se o diário está corrompido antes do fim.
+ */
+int reproduzirDiario(const char *caminho, const Mansao *mansao, const char *arquivoSalvar) {
+    static const char *nomesRegistro[] = {"inicio", "retomada", "comando", "fim da entrada",
+                                          "sala", "pista", "momento", "veredito"};
+    static const char *nomesEstado[] = {"explorando", "na acusação", "encerrada"};
+    int fd = open(caminho, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        perror("Erro ao abrir o diario");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return EXIT_FAILURE;
+    }
+    size_t tamanho = (size_t)info.st_size;
+    void *base = tamanho > 0 ? mmap(NULL, tamanho, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "%s: diario invalido: arquivo truncado\n", caminho);
+        return EXIT_FAILURE;
+    }
+    const uint8_t *dados = (const uint8_t*)base;
+    if (!conferirCabecalhoDiario(dados, tamanho, mansao, caminho)) {
+        munmap(base, tamanho);
+        return EXIT_FAILURE;
+    }
+
+    // Indexa os registros íntegros e os agrupa por partida
+    PosicaoRegistro *posicoes = NULL;
+    size_t numRegistros = 0, capacidade = 0;
+    size_t pos = sizeof(CabecalhoDiario);
+    RegistroDiario registro;
+    int lido;
+    while ((lido = lerRegistro(dados, tamanho, pos, &registro)) > 0) {
+        if (numRegistros == capacidade) {
+            capacidade = capacidade ? capacidade * 2 : 1024;
+            posicoes = (PosicaoRegistro*)realloc(posicoes, capacidade * sizeof(PosicaoRegistro));
+            if (posicoes == NULL) {
+                perror("Erro ao alocar memoria para o diario");
+                exit(EXIT_FAILURE);
+            }
+        }
+        posicoes[numRegistros].partida = registro.partida;
+        posicoes[numRegistros].pos = pos;
+        numRegistros++;
+        pos += sizeof(registro) + registro.tamanho;
+    }
+    int corrompido = lido < 0;
+    if (corrompido) {
+        // Reproduz o que vem antes, mas a auditoria falha: registros depois daqui se perderam
+        fprintf(stderr, "%s: diario corrompido: registro invalido no byte %zu, antes do fim do arquivo\n",
+                caminho, pos);
+    } else if (pos < tamanho) {
+        fprintf(stderr, "%s: %zu bytes de um registro incompleto no fim foram ignorados\n", caminho, tamanho - pos);
+    }
+    qsort(posicoes, numRegistros, sizeof(PosicaoRegistro), compararPosicoes);
+
+    Diario gerados;
+    abrirDiarioEmMemoria(&gerados);
+    Sessao sessao;
+    criarSessao(&sessao, mansao, &motorRegras);
+    configurarSaida(&sessao, SAIDA_SILENCIOSA, stdout);
+    sessao.diario = &gerados;
+
+    char comando[DIARIO_MAX_CARGA + 1];
+    uint64_t partidas = 0, reconstruidas = 0, divergentes = 0, incompletas = 0;
+    for (size_t inicio = 0, fim; inicio < numRegistros; inicio = fim) {
+        uint64_t partida = posicoes[inicio].partida;
+        for (fim = inicio; fim < numRegistros && posicoes[fim].partida == partida; fim++) {
+        }
+        reiniciarSessao(&sessao);
+        gerados.usado = 0;
+        sessao.saida.partida = partida;
+        sessao.estado = JOGO_FIM;
+
+        int iniciada = 0;
+        const char *problema = NULL; // NULL: a partida confere até aqui
+        size_t consumidos = 0, indice = inicio;
+        for (; indice < fim; indice++) {
+            const uint8_t *atual = dados + posicoes[indice].pos;
+            memcpy(&registro, atual, sizeof(registro));
+            size_t bytes = sizeof(registro) + registro.tamanho;
+            if (registro.tipo == REGISTRO_RETOMADA) {
+                if (!iniciada) {
+                    problema = "retomada de um instantâneo cujo início não está no diário";
+                    break;
+                }
+                continue; // Pausar e retomar não mudam o estado
+            }
+            if (registro.tipo == REGISTRO_INICIO || registro.tipo == REGISTRO_COMANDO ||
+                registro.tipo == REGISTRO_FIM_DA_ENTRADA) {
+                // Uma entrada nova: tudo o que a anterior gerou já deve ter aparecido
+                if (consumidos != gerados.usado) {
+                    problema = "a reprodução gerou registros que o diário não tem";
+                    break;
+                }
+                if (registro.tipo == REGISTRO_INICIO) {
+                    if (iniciada) {
+                        problema = "a partida começa duas vezes";
+                        break;
+                    }
+                    iniciada = 1;
+                    iniciarPartida(&sessao);
+                } else if (!iniciada) {
+                    problema = "comandos antes do início da partida";
+                    break;
+                } else if (registro.tipo == REGISTRO_COMANDO) {
+                    memcpy(comando, atual + sizeof(registro), registro.tamanho);
+                    comando[registro.tamanho] = '\0';
+                    passo(&sessao, comando);
+                } else {
+                    passo(&sessao, NULL);
+                }
+            }
+            if (!conferirRegistro(&gerados, &consumidos, atual, bytes)) {
+                problema = "o registro difere do que a reprodução gerou";
+                break;
+            }
+        }
+        int completa = problema == NULL && consumidos == gerados.usado;
+
+        partidas++;
+        if (problema != NULL && iniciada) {
+            divergentes++;
+        } else if (!completa) {
+            incompletas++;
+        } else {
+            reconstruidas++;
+        }
+        if (partidas <= DIARIO_PARTIDAS_LISTADAS) {
+            printf("Partida %llu: ", (unsigned long long)partida);
+            if (problema != NULL) {
+                memcpy(&registro, dados + posicoes[indice < fim ? indice : fim - 1].pos, sizeof(registro));
+                printf("%s no registro %zu (%s)\n", iniciada ? "diverge" : "incompleta",
+                       indice - inicio + 1, nomesRegistro[registro.tipo]);
+            } else {
+                printf("%s em **%s**, %d pista%s", nomesEstado[sessao.estado],
+                       textoDe(mansaoNome(mansao, sessao.salaAtual)), sessao.totalPistasColetadas,
+                       sessao.totalPistasColetadas == 1 ? "" : "s");
+                if (sessao.estado == JOGO_FIM) {
+                    printf(", %s", sessao.vitoria ? "vitória" : "fracasso");
+                }
+                printf("%s\n", completa ? "" : " (o diário termina no meio de um passo)");
+            }
+        }
+        if (arquivoSalvar != NULL && fim == numRegistros && problema == NULL && iniciada) {
+            if (salvarSessao(&sessao, arquivoSalvar)) {
+                printf("💾 Partida %llu salva em %s.\n", (unsigned long long)partida, arquivoSalvar);
+            }
+        }
+    }
+    if (partidas > DIARIO_PARTIDAS_LISTADAS) {
+        printf("... e mais %llu partidas\n", (unsigned long long)(partidas - DIARIO_PARTIDAS_LISTADAS));
+    }
+    printf("Diário: %zu registros, %llu partidas: %llu reconstruídas, %llu divergentes, %llu incompletas\n",
+           numRegistros, (unsigned long long)partidas, (unsigned long long)reconstruidas,
+           (unsigned long long)divergentes, (unsigned long long)incompletas);
+
+    liberarSessao(&sessao);
+    fecharDiario(&gerados);
+    free(posicoes);
+    munmap(base, tamanho);
+    return divergentes > 0 || corrompido ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DO RESOLVEDOR (Busca paralela por suspeito) --------------------
+// -------------------------------------------------------------------
+
+// Chegada de uma primeira pista a uma sala na busca de várias origens
+typedef struct ChegadaBusca {
+    uint32_t distancia;          // Movimentos desde a entrada
+    IdTexto pista;               // Primeira pista coletada (a da sala de origem)
+    uint32_t anterior;           // Chegada de onde veio, ou SEM_SALA na origem
+} ChegadaBusca;
+
+typedef struct Resolvedor {
+    const Mansao *mansao;
+    uint32_t numSuspeitos;
+    uint32_t *suspeitoDaSala;    // Índice do suspeito da pista da sala, ou SEM_SUSPEITO
+    uint8_t *possivel;           // Suspeito tem ao menos 2 pistas distintas na mansão
+    uint32_t *profundidade;      // Distância da entrada a cada sala (árvore de largura)
+    uint32_t proximoSuspeito;    // Próximo suspeito a resolver (atômico)
+    uint32_t *movimentos;        // Tamanho da solução de cada suspeito
+    char **roteiros;             // Solução de cada suspeito, ou NULL se inalcançável
+} Resolvedor;
+
+typedef struct TrabalhadorBusca {
+    pthread_t thread;
+    Resolvedor *resolvedor;
+    uint32_t inicio, fim;        // Faixa de salas da fase de atribuição
+    // Memória da busca, reaproveitada entre suspeitos (2 chegadas por sala)
+    ChegadaBusca *chegadas;
+    uint8_t *numChegadas;
+    uint32_t *fila;
+    uint64_t *origens;           // (profundidade << 32) | sala
+    IdSala *caminho;
+} TrabalhadorBusca;
+
+static void* alocarBusca(size_t bytes) {
+    void *memoria = malloc(bytes);
+    if (memoria == NULL) {
+        perror("Erro ao alocar memoria para o resolvedor");
+        exit(EXIT_FAILURE);
+    }
+    return memoria;
+}
+
+static int compararOrigens(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Anota que a primeira pista 'pista' chega à sala com 'distancia'
+ * movimentos. Cada sala guarda só as 2 primeiras chegadas de pistas distintas:
+ * uma delas sempre difere da pista da própria sala, que é o que interessa.
+ * @return O índice da chegada, ou SEM_SALA se ela não traz nada novo.
+ */
+static uint32_t anotarChegada(TrabalhadorBusca *t, IdSala sala, uint32_t distancia, IdTexto pista, uint32_t anterior) {
+    uint32_t base = sala * 2;
+    for (uint32_t j = 0; j < t->numChegadas[sala]; j++) {
+        if (t->chegadas[base + j].pista == pista) {
+            return SEM_SALA;
+        }
+    }
+    if (t->numChegadas[sala] == 2) {
+        return SEM_SALA;
+    }
+    uint32_t indice = base + t->numChegadas[sala]++;
+    t->chegadas[indice] = (ChegadaBusca){distancia, pista, anterior};
+    return indice;
+}
+
+/**
+ * @brief Caminho mais curto que condena 'suspeito': da entrada até uma sala 'a'
+ * com pista dele e de 'a' até uma sala 'b' com outra pista dele. É uma busca em
+ * largura com várias origens (cada 'a', que já parte com a distância da entrada
+ * até ela) que leva adiante a pista de origem; a primeira sala do suspeito
+ * alcançada com pista diferente da sua fecha a solução.
+ */
+static void resolverSuspeito(Resolvedor *r, TrabalhadorBusca *t, uint32_t suspeito) {
+    const Mansao *mansao = r->mansao;
+    uint32_t numOrigens = 0;
+    for (IdSala sala = 0; sala < mansao->numSalas; sala++) {
+        if (r->suspeitoDaSala[sala] == suspeito) {
+            t->origens[numOrigens++] = ((uint64_t)r->profundidade[sala] << 32) | sala;
+        }
+    }
+    qsort(t->origens, numOrigens, sizeof(uint64_t), compararOrigens);
+    memset(t->numChegadas, 0, mansao->numSalas);
+
+    // As origens entram na ordem da distância, intercaladas com a fila
+    uint32_t solucao = SEM_SALA;
+    uint32_t proximaOrigem = 0, inicio = 0, fim = 0;
+    while (proximaOrigem < numOrigens || inicio < fim) {
+        uint32_t chegada;
+        if (proximaOrigem < numOrigens &&
+            (inicio == fim || (uint32_t)(t->origens[proximaOrigem] >> 32) <= t->chegadas[t->fila[inicio]].distancia)) {
+            IdSala sala = (IdSala)(t->origens[proximaOrigem] & 0xFFFFFFFFu);
+            chegada = anotarChegada(t, sala, (uint32_t)(t->origens[proximaOrigem] >> 32),
+                                    mansaoPista(mansao, sala), SEM_SALA);
+            proximaOrigem++;
+            if (chegada == SEM_SALA) {
+                continue;
+            }
+        } else {
+            chegada = t->fila[inicio++];
+        }
+
+        IdSala sala = chegada / 2;
+        ChegadaBusca atual = t->chegadas[chegada];
+        if (r->suspeitoDaSala[sala] == suspeito && atual.pista != mansaoPista(mansao, sala)) {
+            solucao = chegada;
+            break;
+        }
+        const SalaQuente *quente = &mansao->quentes[sala];
+        for (uint32_t k = 0; k < quente->numSaidas; k++) {
+            uint32_t nova = anotarChegada(t, mansao->saidas[quente->primeiraSaida + k],
+                                          atual.distancia + 1, atual.pista, chegada);
+            if (nova != SEM_SALA) {
+                t->fila[fim++] = nova;
+            }
+        }
+    }
+    if (solucao == SEM_SALA) {
+        return;
+    }
+
+    // Volta pela busca até a origem e, dela, pelos pais das rotas até a entrada
+    uint32_t distancia = t->chegadas[solucao].distancia;
+    uint32_t p = distancia + 1;
+    uint32_t chegada = solucao;
+    while (t->chegadas[chegada].anterior != SEM_SALA) {
+        t->caminho[--p] = chegada / 2;
+        chegada = t->chegadas[chegada].anterior;
+    }
+    for (IdSala sala = chegada / 2; p > 0; sala = mansao->rotas[sala].pai) {
+        t->caminho[--p] = sala;
+    }
+
+    // Roteiro no formato do modo em lote; uma saída além da nona vira "i <cômodo>;"
+    size_t capacidade = 64, tamanho = 0;
+    char *roteiro = (char*)alocarBusca(capacidade);
+    for (uint32_t q = 0; q < distancia; q++) {
+        uint32_t k = 0;
+        while (mansaoSaida(mansao, t->caminho[q], k) != t->caminho[q + 1]) {
+            k++;
+        }
+        const char *nome = textoDe(mansaoNome(mansao, t->caminho[q + 1]));
+        size_t necessario = tamanho + strlen(nome) + 8;
+        if (necessario > capacidade) {
+            capacidade = necessario * 2;
+            roteiro = (char*)realloc(roteiro, capacidade);
+            if (roteiro == NULL) {
+                perror("Erro ao alocar memoria para o resolvedor");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (k < MAX_ATALHOS_SAIDA) {
+            roteiro[tamanho++] = k == 0 ? 'e' : k == 1 ? 'd' : (char)('1' + k);
+        } else {
+            tamanho += (size_t)sprintf(roteiro + tamanho, " i %s;", nome);
+        }
+    }
+    roteiro[tamanho] = '\0';
+    r->movimentos[suspeito] = distancia;
+    r->roteiros[suspeito] = roteiro;
+}
+
+/**
+ * @brief Segunda fase: cada trabalhador pega o próximo suspeito ainda não
+ * resolvido até acabarem.
+ */
+static void* executarBusca(void *argumento) {
+    TrabalhadorBusca *trabalhador = (TrabalhadorBusca*)argumento;
+    Resolvedor *r = trabalhador->resolvedor;
+    uint32_t numSalas = r->mansao->numSalas;
+    trabalhador->chegadas = (ChegadaBusca*)alocarBusca((size_t)numSalas * 2 * sizeof(ChegadaBusca));
+    trabalhador->numChegadas = (uint8_t*)alocarBusca(numSalas);
+    trabalhador->fila = (uint32_t*)alocarBusca((size_t)numSalas * 2 * sizeof(uint32_t));
+    trabalhador->origens = (uint64_t*)alocarBusca((size_t)numSalas * sizeof(uint64_t));
+    trabalhador->caminho = (IdSala*)alocarBusca(((size_t)numSalas * 2 + 1) * sizeof(IdSala));
+
+    while (1) {
+        uint32_t s = __atomic_fetch_add(&r->proximoSuspeito, 1, __ATOMIC_RELAXED);
+        if (s >= r->numSuspeitos) {
+            break;
+        }
+        if (r->possivel[s]) {
+            resolverSuspeito(r, trabalhador, s);
+        }
+    }
+
+    free(trabalhador->chegadas);
+    free(trabalhador->numChegadas);
+    free(trabalhador->fila);
+    free(trabalhador->origens);
+    free(trabalhador->caminho);
+    return NULL;
+}
+
+/**
+ * @brief Primeira fase: atribui o suspeito da pista de cada sala de uma faixa.
+ */
+static void* atribuirFaixa(void *argumento) {
+    TrabalhadorBusca *trabalhador = (TrabalhadorBusca*)argumento;
+    Resolvedor *r = trabalhador->resolvedor;
+    PlacarSuspeitos placar;
+    criarPlacar(&motorRegras, &placar);
+    for (uint32_t sala = trabalhador->inicio; sala < trabalhador->fim; sala++) {
+        IdTexto pista = mansaoPista(r->mansao, sala);
+        r->suspeitoDaSala[sala] = pista == TEXTO_VAZIO ? SEM_SUSPEITO
+                                  : atribuirSuspeito(&motorRegras, textoDe(pista), &placar);
+    }
+    liberarPlacar(&placar);
+    return NULL;
+}
+
+/**
+ * @brief Resolvedor: para cada suspeito, a sequência de movimentos mais curta a
+ * partir da entrada que junta as 2 pistas distintas exigidas no julgamento.
+ * Como as portas valem nos dois sentidos, voltar por um cômodo é permitido e a
+ * solução pode passar mais de uma vez pela mesma sala. A distância da entrada
+ * vem da árvore de largura das rotas; depois cada suspeito é resolvido por uma
+ * busca de várias origens independente, com os suspeitos repartidos entre os
+ * trabalhadores. O resultado não depende do número de threads.
+ * Cada solução sai no formato de roteiro do modo em lote (ex.: "dds Berta").
+ * @param mansao A mansão a resolver.
+ * @param numThreads Quantos trabalhadores usar.
+ * @return EXIT_SUCCESS.
+ */
+int resolverMansao(const Mansao *mansao, int numThreads) {
+    if (numThreads < 1) {
+        numThreads = 1;
+    } else if (numThreads > MAX_TRABALHADORES) {
+        numThreads = MAX_TRABALHADORES;
+    }
+    Resolvedor r;
+    memset(&r, 0, sizeof(r));
+    r.mansao = mansao;
+    r.numSuspeitos = motorRegras.numSuspeitos;
+    r.suspeitoDaSala = (uint32_t*)alocarBusca(mansao->numSalas * sizeof(uint32_t));
+    r.profundidade = (uint32_t*)alocarBusca(mansao->numSalas * sizeof(uint32_t));
+    r.possivel = (uint8_t*)calloc(r.numSuspeitos + 1, 1);
+    r.movimentos = (uint32_t*)calloc(r.numSuspeitos + 1, sizeof(uint32_t));
+    r.roteiros = (char**)calloc(r.numSuspeitos + 1, sizeof(char*));
+    TrabalhadorBusca *trabalhadores = (TrabalhadorBusca*)calloc((size_t)numThreads, sizeof(TrabalhadorBusca));
+    IdTexto *primeira = (IdTexto*)alocarBusca((r.numSuspeitos + 1) * sizeof(IdTexto));
+    if (r.possivel == NULL || r.movimentos == NULL || r.roteiros == NULL || trabalhadores == NULL) {
+        perror("Erro ao alocar memoria para o resolvedor");
+        exit(EXIT_FAILURE);
+    }
+
+    double inicio = agoraSegundos();
+
+    // Fase 1: suspeito de cada sala, em faixas paralelas
+    for (int t = 0; t < numThreads; t++) {
+        trabalhadores[t].resolvedor = &r;
+        trabalhadores[t].inicio = (uint32_t)((uint64_t)mansao->numSalas * t / numThreads);
+        trabalhadores[t].fim = (uint32_t)((uint64_t)mansao->numSalas * (t + 1) / numThreads);
+        if (pthread_create(&trabalhadores[t].thread, NULL, atribuirFaixa, &trabalhadores[t]) != 0) {
+            perror("Erro ao criar thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int t = 0; t < numThreads; t++) {
+        pthread_join(trabalhadores[t].thread, NULL);
+    }
+
+    // Suspeitos com menos de 2 pistas distintas na mansão inteira nunca são condenados
+    for (uint32_t s = 0; s < r.numSuspeitos; s++) {
+        primeira[s] = TEXTO_INEXISTENTE;
+    }
+    uint32_t numPossiveis = 0;
+    for (uint32_t sala = 0; sala < mansao->numSalas; sala++) {
+        uint32_t s = r.suspeitoDaSala[sala];
+        if (s == SEM_SUSPEITO || r.possivel[s]) {
+            continue;
+        }
+        if (primeira[s] == TEXTO_INEXISTENTE) {
+            primeira[s] = mansaoPista(mansao, sala);
+        } else if (primeira[s] != mansaoPista(mansao, sala)) {
+            r.possivel[s] = 1;
+            numPossiveis++;
+        }
+    }
+
+    // Distância da entrada: os filhos das rotas formam a árvore de largura
+    if (numPossiveis > 0) {
+        uint32_t *fila = (uint32_t*)alocarBusca(mansao->numSalas * sizeof(uint32_t));
+        uint32_t fim = 0;
+        fila[fim++] = SALA_ENTRADA;
+        r.profundidade[SALA_ENTRADA] = 0;
+        for (uint32_t i = 0; i < fim; i++) {
+            const RotaSala *rota = &mansao->rotas[fila[i]];
+            for (uint32_t k = 0; k < rota->numFilhos; k++) {
+                IdSala filho = mansao->filhosRota[rota->primeiroFilho + k];
+                r.profundidade[filho] = r.profundidade[fila[i]] + 1;
+                fila[fim++] = filho;
+            }
+        }
+        free(fila);
+    }
+
+    // Fase 2: um suspeito por vez para cada trabalhador
+    int numBuscas = numThreads < (int)numPossiveis ? numThreads : (int)numPossiveis;
+    for (int t = 0; t < numBuscas; t++) {
+        if (pthread_create(&trabalhadores[t].thread, NULL, executarBusca, &trabalhadores[t]) != 0) {
+            perror("Erro ao criar thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int t = 0; t < numBuscas; t++) {
+        pthread_join(trabalhadores[t].thread, NULL);
+    }
+    double segundos = agoraSegundos() - inicio;
+
+    printf("Resolvedor: %u salas, %d threads, %.3f s\n", mansao->numSalas, numThreads, segundos);
+    for (uint32_t s = 0; s < r.numSuspeitos; s++) {
+        const char *nome = textoDe(motorRegras.suspeitos[s]);
+        if (r.roteiros[s] == NULL) {
+            printf("  %s: inalcançável\n", nome);
+            continue;
+        }
+        printf("  %s: %u movimento%s -> %ss %s\n", nome, r.movimentos[s],
+               r.movimentos[s] == 1 ? "" : "s", r.roteiros[s], nome);
+        free(r.roteiros[s]);
+    }
+
+    free(primeira);
+    free(trabalhadores);
+    free(r.roteiros);
+    free(r.movimentos);
+    free(r.possivel);
+    free(r.profundidade);
+    free(r.suspeitoDaSala);
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DE BENCHMARK --------------------
+// -------------------------------------------------------------------
+
+// Distribuições de chaves do benchmark
+typedef enum {
+    CHAVES_ALEATORIAS,  // Conteúdo e ordem aleatórios
+    CHAVES_ORDENADAS,   // Inseridas em ordem crescente
+    CHAVES_COLISOES,    // Mesmo tag de 7 bits na hash e prefixo longo em comum
+    NUM_DISTRIBUICOES
+} DistribuicaoChaves;
+
+static const char *nomeDistribuicao[NUM_DISTRIBUICOES] = {
+    [CHAVES_ALEATORIAS] = "aleatoria",
+    [CHAVES_ORDENADAS] = "ordenada",
+    [CHAVES_COLISOES] = "colisoes",
+};
+
+/**
+ * @brief Gerador pseudoaleatório splitmix64 (determinístico a partir da semente).
+ */
+static uint64_t proximoAleatorio(uint64_t *estado) {
+    uint64_t z = (*estado += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Gera e interna n pistas na distribuição pedida.
+ * Nas colisões, só entram textos cujo hash tem o tag 0: todos disputam os
+ * mesmos bytes de controle na tabela hash, e o prefixo comum anula o
+ * prefixo inline da B-tree.
+ * @return Os ids, na ordem de inserção (liberar com free).
+ */
+static IdTexto* gerarChaves(size_t n, DistribuicaoChaves distribuicao, uint64_t *semente) {
+    IdTexto *chaves = (IdTexto*)malloc(n * sizeof(IdTexto));
+    if (chaves == NULL) {
+        perror("Erro ao alocar memoria para o benchmark");
+        exit(EXIT_FAILURE);
+    }
+    char texto[96];
+    uint64_t contador = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (distribuicao == CHAVES_ALEATORIAS) {
+            snprintf(texto, sizeof(texto), "pista %016llx", (unsigned long long)proximoAleatorio(semente));
+        } else if (distribuicao == CHAVES_ORDENADAS) {
+            snprintf(texto, sizeof(texto), "pista %012zu", i);
+        } else {
+            do {
+                snprintf(texto, sizeof(texto), "Uma pista muito parecida com todas as outras, numero %012llu",
+                         (unsigned long long)contador++);
+            } while ((funcaoHash(texto) & 0x7F) != 0);
+        }
+        chaves[i] = internarTexto(texto);
+    }
+    return chaves;
+}
+
+/**
+ * @brief Imprime uma linha do relatório: ns/op, vazão e o pico de memória do
+ * processo (o de uma só rodada, porque cada uma tem o seu; ver executarBenchmark).
+ */
+static void relatarMedicao(const char *operacao, size_t operacoes, double segundos) {
+    struct rusage uso;
+    getrusage(RUSAGE_SELF, &uso);
+    double nsPorOperacao = operacoes > 0 ? segundos * 1e9 / (double)operacoes : 0.0;
+    printf("  %-24s %10zu ops %10.1f ns/op %14.0f ops/s   pico %8ld KiB\n", operacao, operacoes,
+           nsPorOperacao, segundos > 0 ? (double)operacoes / segundos : 0.0, uso.ru_maxrss);
+}
+
+/**
+ * @brief Mede as operações centrais do jogo para n chaves de uma distribuição.
+ */
+static void medirNucleo(size_t n, DistribuicaoChaves distribuicao, uint64_t *semente) {
+    printf("== n = %zu, chaves %s ==\n", n, nomeDistribuicao[distribuicao]);
+    IdTexto *chaves = gerarChaves(n, distribuicao, semente);
+    IdTexto suspeito = motorRegras.numSuspeitos > 0 ? motorRegras.suspeitos[0] : motorRegras.desconhecido;
+
+    // funcaoHash sobre os textos já gerados
+    volatile uint64_t acumulado = 0;
+    double inicio = agoraSegundos();
+    for (size_t i = 0; i < n; i++) {
+        acumulado ^= funcaoHash(textoDe(chaves[i]));
+    }
+    relatarMedicao("funcaoHash", n, agoraSegundos() - inicio);
+
+    // Tabela hash pista -> suspeito
+    TabelaHash tabela;
+    inicializarHash(&tabela);
+    inicio = agoraSegundos();
+    for (size_t i = 0; i < n; i++) {
+        inserirNaHash(&tabela, chaves[i], suspeito);
+    }
+    relatarMedicao("inserirNaHash", n, agoraSegundos() - inicio);
+
+    inicio = agoraSegundos();
+    for (size_t i = 0; i < n; i++) {
+        acumulado ^= encontrarSuspeito(&tabela, chaves[i]);
+    }
+    relatarMedicao("encontrarSuspeito", n, agoraSegundos() - inicio);
+    liberarHash(&tabela);
+
+    // B-tree de pistas
+    Arena arena = {0};
+    PistaColetada *raiz = NULL;
+    IdTexto anterior;
+    inicio = agoraSegundos();
+    for (size_t i = 0; i < n; i++) {
+        raiz = inserirPista(&arena, raiz, chaves[i], suspeito, &anterior);
+    }
+    relatarMedicao("inserirPista", n, agoraSegundos() - inicio);
+
+    Sessao silenciosa;
+    memset(&silenciosa, 0, sizeof(silenciosa));
+    silenciosa.saida.modo = SAIDA_SILENCIOSA;
+    inicio = agoraSegundos();
+    listarPistasColetadas(&silenciosa, raiz);
+    relatarMedicao("listarPistasColetadas", n, agoraSegundos() - inicio);
+    arenaDestruir(&arena);
+
+    // Exploração: mansão completa de n salas, cada uma com uma das pistas,
+    // percorrida em partidas aleatórias até uma folha
+    Sala **salas = (Sala**)malloc(n * sizeof(Sala*));
+    if (salas == NULL) {
+        perror("Erro ao alocar memoria para o benchmark");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++) {
+        salas[i] = criarSala(textoDe(chaves[i]), textoDe(chaves[i]));
+    }
+    for (size_t i = 1; i < n; i++) {
+        conectarSalas(salas[(i - 1) / 2], salas[i]);
+    }
+    Mansao mansao;
+    compilarMansao(salas[0], &mansao);
+    free(salas);
+
+    Sessao sessao;
+    criarSessao(&sessao, &mansao, &motorRegras);
+    configurarSaida(&sessao, SAIDA_SILENCIOSA, stdout);
+    size_t passos = 0;
+    size_t minimo = n > BENCH_MIN_PASSOS ? n : BENCH_MIN_PASSOS;
+    inicio = agoraSegundos();
+    while (passos < minimo) {
+        reiniciarSessao(&sessao);
+        iniciarPartida(&sessao);
+        while (sessao.estado == JOGO_EXPLORANDO) {
+            // Os filhos vêm antes da volta ao pai, então 'e' e 'd' sempre descem
+            if (mansao.rotas[sessao.salaAtual].numFilhos == 0) {
+                passo(&sessao, "s");
+            } else {
+                passo(&sessao, mansao.rotas[sessao.salaAtual].numFilhos > 1 && proximoAleatorio(semente) & 1 ? "d" : "e");
+            }
+            passos++;
+        }
+        passo(&sessao, "Alfredo");
+        passos++;
+    }
+    relatarMedicao("passo (exploracao)", passos, agoraSegundos() - inicio);
+    liberarSessao(&sessao);
+
+    free(chaves);
+    (void)acumulado;
+}
+
+/**
+ * @brief Modo benchmark: mede hash, B-tree e exploração para vários tamanhos e distribuições.
+ * @param tamanho Número de chaves, ou 0 para a série padrão (10 a 1.000.000).
+ * @param distribuicao Nome da distribuição, ou NULL para todas.
+ * @return EXIT_SUCCESS ou EXIT_FAILURE.
+ */
+int executarBenchmark(size_t tamanho, const char *distribuicao) {
+    static const size_t tamanhosPadrao[] = {10, 1000, 100000, 1000000};
+    size_t numTamanhos = sizeof(tamanhosPadrao) / sizeof(tamanhosPadrao[0]);
+    const size_t *tamanhos = tamanhosPadrao;
+    if (tamanho > 0) {
+        if (tamanho > BENCH_MAX_CHAVES) {
+            fprintf(stderr, "Tamanho maximo do benchmark: %d\n", BENCH_MAX_CHAVES);
+            return EXIT_FAILURE;
+        }
+        tamanhos = &tamanho;
+        numTamanhos = 1;
+    }
+
+    int escolhida = -1;
+    if (distribuicao != NULL) {
+        for (int d = 0; d < NUM_DISTRIBUICOES; d++) {
+            if (strcmp(distribuicao, nomeDistribuicao[d]) == 0) {
+                escolhida = d;
+            }
+        }
+        if (escolhida < 0) {
+            fprintf(stderr, "Distribuicao desconhecida: %s (use aleatoria, ordenada ou colisoes)\n", distribuicao);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Cada rodada num processo filho: os textos internados e a mansão da
+    // rodada somem com ele, e o pico de memória (um máximo que nunca desce)
+    // é só o dela, não o acumulado das anteriores. As métricas da rodada
+    // voltam ao pai por um pipe
+    int status = EXIT_SUCCESS;
+    for (size_t t = 0; t < numTamanhos; t++) {
+        for (int d = 0; d < NUM_DISTRIBUICOES; d++) {
+            if (escolhida >= 0 && escolhida != d) {
+                continue;
+            }
+            uint64_t semente = 42 + t * NUM_DISTRIBUICOES + (uint64_t)d;
+            METRICA(int canal[2];
+                    if (pipe(canal) != 0) {
+                        perror("Erro ao criar canal das metricas");
+                        exit(EXIT_FAILURE);
+                    })
+            fflush(stdout);
+            pid_t filho = fork();
+            if (filho < 0) {
+                perror("Erro ao criar processo do benchmark");
+                exit(EXIT_FAILURE);
+            }
+            if (filho == 0) {
+                METRICA(memset(&metricas, 0, sizeof(metricas));) // Só o que esta rodada contar
+                medirNucleo(tamanhos[t], (DistribuicaoChaves)d, &semente);
+                METRICA(escreverTudo(canal[1], (const uint8_t*)&metricas, sizeof(metricas));)
+                fflush(stdout);
+                _exit(EXIT_SUCCESS);
+            }
+            METRICA(close(canal[1]);
+                    Metricas parcial;
+                    if (read(canal[0], &parcial, sizeof(parcial)) == (ssize_t)sizeof(parcial)) {
+                        juntarMetricas(&parcial);
+                    }
+                    close(canal[0]);)
+            int estado;
+            if (waitpid(filho, &estado, 0) < 0 || !WIFEXITED(estado) || WEXITSTATUS(estado) != EXIT_SUCCESS) {
+                fprintf(stderr, "Rodada n = %zu, chaves %s falhou\n", tamanhos[t], nomeDistribuicao[d]);
+                status = EXIT_FAILURE;
+            }
+        }
+    }
+    return status;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÕES DO GERADOR DE MANSÕES --------------------
+// -------------------------------------------------------------------
+
+// Forma da mansão gerada. Tudo o que se sabe de uma sala (nome, pista e
+// quantas salas novas ela abre) vem de um sorteio que só depende da semente
+// e do índice dela: o gerador não guarda nada por sala e a mesma semente
+// sempre dá a mesma mansão.
+typedef struct ParametrosGerador {
+    uint32_t numSalas;
+    uint32_t profundidade;   // Nível máximo (a entrada é o nível 0)
+    uint32_t minRamos;       // Cada sala abre de minRamos a maxRamos salas novas
+    uint32_t maxRamos;
+    uint32_t densidade;      // Porcentagem de salas com pista
+    uint64_t semente;
+    uint32_t *mistura;       // Peso de cada suspeito nas pistas; o último é o das pistas neutras
+    uint32_t totalMistura;
+    IdTexto *palavras;       // Palavras-chave das regras, agrupadas por suspeito
+    uint32_t *inicioPalavras; // Faixa de cada suspeito em 'palavras' (numSuspeitos + 1)
+} ParametrosGerador;
+
+// Sala entregue pelo gerador, em ordem de largura. As salas novas que ela
+// abre são as de índice [primeiroFilho, primeiroFilho + numFilhos).
+typedef struct SalaGerada {
+    IdSala indice;
+    IdSala primeiroFilho;
+    uint32_t numFilhos;
+    const char *nome;
+    const char *pista;       // "" se a sala não tem pista
+} SalaGerada;
+
+// Destino das salas geradas: a mansão em memória ou um arquivo de texto
+typedef void (*ReceptorSalas)(void *contexto, const ParametrosGerador *parametros, const SalaGerada *sala);
+
+// Canais de sorteio de uma sala (cada um é um número independente)
+enum { SORTEIO_NOME, SORTEIO_PISTA, SORTEIO_RAMOS };
+
+static const char *tiposDeSala[] = {
+    "Biblioteca", "Cozinha", "Quarto", "Adega", "Sótão", "Galeria", "Capela", "Estufa",
+    "Escritório", "Despensa", "Salão", "Corredor", "Porão", "Lavanderia", "Varanda", "Oficina",
+};
+static const char *modelosPistaSuspeito[] = {
+    "Um indício de %s em %s", "Sinais de %s no chão de %s", "Restos de %s esquecidos em %s",
+};
+static const char *modelosPistaNeutra[] = {
+    "Poeira acumulada em %s", "Uma janela entreaberta em %s", "Marcas antigas no chão de %s",
+};
+
+static uint64_t sorteioDaSala(uint64_t semente, IdSala sala, uint32_t canal) {
+    uint64_t estado = semente ^ (((uint64_t)sala << 2) | canal);
+    return proximoAleatorio(&estado);
+}
+
+static void nomeDaSala(const ParametrosGerador *p, IdSala sala, char *nome, size_t tamanho) {
+    if (sala == SALA_ENTRADA) {
+        snprintf(nome, tamanho, "Saguão de Entrada");
+        return;
+    }
+    uint64_t sorteio = sorteioDaSala(p->semente, sala, SORTEIO_NOME);
+    size_t numTipos = sizeof(tiposDeSala) / sizeof(tiposDeSala[0]);
+    snprintf(nome, tamanho, "%s %u", tiposDeSala[sorteio % numTipos], sala);
+}
+
+/**
+ * @brief Sorteia a pista de uma sala: nenhuma, uma com a palavra-chave de uma
+ * regra do suspeito sorteado pela mistura, ou uma neutra.
+ */
+static void pistaDaSala(const ParametrosGerador *p, IdSala sala, const char *nome, char *pista, size_t tamanho) {
+    uint64_t sorteio = sorteioDaSala(p->semente, sala, SORTEIO_PISTA);
+    pista[0] = '\0';
+    if (sorteio % 100 >= p->densidade || p->totalMistura == 0) {
+        return;
+    }
+    uint32_t alvo = (uint32_t)((sorteio >> 8) % p->totalMistura);
+    uint32_t s = 0;
+    while (alvo >= p->mistura[s]) {
+        alvo -= p->mistura[s++];
+    }
+    uint32_t numPalavras = s < motorRegras.numSuspeitos ? p->inicioPalavras[s + 1] - p->inicioPalavras[s] : 0;
+    if (numPalavras == 0) {
+        const char *modelo = modelosPistaNeutra[(sorteio >> 40) % 3];
+        snprintf(pista, tamanho, modelo, nome);
+    } else {
+        IdTexto palavra = p->palavras[p->inicioPalavras[s] + (uint32_t)((sorteio >> 32) % numPalavras)];
+        const char *modelo = modelosPistaSuspeito[(sorteio >> 40) % 3];
+        snprintf(pista, tamanho, modelo, textoDe(palavra), nome);
+    }
+}
+
+/**
+ * @brief Gera a mansão sala por sala, em ordem de largura, entregando cada uma
+ * ao receptor assim que ela fica pronta. Uma sala abaixo do nível máximo abre
+ * de minRamos a maxRamos salas novas; a última sala pendente abre ao menos
+ * uma, para a mansão só parar antes de 'numSalas' se bater na profundidade
+ * máxima.
+ * @return Quantas salas foram geradas.
+ */
+uint32_t gerarMansao(const ParametrosGerador *p, ReceptorSalas receptor, void *contexto) {
+    char nome[64], pista[MAX_LINHA_MAPA / 2];
+    uint32_t nivel = 0, fimDoNivel = 1, proxima = 1;
+    for (IdSala sala = 0; sala < proxima; sala++) {
+        if (sala == fimDoNivel) {
+            nivel++;
+            fimDoNivel = proxima;
+        }
+        uint32_t numFilhos = 0;
+        if (nivel < p->profundidade && proxima < p->numSalas) {
+            numFilhos = p->minRamos + (uint32_t)(sorteioDaSala(p->semente, sala, SORTEIO_RAMOS)
+                                                 % (p->maxRamos - p->minRamos + 1));
+            if (numFilhos == 0 && sala + 1 == proxima) {
+                numFilhos = 1;
+            }
+            if (numFilhos > p->numSalas - proxima) {
+                numFilhos = p->numSalas - proxima;
+            }
+        }
+        nomeDaSala(p, sala, nome, sizeof(nome));
+        pistaDaSala(p, sala, nome, pista, sizeof(pista));
+        SalaGerada gerada = {sala, proxima, numFilhos, nome, pista};
+        receptor(contexto, p, &gerada);
+        proxima += numFilhos;
+    }
+    return proxima;
+}
+
+// Mansão compacta sendo preenchida direto pelo gerador
+typedef struct ConstrucaoMansao {
+    SalaQuente *quentes;
+    SalaFria *frias;
+    IdSala *saidas;
+    uint32_t numSaidas;
+    IdSala pai;              // Cursor: pai da sala sendo recebida
+} ConstrucaoMansao;
+
+/**
+ * @brief Receptor que escreve a sala nos arrays da mansão, no mesmo layout de
+ * compilarMansao: primeiro as salas novas que ela abre, depois a volta ao pai.
+ */
+static void receberNaMansao(void *contexto, const ParametrosGerador *parametros, const SalaGerada *sala) {
+    (void)parametros;
+    ConstrucaoMansao *c = (ConstrucaoMansao*)contexto;
+    IdSala i = sala->indice;
+    if (i != SALA_ENTRADA) {
+        // As faixas de filhos estão em ordem: o pai é a primeira sala cuja faixa chega a 'i'
+        while (1) {
+            const SalaQuente *quente = &c->quentes[c->pai];
+            uint32_t numFilhos = quente->numSaidas - (c->pai != SALA_ENTRADA);
+            if (numFilhos > 0 && i < c->saidas[quente->primeiraSaida] + numFilhos) {
+                break;
+            }
+            c->pai++;
+        }
+    }
+    c->quentes[i].primeiraSaida = c->numSaidas;
+    c->quentes[i].numSaidas = sala->numFilhos + (i != SALA_ENTRADA);
+    for (uint32_t k = 0; k < sala->numFilhos; k++) {
+        c->saidas[c->numSaidas++] = sala->primeiroFilho + k;
+    }
+    if (i != SALA_ENTRADA) {
+        c->saidas[c->numSaidas++] = c->pai;
+    }
+    c->frias[i].nome = internarTexto(sala->nome);
+    c->frias[i].pista = internarTexto(sala->pista);
+}
+
+/**
+ * @brief Gera a mansão direto na forma compacta (arena da mansão), sem passar
+ * por Salas, e calcula as rotas.
+ */
+void gerarMansaoEmMemoria(const ParametrosGerador *p, Mansao *mansao) {
+    uint32_t capacidadeSaidas = p->numSalas > 1 ? 2 * (p->numSalas - 1) : 1;
+    ConstrucaoMansao c;
+    c.quentes = (SalaQuente*)arenaAlocar(&arenaMansao, p->numSalas * sizeof(SalaQuente));
+    c.frias = (SalaFria*)arenaAlocar(&arenaMansao, p->numSalas * sizeof(SalaFria));
+    c.saidas = (IdSala*)arenaAlocar(&arenaMansao, capacidadeSaidas * sizeof(IdSala));
+    c.numSaidas = 0;
+    c.pai = SALA_ENTRADA;
+
+    mansao->numSalas = gerarMansao(p, receberNaMansao, &c);
+    mansao->numSaidas = c.numSaidas;
+    mansao->quentes = c.quentes;
+    mansao->saidas = c.saidas;
+    mansao->frias = c.frias;
+    mansao->sobDemanda = NULL;
+    construirRotas(mansao);
+}
+
+/**
+ * @brief Receptor que escreve a sala como uma linha da descrição em texto
+ * ("nome | pista | saída | ..."), aceita por --converter.
+ */
+static void receberNoArquivo(void *contexto, const ParametrosGerador *parametros, const SalaGerada *sala) {
+    FILE *arquivo = (FILE*)contexto;
+    char nome[64];
+    fprintf(arquivo, "%s | %s", sala->nome, sala->pista[0] != '\0' ? sala->pista : "-");
+    for (uint32_t k = 0; k < sala->numFilhos; k++) {
+        nomeDaSala(parametros, sala->primeiroFilho + k, nome, sizeof(nome));
+        fprintf(arquivo, " | %s", nome);
+    }
+    fputc('\n', arquivo);
+}
+
+/**
+ * @brief Prepara os parâmetros do gerador depois das regras compiladas: a
+ * mistura ("3,1,1,0" = pesos dos suspeitos na ordem das regras e, por último,
+ * o das pistas neutras; NULL = todos 1) e as palavras-chave de cada suspeito.
+ * @return 1 em caso de sucesso, 0 se a mistura for inválida.
+ */
+int prepararGerador(ParametrosGerador *p, const char *mistura) {
+    uint32_t numSuspeitos = motorRegras.numSuspeitos;
+    p->mistura = (uint32_t*)calloc(numSuspeitos + 1, sizeof(uint32_t));
+    p->inicioPalavras = (uint32_t*)calloc(numSuspeitos + 2, sizeof(uint32_t));
+    p->palavras = (IdTexto*)malloc((motorRegras.numRegras + 1) * sizeof(IdTexto));
+    if (p->mistura == NULL || p->inicioPalavras == NULL || p->palavras == NULL) {
+        perror("Erro ao alocar memoria para o gerador");
+        exit(EXIT_FAILURE);
+    }
+
+    p->totalMistura = 0;
+    const char *c = mistura;
+    for (uint32_t s = 0; s <= numSuspeitos; s++) {
+        if (mistura == NULL) {
+            p->mistura[s] = 1;
+        } else {
+            char *fim;
+            unsigned long peso = strtoul(c, &fim, 10);
+            if (fim == c || peso > 1000000 || (*fim != ',' && *fim != '\0') || (*fim == '\0' && s < numSuspeitos)) {
+                fprintf(stderr, "Mistura invalida: use %u pesos separados por virgula (suspeitos e pistas neutras)\n",
+                        numSuspeitos + 1);
+                return 0;
+            }
+            p->mistura[s] = (uint32_t)peso;
+            c = *fim == ',' ? fim + 1 : fim;
+        }
+        p->totalMistura += p->mistura[s];
+    }
+    if (mistura != NULL && *c != '\0') {
+        fprintf(stderr, "Mistura invalida: mais de %u pesos\n", numSuspeitos + 1);
+        return 0;
+    }
+
+    // Palavras-chave por suspeito (contagem, prefixos, preenchimento)
+    for (uint32_t r = 0; r < motorRegras.numRegras; r++) {
+        p->inicioPalavras[motorRegras.regras[r].suspeito + 1]++;
+    }
+    for (uint32_t s = 0; s < numSuspeitos; s++) {
+        p->inicioPalavras[s + 1] += p->inicioPalavras[s];
+    }
+    uint32_t *proxima = (uint32_t*)malloc((numSuspeitos + 1) * sizeof(uint32_t));
+    if (proxima == NULL) {
+        perror("Erro ao alocar memoria para o gerador");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(proxima, p->inicioPalavras, (numSuspeitos + 1) * sizeof(uint32_t));
+    for (uint32_t r = 0; r < motorRegras.numRegras; r++) {
+        p->palavras[proxima[motorRegras.regras[r].suspeito]++] = motorRegras.regras[r].palavra;
+    }
+    free(proxima);
+    return 1;
+}
+
+void liberarGerador(ParametrosGerador *p) {
+    free(p->mistura);
+    free(p->inicioPalavras);
+    free(p->palavras);
+}
+
+/**
+ * @brief Troca a tabela de textos por uma só com os nomes e as pistas da
+ * mansão gerada, internados na ordem em que --converter os encontra na
+ * descrição em texto (nome, pista e salas novas de cada sala). Assim o .dqm
+ * exportado não leva as palavras-chave e os suspeitos das regras e é igual,
+ * byte a byte, ao convertido do .txt da mesma semente. Os ids das regras
+ * deixam de valer: só serve para gravar a mansão no fim da execução.
+ */
+static void recompactarTextosDaMansao(Mansao *mansao) {
+    TabelaTextos antiga = tabelaTextos;
+    memset(&tabelaTextos, 0, sizeof(tabelaTextos));
+    inicializarTextos();
+
+    IdTexto *novoId = (IdTexto*)malloc(antiga.numTextos * sizeof(IdTexto));
+    SalaFria *frias = (SalaFria*)arenaAlocar(&arenaMansao, mansao->numSalas * sizeof(SalaFria));
+    if (novoId == NULL) {
+        perror("Erro ao alocar memoria para o mapa");
+        exit(EXIT_FAILURE);
+    }
+    for (IdSala i = 0; i < mansao->numSalas; i++) {
+        const SalaQuente *quente = &mansao->quentes[i];
+        uint32_t numFilhos = quente->numSaidas - (i != SALA_ENTRADA); // A volta ao pai vem por último
+        novoId[mansao->frias[i].nome] = internarTexto(antiga.textos[mansao->frias[i].nome]);
+        novoId[mansao->frias[i].pista] = internarTexto(antiga.textos[mansao->frias[i].pista]);
+        for (uint32_t k = 0; k < numFilhos; k++) {
+            IdTexto nome = mansao->frias[mansao->saidas[quente->primeiraSaida + k]].nome;
+            novoId[nome] = internarTexto(antiga.textos[nome]);
+        }
+    }
+    for (IdSala i = 0; i < mansao->numSalas; i++) {
+        frias[i].nome = novoId[mansao->frias[i].nome];
+        frias[i].pista = novoId[mansao->frias[i].pista];
+    }
+    mansao->frias = frias;
+
+    free(novoId);
+    arenaDestruir(&antiga.memoria);
+    free(antiga.textos);
+    free(antiga.hashes);
+    free(antiga.controle);
+    free(antiga.ids);
+}
+
+/**
+ * @brief Grava a mansão gerada: "*.dqm" no formato binário (montada em memória
+ * e gravada como em --converter, só com os textos dela); qualquer outro nome,
+ * na descrição em texto, escrita sala a sala sem montar a mansão.
+ * @return EXIT_SUCCESS ou EXIT_FAILURE.
+ */
+int exportarMansaoGerada(const ParametrosGerador *p, const char *destino) {
+    size_t tamanho = strlen(destino);
+    uint32_t numSalas;
+    if (tamanho >= 4 && strcmp(destino + tamanho - 4, ".dqm") == 0) {
+        Mansao mansao;
+        gerarMansaoEmMemoria(p, &mansao);
+        recompactarTextosDaMansao(&mansao);
+        if (!gravarMansao(destino, &mansao)) {
+            return EXIT_FAILURE;
+        }
+        numSalas = mansao.numSalas;
+    } else {
+        FILE *arquivo = fopen(destino, "w");
+        if (arquivo == NULL) {
+            perror("Erro ao criar arquivo do mapa");
+            return EXIT_FAILURE;
+        }
+        fprintf(arquivo, "# Mansão gerada: %u salas, ramos %u-%u, densidade %u%%, semente %llu",
+                p->numSalas, p->minRamos, p->maxRamos, p->densidade, (unsigned long long)p->semente);
+        if (p->profundidade != UINT32_MAX) {
+            fprintf(arquivo, ", profundidade %u", p->profundidade);
+        }
+        fputc('\n', arquivo);
+        numSalas = gerarMansao(p, receberNoArquivo, arquivo);
+        int ok = !ferror(arquivo);
+        if (fclose(arquivo) != 0 || !ok) {
+            perror("Erro ao gravar arquivo do mapa");
+            return EXIT_FAILURE;
+        }
+    }
+    printf("Mansão gerada: %u salas -> %s\n", numSalas, destino);
+    if (numSalas < p->numSalas) {
+        fprintf(stderr, "Aviso: a profundidade máxima (%u) limitou a mansão a %u salas\n", p->profundidade, numSalas);
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// -------------------- FUNÇÃO PRINCIPAL (MAIN) --------------------
+// -------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+    const char *arquivoMapa = NULL;
+    int sobDemanda = 0;
+    const char *arquivoRegras = NULL;
+    const char *arquivoLote = NULL;
+    long repeticoes = 1;
+    int numThreads = 1;
+    int benchmark = 0;
+    int resolver = 0;
+    size_t tamanhoBenchmark = 0;
+    const char *distribuicaoBenchmark = NULL;
+    const char *arquivoSalvar = NULL;
+    const char *arquivoRetomar = NULL;
+    ModoSaida modoSaida = SAIDA_TEXTO;
+    ParametrosGerador gerador = {0, UINT32_MAX, 0, 3, 30, 1, NULL, 0, NULL, NULL};
+    const char *misturaGerador = NULL;
+    const char *arquivoExportar = NULL;
+    const char *arquivoDiario = NULL;
+    const char *arquivoReproduzir = NULL;
+    NivelDurabilidade durabilidade = DURABILIDADE_LOTE;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--converter") == 0 && i + 2 < argc) {
+            return converterMapa(argv[i + 1], argv[i + 2]);
+        } else if (strcmp(argv[i], "--mapa") == 0 && i + 1 < argc) {
+            arquivoMapa = argv[++i];
+        } else if (strcmp(argv[i], "--sob-demanda") == 0) {
+            sobDemanda = 1;
+        } else if (strcmp(argv[i], "--regras") == 0 && i + 1 < argc) {
+            arquivoRegras = argv[++i];
+        } else if (strcmp(argv[i], "--lote") == 0 && i + 1 < argc) {
+            arquivoLote = argv[++i];
+        } else if (strcmp(argv[i], "--repeticoes") == 0 && i + 1 < argc) {
+            repeticoes = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            numThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--salvar") == 0 && i + 1 < argc) {
+            arquivoSalvar = argv[++i];
+        } else if (strcmp(argv[i], "--retomar") == 0 && i + 1 < argc) {
+            arquivoRetomar = argv[++i];
+        } else if (strcmp(argv[i], "--gerar") == 0 && i + 1 < argc) {
+            gerador.numSalas = (uint32_t)strtoul(argv[++i], NULL, 10);
+            if (gerador.numSalas == 0 || gerador.numSalas > GERADOR_MAX_SALAS) {
+                fprintf(stderr, "--gerar aceita de 1 a %u salas\n", GERADOR_MAX_SALAS);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--profundidade") == 0 && i + 1 < argc) {
+            gerador.profundidade = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ramos") == 0 && i + 1 < argc) {
+            // "máx" (de 0 a máx) ou "mín-máx"
+            char *fim;
+            gerador.minRamos = 0;
+            gerador.maxRamos = (uint32_t)strtoul(argv[++i], &fim, 10);
+            if (*fim == '-') {
+                gerador.minRamos = gerador.maxRamos;
+                gerador.maxRamos = (uint32_t)strtoul(fim + 1, &fim, 10);
+            }
+            if (*fim != '\0' || gerador.maxRamos < 1 || gerador.maxRamos > MAX_CAMPOS_LINHA - 2 ||
+                gerador.minRamos > gerador.maxRamos) {
+                fprintf(stderr, "--ramos aceita [mín-]máx, com máx de 1 a %d saídas novas por sala\n",
+                        MAX_CAMPOS_LINHA - 2);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--densidade") == 0 && i + 1 < argc) {
+            gerador.densidade = (uint32_t)strtoul(argv[++i], NULL, 10);
+            if (gerador.densidade > 100) {
+                fprintf(stderr, "--densidade é uma porcentagem (0 a 100)\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--mistura") == 0 && i + 1 < argc) {
+            misturaGerador = argv[++i];
+        } else if (strcmp(argv[i], "--semente") == 0 && i + 1 < argc) {
+            gerador.semente = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--exportar") == 0 && i + 1 < argc) {
+            arquivoExportar = argv[++i];
+        } else if (strcmp(argv[i], "--diario") == 0 && i + 1 < argc) {
+            arquivoDiario = argv[++i];
+        } else if (strcmp(argv[i], "--durabilidade") == 0 && i + 1 < argc) {
+            const char *nivel = argv[++i];
+            if (strcmp(nivel, "nenhuma") == 0) {
+                durabilidade = DURABILIDADE_NENHUMA;
+            } else if (strcmp(nivel, "lote") == 0) {
+                durabilidade = DURABILIDADE_LOTE;
+            } else if (strcmp(nivel, "sempre") == 0) {
+                durabilidade = DURABILIDADE_SEMPRE;
+            } else {
+                fprintf(stderr, "--durabilidade aceita nenhuma, lote ou sempre\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--reproduzir") == 0 && i + 1 < argc) {
+            arquivoReproduzir = argv[++i];
+        } else if (strcmp(argv[i], "--quieto") == 0) {
+            modoSaida = SAIDA_SILENCIOSA;
+        } else if (strcmp(argv[i], "--ndjson") == 0) {
+            modoSaida = SAIDA_NDJSON;
+        } else if (strcmp(argv[i], "--resolver") == 0) {
+            resolver = 1;
+        } else if (strcmp(argv[i], "--benchmark") == 0) {
+            benchmark = 1;
+        } else if (strcmp(argv[i], "--tamanho") == 0 && i + 1 < argc) {
+            tamanhoBenchmark = (size_t)strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--distribuicao") == 0 && i + 1 < argc) {
+            distribuicaoBenchmark = argv[++i];
+        } else {
+            fprintf(stderr, "Uso: %s [--mapa mansao.dqm [--sob-demanda]] [--regras regras.txt] [--salvar sessao.dqs]\n"
+                            "     %*s [--retomar sessao.dqs] [--quieto | --ndjson] [--diario diario.dqj]\n"
+                            "     %*s [--durabilidade nenhuma|lote|sempre]\n",
+                    argv[0], (int)strlen(argv[0]), "", (int)strlen(argv[0]), "");
+            fprintf(stderr, "     %s --lote roteiros.txt|- [--repeticoes N] [--threads N] [--ndjson] [--diario ...] [--mapa ...] [--regras ...]\n", argv[0]);
+            fprintf(stderr, "     %s --reproduzir diario.dqj [--salvar sessao.dqs] [--mapa ...] [--regras ...]\n", argv[0]);
+            fprintf(stderr, "     %s --resolver [--threads N] [--mapa ...] [--regras ...]\n", argv[0]);
+            fprintf(stderr, "     %s --benchmark [--tamanho N] [--distribuicao aleatoria|ordenada|colisoes]\n", argv[0]);
+            fprintf(stderr, "     %s --converter mansao.txt mansao.dqm|mansao.h\n", argv[0]);
+            fprintf(stderr, "     %s --gerar N [--profundidade D] [--ramos [mín-]máx] [--densidade P] [--mistura 1,1,1,1]\n"
+                            "     %*s [--semente S] [--exportar mansao.txt|mansao.dqm] (ou no lugar de --mapa)\n",
+                    argv[0], (int)strlen(argv[0]), "");
+            return EXIT_FAILURE;
+        }
+    }
+    if (gerador.numSalas > 0 && arquivoMapa != NULL) {
+        fprintf(stderr, "Use --gerar ou --mapa, não os dois\n");
+        return EXIT_FAILURE;
+    }
+    if (arquivoExportar != NULL && gerador.numSalas == 0) {
+        fprintf(stderr, "--exportar só vale com --gerar\n");
+        return EXIT_FAILURE;
+    }
+    if (sobDemanda && arquivoMapa == NULL) {
+        fprintf(stderr, "--sob-demanda só vale com --mapa\n");
+        return EXIT_FAILURE;
+    }
+    if (sobDemanda && (resolver || arquivoSalvar != NULL || arquivoRetomar != NULL)) {
+        // O resolvedor percorre a mansão inteira, e o instantâneo guarda ids de
+        // textos que, sob demanda, só existem na partida que os internou
+        fprintf(stderr, "--sob-demanda não combina com --resolver, --salvar ou --retomar\n");
+        return EXIT_FAILURE;
+    }
+    if (arquivoDiario != NULL && (sobDemanda || resolver || benchmark || arquivoReproduzir != NULL)) {
+        // O diário guarda ids de salas e textos, como o instantâneo
+        fprintf(stderr, "--diario não combina com --sob-demanda, --resolver, --benchmark ou --reproduzir\n");
+        return EXIT_FAILURE;
+    }
+    if (arquivoReproduzir != NULL && (sobDemanda || arquivoLote != NULL || arquivoRetomar != NULL)) {
+        fprintf(stderr, "--reproduzir não combina com --sob-demanda, --lote ou --retomar\n");
+        return EXIT_FAILURE;
+    }
+
+    METRICA(signal(SIGUSR1, tratarSinalMetricas);)
+
+    // Carrega a mansão (do arquivo ou a embutida; a gerada vem depois das
+    // regras, porque as pistas usam as palavras-chave delas)
+    MapaArquivo mapa = {NULL, 0};
+    Mansao mansao;
+    if (arquivoMapa != NULL && sobDemanda) {
+        inicializarTextos();
+        if (!abrirMansaoSobDemanda(arquivoMapa, &mansao)) {
+            return EXIT_FAILURE;
+        }
+    } else if (arquivoMapa != NULL) {
+        if (!carregarMansao(arquivoMapa, &mapa, &mansao)) {
+            return EXIT_FAILURE;
+        }
+    } else if (gerador.numSalas > 0) {
+        inicializarTextos();
+    } else {
+        abrirMansaoEmbutida(&mansao);
+    }
+
+    // Regras de atribuição pista -> suspeito
+    if (arquivoRegras != NULL) {
+        if (!carregarRegras(&motorRegras, arquivoRegras)) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        carregarRegrasPadrao(&motorRegras);
+    }
+    compilarRegras(&motorRegras);
+
+    if (gerador.numSalas > 0) {
+        if (!prepararGerador(&gerador, misturaGerador)) {
+            return EXIT_FAILURE;
+        }
+        if (arquivoExportar != NULL) {
+            int exportado = exportarMansaoGerada(&gerador, arquivoExportar);
+            liberarGerador(&gerador);
+            return exportado;
+        }
+        gerarMansaoEmMemoria(&gerador, &mansao);
+        liberarGerador(&gerador);
+    }
+
+    // O diário é aberto só agora: o cabeçalho confere a mansão e as regras
+    Diario diario;
+    if (arquivoDiario != NULL && !abrirDiario(&diario, arquivoDiario, &mansao, durabilidade)) {
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    if (benchmark) {
+        status = executarBenchmark(tamanhoBenchmark, distribuicaoBenchmark);
+    } else if (resolver) {
+        status = resolverMansao(&mansao, numThreads);
+    } else if (arquivoReproduzir != NULL) {
+        status = reproduzirDiario(arquivoReproduzir, &mansao, arquivoSalvar);
+    } else if (arquivoLote != NULL) {
+        status = executarLote(arquivoLote, repeticoes, numThreads, &mansao, modoSaida == SAIDA_NDJSON,
+                              arquivoDiario != NULL ? &diario : NULL);
+    } else {
+        // Inicia a Lógica do Jogo
+        FonteEntrada teclado = {stdin, NULL, 0, 0};
+        Sessao sessao;
+        criarSessao(&sessao, &mansao, &motorRegras);
+        configurarSaida(&sessao, modoSaida, stdout);
+        if (arquivoDiario != NULL) {
+            sessao.diario = &diario;
+        }
+        exibir(&sessao, "============================================\n");
+        exibir(&sessao, "   🕵️‍♂️ DETECTIVE QUEST: O MISTÉRIO DA MANSÃO 🕵️‍♀️\n");
+        exibir(&sessao, "   Explore a mansão para coletar pistas.\n");
+        if (arquivoSalvar != NULL) {
+            exibir(&sessao, "   Digite [**p**] para pausar e salvar em %s.\n", arquivoSalvar);
+        }
+        exibir(&sessao, "============================================\n");
+
+        // Exploração e julgamento, um passo por entrada do jogador
+        if (arquivoRetomar != NULL) {
+            if (retomarSessao(&sessao, arquivoRetomar)) {
+                registrarRetomada(&sessao);
+                apresentarRetomada(&sessao);
+            } else {
+                status = EXIT_FAILURE;
+                sessao.estado = JOGO_FIM;
+            }
+        } else {
+            if (sessao.diario != NULL) {
+                sessao.saida.partida = reservarPartidas(&diario, 1);
+            }
+            iniciarPartida(&sessao);
+        }
+        continuarPartida(&sessao, &teclado, arquivoSalvar);
+        liberarSessao(&sessao);
+    }
+
+    if (arquivoDiario != NULL && !fecharDiario(&diario)) {
+        status = EXIT_FAILURE;
+    }
+
+    METRICA(despejarMetricas(stderr);)
 
     // Limpeza de Memória
-    // Liberar a memória da Árvore Binária da Mansão (Opcional, mas boa prática)
-    // Nota: Deixado de fora para simplificação do main e foco nos requisitos.
-    liberarPistas(raizPistas);
-    liberarHash();
+    arenaDestruir(&arenaMansao);
+    liberarRegras(&motorRegras);
+    liberarTextos();
+    fecharMapa(&mapa);
+    fecharMansaoSobDemanda(&mansao);
     
-    return 0;
+    return status;
 }
\ No newline at end of file
@@ -1,106 +1,290 @@
+#define _POSIX_C_SOURCE 199309L // clock_gettime também com -std=c11
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define TAMANHO_SAIDA (64 * 1024)   // buffer da saída do jogo
+#define SEM_SALA -1                 // caminho inexistente
 
 // ------------------------------------------------------------
 // Estrutura da sala (nó da árvore)
+// Os caminhos são índices na tabela de salas, não ponteiros:
+// assim a tabela inteira é constante (ver mapaMansao).
 // ------------------------------------------------------------
 typedef struct Sala {
     char nome[50];           // Nome do cômodo
-    struct Sala *esq;        // Caminho à esquerda
-    struct Sala *dir;        // Caminho à direita
+    int esq;                 // Caminho à esquerda (SEM_SALA se não houver)
+    int dir;                 // Caminho à direita
 } Sala;
 
 // ------------------------------------------------------------
-// Função criarSala()
-// Cria dinamicamente uma sala com um nome e retorna seu ponteiro
+// Mapa fixo da mansão (a entrada é a sala 0)
+//
+//                  Hall de Entrada
+//             ┌───────────┴──────────┐
+//       Sala de Estar             Cozinha
+//       ┌─────┴─────┐          ┌─────┴──────┐
+//   Biblioteca    Jardim    Despensa   Sala Secreta
+//
+// A tabela fica na seção somente leitura do executável: nada é
+// alocado nem copiado ao iniciar, e as páginas são compartilhadas
+// entre os processos do jogo.
 // ------------------------------------------------------------
-Sala* criarSala(const char *nome) {
-    Sala *nova = (Sala*) malloc(sizeof(Sala));
-    if (nova == NULL) {
-        printf("Erro ao alocar memória.\n");
-        exit(1);
+static const Sala mapaMansao[] = {
+    { "Hall de Entrada", 1, 2 },
+    { "Sala de Estar",   3, 4 },
+    { "Cozinha",         5, 6 },
+    { "Biblioteca",      SEM_SALA, SEM_SALA },
+    { "Jardim",          SEM_SALA, SEM_SALA },
+    { "Despensa",        SEM_SALA, SEM_SALA },
+    { "Sala Secreta",    SEM_SALA, SEM_SALA },
+};
+
+// ------------------------------------------------------------
+// Saída do jogo: texto para o jogador, nada (--quieto e modo em
+// lote) ou uma linha JSON por evento (--ndjson). Tudo passa por
+// um buffer grande, entregue de uma vez quando enche, antes de
+// ler o teclado e no fim, em vez de um printf por linha.
+// ------------------------------------------------------------
+enum { SAIDA_TEXTO, SAIDA_SILENCIOSA, SAIDA_NDJSON };
+int modoSaida = SAIDA_TEXTO;
+char bufferSaida[TAMANHO_SAIDA];
+size_t usadoSaida = 0;
+long partidaAtual = 0;        // número da partida nos eventos
+
+// ------------------------------------------------------------
+// Modo em lote: os movimentos vêm de um roteiro em memória
+// (ver executarLote()).
+// ------------------------------------------------------------
+const char *roteiro = NULL;   // NULL = movimentos lidos do teclado
+
+// ------------------------------------------------------------
+// Função descarregarSaida()
+// Entrega ao stdout tudo o que está no buffer.
+// ------------------------------------------------------------
+void descarregarSaida(void) {
+    if (usadoSaida == 0) return;
+    fwrite(bufferSaida, 1, usadoSaida, stdout);
+    fflush(stdout);
+    usadoSaida = 0;
+}
+
+// ------------------------------------------------------------
+// Função mostrar()
+// printf do jogo: escreve no buffer, e só no modo texto.
+// ------------------------------------------------------------
+void mostrar(const char *formato, ...) {
+    if (modoSaida != SAIDA_TEXTO) return;
+    va_list args;
+    for (int tentativa = 0; tentativa < 2; tentativa++) {
+        va_start(args, formato);
+        int n = vsnprintf(bufferSaida + usadoSaida, TAMANHO_SAIDA - usadoSaida, formato, args);
+        va_end(args);
+        if (n < 0) return;
+        if ((size_t) n < TAMANHO_SAIDA - usadoSaida) {
+            usadoSaida += (size_t) n;
+            return;
+        }
+        descarregarSaida();   // não coube: esvazia e tenta de novo
+    }
+    va_start(args, formato);  // maior que o buffer inteiro
+    vprintf(formato, args);
+    va_end(args);
+}
+
+// ------------------------------------------------------------
+// Função evento()
+// No modo NDJSON, escreve {"partida":N,"evento":"tipo",...} com
+// os pares campo/valor seguintes (textos, terminados por NULL).
+// ------------------------------------------------------------
+void evento(const char *tipo, ...) {
+    if (modoSaida != SAIDA_NDJSON) return;
+    char linha[1024];
+    size_t n = (size_t) snprintf(linha, sizeof(linha), "{\"partida\":%ld,\"evento\":\"%s\"", partidaAtual, tipo);
+    va_list args;
+    va_start(args, tipo);
+    const char *campo;
+    while ((campo = va_arg(args, const char*)) != NULL) {
+        const unsigned char *valor = va_arg(args, const unsigned char*);
+        int k = snprintf(linha + n, sizeof(linha) - n, ",\"%s\":\"", campo);
+        if (k < 0 || n + (size_t) k + 8 >= sizeof(linha)) break; // Sem espaço: os campos restantes ficam de fora
+        n += (size_t) k;
+        for (; *valor != '\0' && n + 8 < sizeof(linha); valor++) {
+            if (*valor == '"' || *valor == '\\') {
+                linha[n++] = '\\';
+                linha[n++] = (char) *valor;
+            } else if (*valor < 0x20) {
+                n += (size_t) sprintf(linha + n, "\\u%04x", *valor);
+            } else {
+                linha[n++] = (char) *valor;
+            }
+        }
+        linha[n++] = '"';
     }
-    strcpy(nova->nome, nome);
-    nova->esq = NULL;
-    nova->dir = NULL;
-    return nova;
+    va_end(args);
+    linha[n++] = '}';
+    linha[n++] = '\n';
+    if (usadoSaida + n > TAMANHO_SAIDA) descarregarSaida();
+    memcpy(bufferSaida + usadoSaida, linha, n);
+    usadoSaida += n;
+}
+
+// ------------------------------------------------------------
+// Função lerOpcao()
+// Lê o próximo caractere que não seja espaço, do roteiro ou do
+// teclado. Retorna 0 quando a entrada acaba.
+// ------------------------------------------------------------
+int lerOpcao(char *opcao) {
+    if (roteiro != NULL) {
+        while (*roteiro != '\0' && isspace((unsigned char) *roteiro)) roteiro++;
+        if (*roteiro == '\0') return 0;
+        *opcao = *roteiro++;
+        return 1;
+    }
+    descarregarSaida();   // o jogador precisa ver a pergunta
+    return scanf(" %c", opcao) == 1;
 }
 
 // ------------------------------------------------------------
 // Função explorarSalas()
-// Permite o jogador navegar pela árvore binária
+// Permite o jogador navegar pela árvore binária, a partir da
+// sala de índice 'entrada' da tabela 'salas'.
 // ------------------------------------------------------------
-void explorarSalas(Sala *atual) {
+void explorarSalas(const Sala *salas, int entrada) {
     char escolha;
+    const Sala *atual = &salas[entrada];
 
-    while (atual != NULL) {
-        printf("\nVocê está em: **%s**\n", atual->nome);
+    while (1) {
+        mostrar("\nVocê está em: **%s**\n", atual->nome);
+        evento("sala", "sala", atual->nome, NULL);
 
         // Se não houver mais caminhos, termina a exploração
-        if (atual->esq == NULL && atual->dir == NULL) {
-            printf("Você chegou a um cômodo sem saídas. Fim da exploração!\n");
+        if (atual->esq == SEM_SALA && atual->dir == SEM_SALA) {
+            mostrar("Você chegou a um cômodo sem saídas. Fim da exploração!\n");
             return;
         }
 
-        printf("Escolha o caminho:\n");
-        if (atual->esq != NULL) printf("  (e) - Ir para %s (esquerda)\n", atual->esq->nome);
-        if (atual->dir != NULL) printf("  (d) - Ir para %s (direita)\n", atual->dir->nome);
-        printf("  (s) - Sair da mansão\n");
-        printf("Opção: ");
-        scanf(" %c", &escolha);
+        mostrar("Escolha o caminho:\n");
+        if (atual->esq != SEM_SALA) mostrar("  (e) - Ir para %s (esquerda)\n", salas[atual->esq].nome);
+        if (atual->dir != SEM_SALA) mostrar("  (d) - Ir para %s (direita)\n", salas[atual->dir].nome);
+        mostrar("  (s) - Sair da mansão\n");
+        mostrar("Opção: ");
+        if (!lerOpcao(&escolha)) {
+            escolha = 's';   // fim da entrada
+        }
 
-        if (escolha == 'e' && atual->esq != NULL) {
-            atual = atual->esq;
+        if (escolha == 'e' && atual->esq != SEM_SALA) {
+            atual = &salas[atual->esq];
         } 
-        else if (escolha == 'd' && atual->dir != NULL) {
-            atual = atual->dir;
+        else if (escolha == 'd' && atual->dir != SEM_SALA) {
+            atual = &salas[atual->dir];
         } 
         else if (escolha == 's') {
-            printf("Saindo da mansão...\n");
+            mostrar("Saindo da mansão...\n");
             return;
         } 
         else {
-            printf("Opção inválida. Tente novamente.\n");
+            mostrar("Opção inválida. Tente novamente.\n");
         }
     }
 }
 
 // ------------------------------------------------------------
-// Função main()
-// Monta manualmente o mapa da mansão e inicia a exploração
+// Função executarLote()
+// Cada linha do arquivo é uma partida (ex.: "eds"). O arquivo
+// inteiro é lido uma vez e repetido 'repeticoes' vezes, sem
+// saída; no fim mostra quantas partidas por segundo rodaram.
 // ------------------------------------------------------------
-int main() {
+int executarLote(const char *caminho, long repeticoes, const Sala *salas) {
+    FILE *arquivo = strcmp(caminho, "-") == 0 ? stdin : fopen(caminho, "rb");
+    if (arquivo == NULL) {
+        printf("Erro ao abrir roteiro %s.\n", caminho);
+        return 1;
+    }
+    size_t capacidade = 4096, tamanho = 0;
+    char *texto = (char*) malloc(capacidade);
+    while (texto != NULL) {
+        tamanho += fread(texto + tamanho, 1, capacidade - tamanho - 1, arquivo);
+        if (tamanho < capacidade - 1) break;
+        capacidade *= 2;
+        texto = (char*) realloc(texto, capacidade);
+    }
+    if (arquivo != stdin) fclose(arquivo);
+    if (texto == NULL) {
+        printf("Erro ao alocar memória.\n");
+        exit(1);
+    }
+    texto[tamanho] = '\0';
 
-    // Construção da árvore (mansão)
-    //
-    //                Hall de Entrada
-    //                 /            \
-    //         Sala de Estar      Cozinha
-    //           /      \          /     \
-    //     Biblioteca  Jardim  Despensa  Sala Secreta
+    // Uma string por linha (troca os '\n' por '\0')
+    for (size_t i = 0; i < tamanho; i++) {
+        if (texto[i] == '\n') texto[i] = '\0';
+    }
+
+    long partidas = 0;
+    struct timespec inicio, fim;
+    int modoAnterior = modoSaida;
+    if (modoSaida != SAIDA_NDJSON) modoSaida = SAIDA_SILENCIOSA;
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+    for (long r = 0; r < repeticoes; r++) {
+        for (size_t i = 0; i < tamanho; i += strlen(texto + i) + 1) {
+            const char *linha = texto + i;
+            while (isspace((unsigned char) *linha)) linha++;
+            if (*linha == '\0' || *linha == '#') continue;
+            roteiro = linha;
+            partidaAtual = partidas;
+            explorarSalas(salas, 0);
+            partidas++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &fim);
+    descarregarSaida();
+    modoSaida = modoAnterior;
+    roteiro = NULL;
+    free(texto);
 
-    Sala *hall        = criarSala("Hall de Entrada");
-    Sala *estar       = criarSala("Sala de Estar");
-    Sala *cozinha     = criarSala("Cozinha");
-    Sala *biblioteca  = criarSala("Biblioteca");
-    Sala *jardim      = criarSala("Jardim");
-    Sala *despensa    = criarSala("Despensa");
-    Sala *secreta     = criarSala("Sala Secreta");
+    // Com --ndjson o stdout é só de eventos: a vazão vai para o stderr
+    double segundos = (fim.tv_sec - inicio.tv_sec) + (fim.tv_nsec - inicio.tv_nsec) / 1e9;
+    fprintf(modoSaida == SAIDA_NDJSON ? stderr : stdout, "Lote: %ld partidas em %.3f s = %.0f partidas/s\n",
+            partidas, segundos, segundos > 0 ? partidas / segundos : 0.0);
+    return 0;
+}
 
-    // Ligações da árvore
-    hall->esq = estar;
-    hall->dir = cozinha;
+// ------------------------------------------------------------
+// Função main()
+// Usa o mapa fixo da mansão e inicia a exploração
+// ------------------------------------------------------------
+int main(int argc, char *argv[]) {
+    const char *arquivoLote = NULL;
+    long repeticoes = 1;
 
-    estar->esq = biblioteca;
-    estar->dir = jardim;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--lote") == 0 && i + 1 < argc) {
+            arquivoLote = argv[++i];
+        } else if (strcmp(argv[i], "--repeticoes") == 0 && i + 1 < argc) {
+            repeticoes = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--quieto") == 0) {
+            modoSaida = SAIDA_SILENCIOSA;
+        } else if (strcmp(argv[i], "--ndjson") == 0) {
+            modoSaida = SAIDA_NDJSON;
+        } else {
+            printf("Uso: %s [--quieto | --ndjson] [--lote roteiros.txt|- [--repeticoes N]]\n", argv[0]);
+            return 1;
+        }
+    }
 
-    cozinha->esq = despensa;
-    cozinha->dir = secreta;
+    if (arquivoLote != NULL) {
+        return executarLote(arquivoLote, repeticoes, mapaMansao);
+    }
 
     // Iniciar exploração
-    printf("===== Detective Quest: Exploração da Mansão =====\n");
-    explorarSalas(hall);
+    mostrar("===== Detective Quest: Exploração da Mansão =====\n");
+    explorarSalas(mapaMansao, 0);
+    descarregarSaida();
 
     return 0;
 }